@@ -631,6 +631,22 @@ ctrl_stat_con (svz_socket_t *sock, int flag, UNUSED char *arg)
 }
 
 #if ENABLE_HTTP_PROTO
+static void
+stat_cache_internal (UNUSED void *k, void *v, void *closure)
+{
+  svz_socket_t *sock = closure;
+  http_cache_entry_t *cache = v;
+  char *p;
+
+  p = cache->file;
+  p += strlen (cache->file);
+  while (*p != '/' && *p != '\\' && p != cache->file) p--;
+  if (p != cache->file) p++;
+  svz_sock_printf (sock, "%-30s %6d %6d %5d %-5s\r\n", p,
+                   cache->size, cache->usage, cache->hits,
+                   cache->ready ? "Yes" : "No");
+}
+
 /*
  * HTTP cache statistics.  The following displayed information is a
  * visual representation of the http cache structures.
@@ -638,32 +654,18 @@ ctrl_stat_con (svz_socket_t *sock, int flag, UNUSED char *arg)
 int
 ctrl_stat_cache (svz_socket_t *sock, int flag, UNUSED char *arg)
 {
-  int n, total, files;
-  char *p;
-  http_cache_entry_t *cache;
-
   svz_sock_printf (sock, "\r\n%s",
                    "File                             "
-                   "Size  Usage  Hits Recent Ready\r\n");
+                   "Size  Usage  Hits Ready\r\n");
 
-  files = total = n = 0;
   /* go through each cache entry */
-  for (cache = http_cache_first; cache; cache = cache->next, n++)
-    {
-      files++;
-      total += cache->size;
-      p = cache->file;
-      p += strlen (cache->file);
-      while (*p != '/' && *p != '\\' && p != cache->file) p--;
-      if (p != cache->file) p++;
-      svz_sock_printf (sock, "%-30s %6d %6d %5d %6d %-5s\r\n", p,
-                       cache->size, cache->usage, cache->hits, n,
-                       cache->ready ? "Yes" : "No");
-    }
+  if (http_cache)
+    svz_hash_foreach (stat_cache_internal, http_cache, sock);
 
   /* print cache summary */
-  svz_sock_printf (sock, "\r\nTotal : %d byte in %d cache entries\r\n\r\n",
-                   total, files);
+  svz_sock_printf (sock, "\r\nTotal : %zu of %zu byte in %zu cache entries"
+                   "\r\n\r\n", http_cache_bytes, http_cache_limit,
+                   http_cache ? svz_hash_size (http_cache) : 0);
 
   return flag;
 }
@@ -674,10 +676,10 @@ ctrl_stat_cache (svz_socket_t *sock, int flag, UNUSED char *arg)
 int
 ctrl_kill_cache (svz_socket_t *sock, int flag, UNUSED char *arg)
 {
-  svz_sock_printf (sock, "%d HTTP cache entries reinitialized.\r\n",
-                   http_cache_entries);
+  svz_sock_printf (sock, "%zu HTTP cache entries reinitialized.\r\n",
+                   http_cache ? svz_hash_size (http_cache) : 0);
   http_free_cache ();
-  http_alloc_cache (http_cache_entries);
+  http_alloc_cache (http_cache_limit);
   return flag;
 }
 #endif /* ENABLE_HTTP_PROTO */
@@ -710,8 +712,39 @@ stat_coservers_internal (const svz_coserver_t *coserver,
 int
 ctrl_stat_coservers (svz_socket_t *sock, int flag, UNUSED char *arg)
 {
+  static const int cached[] =
+    { SVZ_COSERVER_DNS, SVZ_COSERVER_REVERSE_DNS };
+  static const char *name[] = { "dns", "reverse dns" };
+  size_t n, entries;
+  unsigned long hits, misses;
+  const char *type;
+  int count, queued;
+  long latency;
+
   /* go through all internal coserver instances */
   svz_foreach_coserver (stat_coservers_internal, sock);
+
+  /* show the load of each coserver type */
+  for (n = 0; n < SVZ_MAX_COSERVER_TYPES; n++)
+    if ((type = svz_coserver_load (n, &count, &queued, &latency)) != NULL
+        && count > 0)
+      svz_sock_printf (sock,
+                       "\r\n%s coservers:\r\n"
+                       " instances  : %d (at most %d)\r\n"
+                       " waiting    : %d\r\n"
+                       " latency    : %ld msec\r\n",
+                       type, count, SVZ_RUNPARM (MAX_COSERVERS),
+                       queued, latency);
+
+  /* show the lookup cache statistics */
+  for (n = 0; n < sizeof (cached) / sizeof (cached[0]); n++)
+    if (!svz_coserver_cache_stats (cached[n], &entries, &hits, &misses))
+      svz_sock_printf (sock,
+                       "\r\n%s cache:\r\n"
+                       " entries    : %u\r\n"
+                       " hits       : %lu\r\n"
+                       " misses     : %lu\r\n",
+                       name[n], (unsigned) entries, hits, misses);
   svz_sock_printf (sock, "\r\n");
   return flag;
 }
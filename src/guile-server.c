@@ -882,6 +882,67 @@ For instance, you can arrange for Serveez to pass the
 #undef FUNC_NAME
 }
 
+SCM_DEFINE
+(guile_sock_frame,
+ "svz:sock:frame", 4, 3, 0,
+ (SCM sock, SCM size, SCM offset, SCM width, SCM big_endian, SCM max,
+  SCM inclusive),
+ doc: /***********
+Setup the socket @var{sock} to parse length-prefixed packets.  Each
+packet starts with a header of @var{size} bytes which contains the
+length of the data following the header as an unsigned number of
+@var{width} (1, 2 or 4) bytes at @var{offset}.  The length is read in
+network byte order if the optional argument @var{big-endian} is
+@code{#t} and in little endian byte order otherwise.  If the optional
+argument @var{inclusive} is @code{#t}, the length counts the header as
+well.  Packets larger than @var{max} bytes (header inclusive) are
+rejected.
+
+The socket's @code{handle-request} callback is run for each complete
+packet, header inclusive.  Return @code{#t} on success and @code{#f}
+if the given packet layout is invalid.  */)
+{
+#define FUNC_NAME s_guile_sock_frame
+  svz_socket_t *xsock;
+  int flags = 0, xmax = 0;
+
+  CHECK_SMOB_ARG (socket, sock, SCM_ARG1, "svz-socket", xsock);
+  ASSERT_EXACT (2, size);
+  ASSERT_EXACT (3, offset);
+  ASSERT_EXACT (4, width);
+  if (!SCM_UNBNDP (big_endian))
+    {
+      SCM_ASSERT_TYPE (SCM_BOOLP (big_endian), big_endian,
+                       SCM_ARG5, FUNC_NAME, "boolean");
+      if (gi_nfalsep (big_endian))
+        flags |= SVZ_FRAME_BIG_ENDIAN;
+    }
+  if (!SCM_UNBNDP (max))
+    {
+      ASSERT_EXACT (6, max);
+      xmax = gi_scm2int (max);
+    }
+  if (!SCM_UNBNDP (inclusive))
+    {
+      SCM_ASSERT_TYPE (SCM_BOOLP (inclusive), inclusive,
+                       SCM_ARG7, FUNC_NAME, "boolean");
+      if (gi_nfalsep (inclusive))
+        flags |= SVZ_FRAME_INCLUSIVE;
+    }
+
+  /* Only connection oriented protocols can handle this.  */
+  if (!(xsock->proto & (SVZ_PROTO_TCP | SVZ_PROTO_PIPE)))
+    return SCM_BOOL_F;
+
+  /* Release previously set boundaries.  */
+  guile_sock_clear_boundary (xsock);
+
+  return SCM_BOOL (svz_sock_setframe (xsock, gi_scm2int (size),
+                                      gi_scm2int (offset), gi_scm2int (width),
+                                      flags, xmax) == 0);
+#undef FUNC_NAME
+}
+
 SCM_DEFINE
 (guile_sock_floodprotect,
  "svz:sock:floodprotect", 1, 1, 0,
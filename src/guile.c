@@ -58,6 +58,14 @@
 #define PORTCFG_IP      "ipaddr"
 #define PORTCFG_DEVICE  "device"
 #define PORTCFG_BACKLOG "backlog"
+#define PORTCFG_RBUDGET "read-budget"
+#define PORTCFG_WBUDGET "write-budget"
+#define PORTCFG_DEFER   "defer-accept"
+#define PORTCFG_TFO     "fastopen"
+#define PORTCFG_RCVBUF  "so-rcvbuf"
+#define PORTCFG_SNDBUF  "so-sndbuf"
+#define PORTCFG_LOWAT   "notsent-lowat"
+#define PORTCFG_ZCOPY   "zerocopy"
 #define PORTCFG_TYPE    "type"
 
 /* Pipe definitions.  */
@@ -73,6 +81,8 @@
 /* Miscellaneous definitions.  */
 #define PORTCFG_SEND_BUFSIZE "send-buffer-size"
 #define PORTCFG_RECV_BUFSIZE "recv-buffer-size"
+#define PORTCFG_SEND_BUFMAX  "send-buffer-limit"
+#define PORTCFG_RECV_BUFMAX  "recv-buffer-limit"
 #define PORTCFG_FREQ         "connect-frequency"
 #define PORTCFG_ALLOW        "allow"
 #define PORTCFG_DENY         "deny"
@@ -1169,6 +1179,23 @@ Emit error messages (to stderr).  */)
       SVZ_CFG_TCP (cfg, port) = port;
       err |= optionhash_extract_int (options, PORTCFG_BACKLOG, 1, 0,
                                      &SVZ_CFG_TCP (cfg, backlog), action);
+      err |= optionhash_extract_int (options, PORTCFG_RBUDGET, 1, 0,
+                                     &SVZ_CFG_TCP (cfg, read_budget), action);
+      err |= optionhash_extract_int (options, PORTCFG_WBUDGET, 1, 0,
+                                     &SVZ_CFG_TCP (cfg, write_budget), action);
+      err |= optionhash_extract_int (options, PORTCFG_DEFER, 1, 0,
+                                     &SVZ_CFG_TCP (cfg, defer_accept), action);
+      err |= optionhash_extract_int (options, PORTCFG_TFO, 1, 0,
+                                     &SVZ_CFG_TCP (cfg, fastopen), action);
+      err |= optionhash_extract_int (options, PORTCFG_RCVBUF, 1, 0,
+                                     &SVZ_CFG_TCP (cfg, rcvbuf), action);
+      err |= optionhash_extract_int (options, PORTCFG_SNDBUF, 1, 0,
+                                     &SVZ_CFG_TCP (cfg, sndbuf), action);
+      err |= optionhash_extract_int (options, PORTCFG_LOWAT, 1, 0,
+                                     &SVZ_CFG_TCP (cfg, notsent_lowat),
+                                     action);
+      err |= optionhash_extract_int (options, PORTCFG_ZCOPY, 1, 0,
+                                     &SVZ_CFG_TCP (cfg, zerocopy), action);
       err |= optionhash_extract_string (options, PORTCFG_IP, 1,
                                         SVZ_PORTCFG_NOIP,
                                         &SVZ_CFG_TCP (cfg, ipaddr), action);
@@ -1303,6 +1330,10 @@ Emit error messages (to stderr).  */)
                                  &(cfg->send_buffer_size), action);
   err |= optionhash_extract_int (options, PORTCFG_RECV_BUFSIZE, 1, 0,
                                  &(cfg->recv_buffer_size), action);
+  err |= optionhash_extract_int (options, PORTCFG_SEND_BUFMAX, 1, 0,
+                                 &(cfg->send_buffer_limit), action);
+  err |= optionhash_extract_int (options, PORTCFG_RECV_BUFMAX, 1, 0,
+                                 &(cfg->recv_buffer_limit), action);
 
   /* Acquire the connect frequency.  */
   if (cfg->proto & SVZ_PROTO_TCP)
@@ -1711,6 +1742,21 @@ This setting is overridden by the command-line @samp{-m} option.  */)
                         max);
 }
 
+SCM_DEFINE
+(guile_access_maxcoservers,
+ "serveez-maxcoservers", 0, 1, 0,
+ (SCM max),
+ doc: /***********
+Return the maximum number of instances of each coserver type
+(an integer).  Serveez starts more instances up to this number
+if requests pile up.  Optional arg @var{max} means set it to that
+number, instead.  */)
+{
+  return parm_accessor (s_guile_access_maxcoservers,
+                        SVZ_RUNPARM_MAX_COSERVERS,
+                        max);
+}
+
 #if ENABLE_CONTROL_PROTO
 extern char *control_protocol_password;
 #else
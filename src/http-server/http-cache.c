@@ -31,6 +31,10 @@
 #if HAVE_FLOSS_H
 # include <floss.h>
 #endif
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#include "o-binary.h"
 #include "networking-headers.h"
 
 #ifdef __MINGW32__
@@ -50,54 +54,111 @@
 #include "unused.h"
 
 svz_hash_t *http_cache = NULL;               /* actual cache entry hash */
-size_t http_cache_entries = 0;               /* amount of cache entries */
+size_t http_cache_limit = 0;                 /* cache memory limit */
+size_t http_cache_bytes = 0;                 /* cache memory in use */
 http_cache_entry_t *http_cache_first = NULL; /* most recent entry */
 http_cache_entry_t *http_cache_last = NULL;  /* least recent entry */
 
 /*
- * This will initialize the http cache entries.
+ * Admission to a full cache is decided by the frequency of recent
+ * requests for a file (TinyLFU): a new file only displaces entries
+ * requested less often than itself.  The frequencies are estimated by
+ * a count-min sketch of HTTP_SKETCH_ROWS rows of 4 bit counters which
+ * are halved every HTTP_SKETCH_SAMPLES requests.
  */
-void
-http_alloc_cache (size_t entries)
+#define HTTP_SKETCH_ROWS    4
+#define HTTP_SKETCH_WIDTH   4096
+#define HTTP_SKETCH_SAMPLES (HTTP_SKETCH_WIDTH * 8)
+
+static unsigned char http_sketch[HTTP_SKETCH_ROWS][HTTP_SKETCH_WIDTH];
+static unsigned long http_sketch_samples = 0;
+
+/*
+ * Return the hash code of the filename FILE used by the sketch.
+ */
+static unsigned long
+http_cache_code (const char *file)
+{
+  unsigned long code = 2166136261UL;
+
+  while (*file)
+    code = (code ^ (unsigned char) *file++) * 16777619UL;
+  return code;
+}
+
+/*
+ * Return the index of the counter in row ROW of the sketch for the hash
+ * code CODE.
+ */
+static unsigned
+http_sketch_index (unsigned long code, int row)
 {
-  if (entries > http_cache_entries || http_cache == NULL)
+  unsigned long step = (code >> 16) | 1;
+
+  return (unsigned) ((code + row * step) & (HTTP_SKETCH_WIDTH - 1));
+}
+
+/*
+ * Return the estimated number of recent requests for the file with the
+ * hash code CODE.
+ */
+static int
+http_sketch_estimate (unsigned long code)
+{
+  int row, n, min = 15;
+
+  for (row = 0; row < HTTP_SKETCH_ROWS; row++)
     {
-      if (http_cache)
-        http_free_cache ();
-      http_cache = svz_hash_create (entries, NULL);
-      http_cache_entries = entries;
-#if ENABLE_DEBUG
-      svz_log (SVZ_LOG_DEBUG, "cache: created %d cache entries\n", entries);
-#endif
+      n = http_sketch[row][http_sketch_index (code, row)];
+      if (n < min)
+        min = n;
     }
+  return min;
 }
 
 /*
- * Free all the cache entries.
+ * Count another request for the file with the hash code CODE.
  */
-void
-http_free_cache (void)
+static void
+http_sketch_add (unsigned long code)
 {
-  int total, files;
-  http_cache_entry_t *cache, *next;
+  int row;
+  unsigned n;
+  unsigned char *counter;
 
-  files = total = 0;
-  for (cache = http_cache_first; cache; cache = next)
+  for (row = 0; row < HTTP_SKETCH_ROWS; row++)
     {
-      next = cache->next;
-      total += cache->size;
-      files++;
-      svz_free (cache->buffer);
-      svz_free (cache->file);
-      svz_free (cache);
+      counter = &http_sketch[row][http_sketch_index (code, row)];
+      if (*counter < 15)
+        (*counter)++;
     }
 
-  svz_hash_destroy (http_cache);
-  http_cache_first = http_cache_last = NULL;
-  http_cache = NULL;
+  /* let older requests count less */
+  if (++http_sketch_samples >= HTTP_SKETCH_SAMPLES)
+    {
+      for (row = 0; row < HTTP_SKETCH_ROWS; row++)
+        for (n = 0; n < HTTP_SKETCH_WIDTH; n++)
+          http_sketch[row][n] >>= 1;
+      http_sketch_samples /= 2;
+    }
+}
+
+/*
+ * This will initialize the http cache allowing it to use at most LIMIT
+ * bytes.  The biggest limit ever given wins.
+ */
+void
+http_alloc_cache (size_t limit)
+{
+  if (http_cache == NULL)
+    http_cache = svz_hash_create (64, NULL);
+  if (limit > http_cache_limit)
+    {
+      http_cache_limit = limit;
 #if ENABLE_DEBUG
-  svz_log (SVZ_LOG_DEBUG, "cache: freeing %d byte in %d entries\n", total, files);
+      svz_log (SVZ_LOG_DEBUG, "cache: using up to %zu byte\n", limit);
 #endif
+    }
 }
 
 #if ENABLE_DEBUG
@@ -114,12 +175,15 @@ cache_consistency_internal (UNUSED void *k, void *v,
   if (!ent->ready)
     assert (!ent->size
             && !ent->buffer
-            && !ent->hits);
-  /* Otherwise, a cache entry must contain something.  */
+            && !ent->hits
+            && !ent->usage);
+  /* Otherwise, a cache entry must contain something, unless it is
+     empty to tell that the encoded file is not smaller.  */
   else
     assert (ent->size >= 0
-            && ent->buffer
-            && ent->hits >= 0);
+            && (ent->buffer || !ent->size)
+            && ent->hits >= 0
+            && ent->usage >= 0);
 }
 
 /*
@@ -153,49 +217,43 @@ http_cache_print (void)
 #endif  /* ENABLE_CACHE_PRINT */
 
 /*
- * Returns the urgency value of the given http cache entry CACHE.
+ * Remove the cache entry CACHE from the list of unused entries.
  */
-int
-http_cache_urgency (http_cache_entry_t *cache)
+static void
+http_cache_unlink (http_cache_entry_t *cache)
 {
-  int n;
-  http_cache_entry_t *entry;
-
-  for (n = 0, entry = http_cache_first; entry; entry = entry->next, n++)
-    if (entry == cache)
-      return n;
-  return -1;
+  if (cache->prev)
+    cache->prev->next = cache->next;
+  else
+    http_cache_first = cache->next;
+  if (cache->next)
+    cache->next->prev = cache->prev;
+  else
+    http_cache_last = cache->prev;
+  cache->next = cache->prev = NULL;
 }
 
 /*
- * This function will make the given cache entry CACHE the most recent
- * within the whole HTTP file cache.  All other used entries will be less
- * urgent afterwards.
+ * Put the cache entry CACHE at the head of the list of unused entries,
+ * making it the most recent one.
  */
-void
-http_urgent_cache (http_cache_entry_t *cache)
+static void
+http_cache_link (http_cache_entry_t *cache)
 {
-  if (cache->prev)
-    {
-      cache->prev->next = cache->next;
-      if (cache->next)
-        cache->next->prev = cache->prev;
-      else
-        http_cache_last = cache->prev;
-      http_cache_first->prev = cache;
-      cache->next = http_cache_first;
-      cache->prev = NULL;
-      http_cache_first = cache;
-    }
+  cache->prev = NULL;
+  if ((cache->next = http_cache_first) == NULL)
+    http_cache_last = cache;
+  else
+    http_cache_first->prev = cache;
+  http_cache_first = cache;
 }
 
 /*
  * This routine checks if a certain FILE is already within the HTTP file
  * cache.  It returns HTTP_CACHE_COMPLETE if it is already cached and fills
- * in the CACHE entry.  This entry will be additionally the most recent
- * afterwards.  If the given FILE is going to be in the cache then return
- * HTTP_CACHE_INCOMPLETE, return HTTP_CACHE_NO if it is not at all in the
- * cache.
+ * in the CACHE entry.  If the given FILE is going to be in the cache then
+ * return HTTP_CACHE_INCOMPLETE, return HTTP_CACHE_NO if it is not at all
+ * in the cache.
  */
 int
 http_check_cache (char *file, http_cache_t *cache)
@@ -204,8 +262,7 @@ http_check_cache (char *file, http_cache_t *cache)
 
   if ((cachefile = svz_hash_get (http_cache, file)) != NULL)
     {
-      /* set this entry to the most recent, ready or not  */
-      http_urgent_cache (cachefile);
+      http_sketch_add (cachefile->code);
       http_cache_consistency ();
 
       /* is this entry fully read by the cache reader?  */
@@ -220,6 +277,7 @@ http_check_cache (char *file, http_cache_t *cache)
       /* not but is going to be ...  */
       return HTTP_CACHE_INCOMPLETE;
     }
+  http_sketch_add (http_cache_code (file));
   return HTTP_CACHE_NO;
 }
 
@@ -245,25 +303,113 @@ http_cache_destroy_entry (http_cache_entry_t *cache)
   http_cache_consistency ();
 
   /* Delete cache entry from hash.  */
-  if (svz_hash_delete (http_cache, cache->file) != cache)
+  if (!cache->stale && svz_hash_delete (http_cache, cache->file) != cache)
     svz_log (SVZ_LOG_FATAL, "cache: inconsistent http hash\n");
 
-  /* Update the double chained list of entries.  */
-  if (cache->prev)
-    cache->prev->next = cache->next;
-  else
-    http_cache_first = cache->next;
-  if (cache->next)
-    cache->next->prev = cache->prev;
-  else
-    http_cache_last = cache->prev;
+  /* Only unused entries are in the list, and stale ones never.  */
+  if (!cache->stale && cache->ready && !cache->usage)
+    http_cache_unlink (cache);
 
+  http_cache_bytes -= cache->length;
+#if HAVE_MMAP && HAVE_SYS_MMAN_H
+  if (cache->mapped)
+    munmap (cache->buffer, cache->size);
+  else
+#endif
   if (cache->ready)
     svz_free (cache->buffer);
   svz_free (cache->file);
   svz_free (cache);
 }
 
+/*
+ * Make sure the cache entry CACHE is kept while it is sent to a client.
+ */
+void
+http_cache_pin (http_cache_entry_t *cache)
+{
+  if (cache->usage++ == 0)
+    http_cache_unlink (cache);
+}
+
+/*
+ * Release the cache entry CACHE previously pinned by ‘http_cache_pin’.
+ * It becomes the most recent entry unless it has been invalidated
+ * meanwhile, in which case it is destroyed.
+ */
+void
+http_cache_release (http_cache_entry_t *cache)
+{
+  if (--cache->usage > 0)
+    return;
+  if (cache->stale)
+    http_cache_destroy_entry (cache);
+  else
+    http_cache_link (cache);
+}
+
+/*
+ * Remove the cache entry CACHE from the cache.  If it is still being
+ * sent or read, it is destroyed as soon as this is done.
+ */
+void
+http_cache_invalidate (http_cache_entry_t *cache)
+{
+  if (cache->stale)
+    return;
+  if (!cache->ready || cache->usage)
+    {
+      svz_hash_delete (http_cache, cache->file);
+      cache->stale = 1;
+    }
+  else
+    http_cache_destroy_entry (cache);
+}
+
+static void
+collect_entry (UNUSED void *k, void *v, void *closure)
+{
+  svz_array_add (closure, v);
+}
+
+/*
+ * Invalidate all cache entries and free the cache.
+ */
+void
+http_free_cache (void)
+{
+  svz_array_t *entries;
+  http_cache_entry_t *cache;
+  size_t n;
+
+  if (http_cache == NULL)
+    return;
+
+  entries = svz_array_create (svz_hash_size (http_cache), NULL);
+  svz_hash_foreach (collect_entry, http_cache, entries);
+  svz_array_foreach (entries, cache, n)
+    http_cache_invalidate (cache);
+  svz_array_destroy (entries);
+
+  svz_hash_destroy (http_cache);
+  http_cache = NULL;
+#if ENABLE_DEBUG
+  svz_log (SVZ_LOG_DEBUG, "cache: %zu byte still in use\n",
+           http_cache_bytes);
+#endif
+}
+
+/*
+ * Destroy the least recent unused entries until the cache uses no more
+ * than its limit.
+ */
+static void
+http_cache_shrink (void)
+{
+  while (http_cache_bytes > http_cache_limit && http_cache_last)
+    http_cache_destroy_entry (http_cache_last);
+}
+
 /*
  * Reset the cache entry of a http sockets cache structure.
  */
@@ -299,62 +445,54 @@ http_cache_disconnect (svz_socket_t *sock)
 }
 
 /*
- * Find a free slot in the http file cache entries.  If necessary
- * delete the least recent.  Return zero if there was a free slot.
+ * Make room in the http file cache for the FILE of SIZE bytes and create
+ * a new entry for it.  Entries currently in use are never dropped, and
+ * the others only if they have been requested less often than FILE.
+ * Return zero if the file can be cached.
  */
 int
-http_init_cache (char *file, http_cache_t *cache)
+http_init_cache (char *file, int size, http_cache_t *cache)
 {
-  http_cache_entry_t *entry, *slot = NULL;
+  http_cache_entry_t *entry, *slot;
+  unsigned long code = http_cache_code (file);
+  long need;
+  int freq;
 
-  /*
-   * If there are still empty cache entries then create a
-   * new cache entry.
-   */
-  if (svz_hash_size (http_cache) < http_cache_entries)
-    {
-      slot = http_cache_create_entry ();
-    }
+  http_cache_reset (cache);
+  if (size <= 0 || (size_t) size > http_cache_limit)
+    return -1;
 
   /*
-   * Otherwise find the least recent which is not currently in
-   * use by the cache writer or reader.
+   * Check whether the least recent unused entries which would have to
+   * go make enough room and are less popular than the new file.
    */
-  else
+  need = (long) (http_cache_bytes + size) - (long) http_cache_limit;
+  if (need > 0)
     {
-      for (entry = http_cache_last; entry; entry = entry->prev)
-        if (!entry->usage && entry->ready)
-          {
-            slot = entry;
-            break;
-          }
-
-      /* not a "reinitialable" cache entry found */
-      if (!slot)
+      freq = http_sketch_estimate (code);
+      for (entry = http_cache_last; entry && need > 0; entry = entry->prev)
         {
-          http_cache_reset (cache);
-          http_cache_consistency ();
-          return -1;
+          if (http_sketch_estimate (entry->code) >= freq)
+            return -1;
+          need -= entry->length;
         }
-
-      /* is currently used, so free the entry previously */
-      http_cache_destroy_entry (slot);
-      slot = http_cache_create_entry ();
+      if (need > 0)
+        return -1;
+      while (http_cache_bytes + size > http_cache_limit)
+        http_cache_destroy_entry (http_cache_last);
     }
 
-  svz_hash_put (http_cache, file, slot);
+  slot = http_cache_create_entry ();
   slot->file = svz_strdup (file);
-  if ((slot->next = http_cache_first) == NULL)
-    http_cache_last = slot;
-  else
-    http_cache_first->prev = slot;
-  http_cache_first = slot;
+  slot->code = code;
+  slot->length = size;
+  http_cache_bytes += size;
+  svz_hash_put (http_cache, file, slot);
 
   /*
    * initialize the cache entry for the cache file reader: cachebuffer
    * is not allocated yet and current cache length is zero
    */
-  http_cache_reset (cache);
   cache->entry = slot;
 
   http_cache_consistency ();
@@ -362,18 +500,160 @@ http_init_cache (char *file, http_cache_t *cache)
 }
 
 /*
- * Refresh a certain cache entry for reusing it afterwards.  So we do not
- * destroy the entry, but the actual cache content.
+ * Finish reading the cache entry of CACHE.  Afterwards it is ready to be
+ * sent to clients.
+ */
+static void
+http_cache_complete (http_cache_t *cache)
+{
+  http_cache_entry_t *entry = cache->entry;
+
+  entry->size = cache->size;
+  entry->buffer = cache->buffer;
+  entry->ready = 42;
+  http_cache_bytes += entry->size - entry->length;
+  entry->length = entry->size;
+  http_cache_reset (cache);
+
+  if (entry->stale)
+    http_cache_destroy_entry (entry);
+  else
+    {
+      http_cache_link (entry);
+      http_cache_shrink ();
+    }
+}
+
+/*
+ * Map the file FD into memory as the content of the cache entry of CACHE
+ * which has just been created by ‘http_init_cache’.  The entry is ready
+ * at once and CACHE is set up for the cache writer.  Return zero on
+ * success, otherwise the file has to be read.
+ */
+int
+http_cache_map (http_cache_t *cache, int fd)
+{
+#if HAVE_MMAP && HAVE_SYS_MMAN_H
+  http_cache_entry_t *entry = cache->entry;
+  void *buffer;
+
+  buffer = mmap (NULL, entry->length, PROT_READ, MAP_SHARED, fd, 0);
+  if (buffer == MAP_FAILED)
+    {
+      svz_log_sys_error ("cache: mmap");
+      return -1;
+    }
+
+  cache->buffer = buffer;
+  cache->size = entry->length;
+  entry->mapped = 1;
+  http_cache_complete (cache);
+
+  cache->entry = entry;
+  cache->buffer = entry->buffer;
+  cache->size = entry->size;
+  return 0;
+#else /* not (HAVE_MMAP && HAVE_SYS_MMAN_H) */
+  return -1;
+#endif /* not (HAVE_MMAP && HAVE_SYS_MMAN_H) */
+}
+
+/*
+ * Make the memory block BUFFER of SIZE bytes the content of the cache
+ * entry of CACHE which has just been created by ‘http_init_cache’.  The
+ * cache takes over BUFFER.  The entry is ready at once and CACHE is set
+ * up for the cache writer.
  */
 void
-http_refresh_cache (http_cache_t *cache)
+http_cache_store (http_cache_t *cache, char *buffer, int size)
 {
-  svz_free_and_zero (cache->entry->buffer);
-  cache->entry->ready = 0;
-  cache->entry->hits = 0;
-  cache->entry->usage = 0;
-  cache->size = 0;
-  cache->buffer = NULL;
+  http_cache_entry_t *entry = cache->entry;
+
+  cache->buffer = buffer;
+  cache->size = size;
+  http_cache_complete (cache);
+
+  cache->entry = entry;
+  cache->buffer = entry->buffer;
+  cache->size = entry->size;
+}
+
+/*
+ * Return the name of the cache entry holding the content of FILE encoded
+ * with the content coding ENCODING.  Do not forget to ‘svz_free’ it.
+ * The name starts with a control character, so it cannot be the name of
+ * a file as the other entries have, which starts with a document root.
+ */
+char *
+http_cache_variant (char *file, char *encoding)
+{
+  char *key = svz_malloc (strlen (file) + strlen (encoding) + 3);
+
+  sprintf (key, "\001%s:%s", encoding, file);
+  return key;
+}
+
+/*
+ * Read FILE and encode its content with the codec CODEC into the cache
+ * entry of CACHE which has just been created by ‘http_init_cache’ for as
+ * many bytes as the file has.  The entry is ready at once and CACHE is
+ * set up for the cache writer.  Return zero on success.  If the encoded
+ * content is not smaller than the file, the entry is kept empty so that
+ * the file is not encoded again until it changes.
+ */
+int
+http_cache_encode (http_cache_t *cache, svz_codec_t *codec, char *file)
+{
+  http_cache_entry_t *entry = cache->entry;
+  svz_codec_data_t data;
+  int fd, n, size = entry->length, ret = SVZ_CODEC_ERROR;
+
+  memset (&data, 0, sizeof (data));
+  data.codec = codec;
+  data.flag = SVZ_CODEC_FINISH;
+  data.in_buffer = svz_malloc (size);
+  data.in_size = size;
+  data.out_buffer = svz_malloc (size);
+  data.out_size = size;
+
+  /* read the whole file */
+  if ((fd = svz_open (file, O_RDONLY | O_BINARY, 0)) != -1)
+    {
+      while (data.in_fill < size &&
+             (n = read (fd, data.in_buffer + data.in_fill,
+                        size - data.in_fill)) > 0)
+        data.in_fill += n;
+      svz_close (fd);
+    }
+
+  /* the file could not be read */
+  if (data.in_fill != size)
+    {
+      svz_free (data.in_buffer);
+      svz_free (data.out_buffer);
+      http_cache_destroy_entry (entry);
+      http_cache_reset (cache);
+      return -1;
+    }
+
+  /* encode it in one go */
+  if (codec->init (&data) != SVZ_CODEC_ERROR)
+    ret = codec->code (&data);
+  codec->finalize (&data);
+  svz_free (data.in_buffer);
+
+  /* remember that it is not worth it by an empty entry */
+  if (ret != SVZ_CODEC_FINISHED)
+    {
+      svz_free (data.out_buffer);
+      http_cache_store (cache, NULL, 0);
+      http_cache_reset (cache);
+      return -1;
+    }
+
+  http_cache_store (cache, svz_realloc (data.out_buffer, data.out_fill),
+                    data.out_fill);
+  return 0;
 }
 
 /*
@@ -481,12 +761,9 @@ http_cache_read (svz_socket_t *sock)
       svz_log_sys_error ("cache: ReadFile");
 #endif
 
-      /* release the actual cache entry previously reserved */
-      if (cache->size > 0)
-        {
-          svz_free (cache->buffer);
-          http_cache_reset (cache);
-        }
+      /* release the buffer, the entry goes on disconnection */
+      svz_free_and_zero (cache->buffer);
+      cache->size = 0;
       return -1;
     }
 
@@ -510,10 +787,7 @@ http_cache_read (svz_socket_t *sock)
   /* Bogus file.  File size from ‘stat’ was not true.  */
   if (num_read == 0 && http->filelength != 0)
     {
-      cache->entry->size = cache->size;
-      cache->entry->buffer = cache->buffer;
-      cache->entry->ready = 42;
-      http_cache_reset (cache);
+      http_cache_complete (cache);
       return -1;
     }
 
@@ -526,10 +800,7 @@ http_cache_read (svz_socket_t *sock)
 #endif
 
       /* fill in the actual cache entry */
-      cache->entry->size = cache->size;
-      cache->entry->buffer = cache->buffer;
-      cache->entry->ready = 42;
-      http_cache_reset (cache);
+      http_cache_complete (cache);
 
       /* set flags and reassign default reader */
       sock->read_socket = svz_tcp_read_socket;
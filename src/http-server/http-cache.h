@@ -25,24 +25,33 @@
  * Some #defines.  These are just default values for configurable
  * variables.
  */
-#define MAX_CACHE          64       /* cache file entries */
-#define MAX_CACHE_SIZE     1024*200 /* maximum cache file size */
+#define MAX_CACHE_LIMIT    1024*1024*16 /* cache memory in bytes */
+#define MAX_CACHE_SIZE     1024*200     /* maximum cache file size */
+#define MIN_ENCODE_SIZE    256          /* minimum size worth compressing */
 
 /*
- * This structure contains the info for a cached file.
+ * This structure contains the info for a cached file.  Entries which
+ * are ready and not currently sent to any client are kept in a list in
+ * order of their last use, most recent first.  All others are pinned.
  */
 typedef struct http_cache_entry http_cache_entry_t;
 struct http_cache_entry
 {
-  http_cache_entry_t *next; /* next in list */
-  http_cache_entry_t *prev; /* previous in list */
+  http_cache_entry_t *next; /* next (less recent) in list */
+  http_cache_entry_t *prev; /* previous (more recent) in list */
   char *buffer;             /* pointer to cache buffer */
   int size;                 /* cache buffer size (size of file) */
+  int length;               /* bytes accounted for this entry */
   char *file;               /* actual filename */
+  unsigned long code;       /* hash code of the filename */
   time_t date;              /* date of last modification */
+  ino_t inode;              /* inode of the file */
+  dev_t device;             /* and its device */
   int usage;                /* how often this is currently used */
   int hits;                 /* cache hits */
   int ready;                /* this flag indicates if the entry is ok */
+  int stale;                /* removed from the cache, but still used */
+  int mapped;               /* the buffer is a mapping of the file */
 };
 
 /*
@@ -61,18 +70,24 @@ http_cache_t;
  * http cache structures.
  */
 extern svz_hash_t *http_cache;
-extern size_t http_cache_entries;
+extern size_t http_cache_limit;
+extern size_t http_cache_bytes;
 extern http_cache_entry_t *http_cache_first;
 extern http_cache_entry_t *http_cache_last;
 
 /*
  * Basic http cache functions.
  */
-void http_alloc_cache (size_t entries);
+void http_alloc_cache (size_t limit);
 void http_free_cache (void);
-void http_refresh_cache (http_cache_t *cache);
-int http_cache_urgency (http_cache_entry_t *cache);
-int http_init_cache (char *file, http_cache_t *cache);
+void http_cache_pin (http_cache_entry_t *cache);
+void http_cache_release (http_cache_entry_t *cache);
+void http_cache_invalidate (http_cache_entry_t *cache);
+int http_init_cache (char *file, int size, http_cache_t *cache);
+int http_cache_map (http_cache_t *cache, int fd);
+void http_cache_store (http_cache_t *cache, char *buffer, int size);
+char *http_cache_variant (char *file, char *encoding);
+int http_cache_encode (http_cache_t *cache, svz_codec_t *codec, char *file);
 int http_check_cache (char *file, http_cache_t *cache);
 int http_cache_write (svz_socket_t *sock);
 int http_cache_read (svz_socket_t *sock);
@@ -56,6 +56,7 @@
 #include "http-proto.h"
 #include "http-core.h"
 #include "http-cgi.h"
+#include "http-fcgi.h"
 #include "unused.h"
 
 /*
@@ -373,48 +374,34 @@ cgi_create_envp (svz_socket_t *sock,  /* socket for this request */
    */
   static struct
   {
-    char *property; /* property identifier */
-    char *env;      /* variable identifier */
+    int field; /* property index */
+    char *env; /* variable identifier */
   }
   env_var[] =
   {
-    { "Content-length",  "CONTENT_LENGTH"       },
-    { "Content-type",    "CONTENT_TYPE"         },
-    { "Accept",          "HTTP_ACCEPT"          },
-    { "Referer",         "HTTP_REFERER"         },
-    { "User-Agent",      "HTTP_USER_AGENT"      },
-    { "Host",            "HTTP_HOST"            },
-    { "Connection",      "HTTP_CONNECTION"      },
-    { "Accept-Encoding", "HTTP_ACCEPT_ENCODING" },
-    { "Accept-Language", "HTTP_ACCEPT_LANGUAGE" },
-    { "Accept-Charset",  "HTTP_ACCEPT_CHARSET"  },
-    { NULL, NULL }
+    { HTTP_FIELD_CONTENT_LENGTH,  "CONTENT_LENGTH"       },
+    { HTTP_FIELD_CONTENT_TYPE,    "CONTENT_TYPE"         },
+    { HTTP_FIELD_ACCEPT,          "HTTP_ACCEPT"          },
+    { HTTP_FIELD_REFERER,         "HTTP_REFERER"         },
+    { HTTP_FIELD_USER_AGENT,      "HTTP_USER_AGENT"      },
+    { HTTP_FIELD_HOST,            "HTTP_HOST"            },
+    { HTTP_FIELD_CONNECTION,      "HTTP_CONNECTION"      },
+    { HTTP_FIELD_ACCEPT_ENCODING, "HTTP_ACCEPT_ENCODING" },
+    { HTTP_FIELD_ACCEPT_LANGUAGE, "HTTP_ACCEPT_LANGUAGE" },
+    { HTTP_FIELD_ACCEPT_CHARSET,  "HTTP_ACCEPT_CHARSET"  },
+    { -1, NULL }
   };
 
-  unsigned n;
+  char *value;
   int c;
 
-  /* setup default environment */
-  svz_envblock_default (env);
-
   /* get http socket structure */
   http = sock->data;
 
   /* convert some http request properties into environment variables */
-  if (http->property)
-    for (c = 0; env_var[c].property; c++)
-      {
-        char *prop = env_var[c].property;
-        size_t plen = strlen (prop);
-
-        for (n = 0; http->property[n]; n += 2)
-          if (!strncasecmp (http->property[n], prop, plen))
-            {
-              svz_envblock_add (env, "%s=%s",
-                                env_var[c].env, http->property[n + 1]);
-              break;
-            }
-      }
+  for (c = 0; env_var[c].env; c++)
+    if ((value = http_find_property (http, env_var[c].field)) != NULL)
+      svz_envblock_add (env, "%s=%s", env_var[c].env, value);
 
   /*
    * set up some more environment variables which might be
@@ -451,7 +438,8 @@ cgi_create_envp (svz_socket_t *sock,  /* socket for this request */
  * Check the http option (the URL) for a cgi request.  This routine
  * parses the text of the request and fills in the ‘struct details’ if
  * possible.  This function makes sure that the cgi script file exists
- * and is executable.  Return 0 on success, otherwise -1.
+ * and is executable, unless it is run by a FastCGI application.  Return
+ * 0 on success, otherwise -1.
  */
 static int
 check_cgi (svz_socket_t *sock, char *request, struct details *det)
@@ -530,8 +518,8 @@ check_cgi (svz_socket_t *sock, char *request, struct details *det)
       return -1;
     }
 
-  if (!(buf.st_mode & S_IFREG) ||
-      !(buf.st_mode & S_IXUSR) || !(buf.st_mode & S_IRUSR))
+  if (!(buf.st_mode & S_IFREG) || !(buf.st_mode & S_IRUSR) ||
+      (!(buf.st_mode & S_IXUSR) && !cfg->fcgi))
     {
       svz_log (SVZ_LOG_ERROR, "cgi: no executable: %s\n", det->filename);
       close (fd);
@@ -580,6 +568,7 @@ pre_exec (svz_socket_t *sock,   /* socket structure */
   svz_free (cgidir);
 
   /* create the environment block for the CGI script */
+  svz_envblock_default (envp);
   cgi_create_envp (sock, envp, det, type);
 
   return cgifile;
@@ -628,6 +617,38 @@ http_gen_cgi_apps (http_config_t *cfg)
     svz_free (p);
 }
 
+/*
+ * Pass a cgi request to the FastCGI application instead of invoking the
+ * cgi script.  The environment of the script is passed as the request's
+ * parameters, without the server's own environment.
+ */
+static int
+cgi_fastcgi (svz_socket_t *sock,  /* the socket structure */
+             struct details *det, /* filename, path-info, nv-pairs */
+             int type)            /* request type (POST or GET) */
+{
+  svz_envblock_t *envp;
+  char *cgidir;
+  int ret;
+
+  envp = svz_envblock_create ();
+  cgi_create_envp (sock, envp, det, type);
+
+  /* the application needs the full path of the script */
+  if (det->filename[0] == '/')
+    svz_envblock_add (envp, "SCRIPT_FILENAME=%s", det->filename);
+  else
+    {
+      cgidir = svz_getcwd ();
+      svz_envblock_add (envp, "SCRIPT_FILENAME=%s/%s", cgidir, det->filename);
+      svz_free (cgidir);
+    }
+
+  ret = http_fcgi_request (sock, envp, type == POST_METHOD);
+  svz_envblock_destroy (envp);
+  return ret;
+}
+
 /* FIXME: Make ‘static inline’ func w/ attribute ‘SVZ_EXITING’.  */
 #define cool()  exit (EXIT_SUCCESS)
 
@@ -958,6 +979,7 @@ http_cgi_get_response (svz_socket_t *sock, char *request,
   svz_t_handle cgi2s[2];
   struct details det;
   int rv;
+  http_config_t *cfg = sock->cfg;
 
   /* check if this is a cgi request at all */
   if (0 > check_cgi (sock, request, &det))
@@ -972,6 +994,13 @@ http_cgi_get_response (svz_socket_t *sock, char *request,
       LOSE ();
     }
 
+  /* let the FastCGI application respond if there is one */
+  if (cfg->fcgi)
+    {
+      rv = cgi_fastcgi (sock, &det, GET_METHOD);
+      goto out;
+    }
+
   /* create a pipe for the cgi script process */
   if (svz_pipe_create_pair (cgi2s) == -1)
     {
@@ -1013,6 +1042,7 @@ http_post_response (svz_socket_t *sock, char *request,
   svz_t_handle s2cgi[2];
   svz_t_handle cgi2s[2];
   http_socket_t *http;
+  http_config_t *cfg = sock->cfg;
   int rv = 0;
 
   /* get http socket structure */
@@ -1027,6 +1057,23 @@ http_post_response (svz_socket_t *sock, char *request,
       LOSE ();
     }
 
+  /* get the content length from the header information */
+  if ((length = http_find_property (http, HTTP_FIELD_CONTENT_LENGTH)) == NULL)
+    {
+      svz_sock_printf (sock, HTTP_BAD_REQUEST "\r\n");
+      http_error_response (sock, 411);
+      sock->userflags |= HTTP_FLAG_DONE;
+      LOSE ();
+    }
+  http->contentlength = svz_atoi (length);
+
+  /* let the FastCGI application respond if there is one */
+  if (cfg->fcgi)
+    {
+      rv = cgi_fastcgi (sock, &det, POST_METHOD);
+      goto out;
+    }
+
   /* create a pair of pipes for the cgi script process */
   if (svz_pipe_create_pair (cgi2s) == -1)
     {
@@ -1043,16 +1090,6 @@ http_post_response (svz_socket_t *sock, char *request,
       LOSE ();
     }
 
-  /* get the content length from the header information */
-  if ((length = http_find_property (http, "Content-length")) == NULL)
-    {
-      svz_sock_printf (sock, HTTP_BAD_REQUEST "\r\n");
-      http_error_response (sock, 411);
-      sock->userflags |= HTTP_FLAG_DONE;
-      LOSE ();
-    }
-  http->contentlength = svz_atoi (length);
-
   /* prepare everything for the cgi pipe handling */
   sock->pipe_desc[SVZ_WRITE] = s2cgi[SVZ_WRITE];
   sock->pipe_desc[SVZ_READ] = cgi2s[SVZ_READ];
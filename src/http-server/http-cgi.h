@@ -34,6 +34,7 @@ int http_cgi_write (svz_socket_t *sock);
 int http_cgi_read (svz_socket_t *sock);
 int http_cgi_disconnect (svz_socket_t *sock);
 int http_cgi_died (svz_socket_t *sock);
+int http_cgi_accepted (svz_socket_t *sock);
 void http_gen_cgi_apps (http_config_t *cfg);
 
 #endif /* __HTTP_CGI_H__ */
@@ -42,8 +42,10 @@
 #include "cpp-tricks.h"
 
 #include "libserveez.h"
+#include "misc-macros.h"
 #include "http-proto.h"
 #include "http-core.h"
+#include "unused.h"
 
 /* the current http header structure */
 http_header_t http_header;
@@ -286,8 +288,8 @@ http_log (svz_socket_t *sock)
 
   if (cfg->log && http->request)
     {
-      referrer = http_find_property (http, "Referer");
-      agent = http_find_property (http, "User-Agent");
+      referrer = http_find_property (http, HTTP_FIELD_REFERER);
+      agent = http_find_property (http, HTTP_FIELD_USER_AGENT);
 
       /* access logging format given?  */
       if (cfg->logformat && *cfg->logformat)
@@ -367,7 +369,7 @@ http_log (svz_socket_t *sock)
 
       if (!ferror (cfg->log) && !feof (cfg->log))
         {
-          fprintf (cfg->log, line);
+          fputs (line, cfg->log);
           fflush (cfg->log);
         }
       else
@@ -386,6 +388,7 @@ void
 http_reset_header (void)
 {
   http_header.code = 0;
+  http_header.length = 0;
   http_header.field[0] = '\0';
   http_header.response = NULL;
 }
@@ -397,14 +400,53 @@ void
 http_add_header (const char *fmt, ...)
 {
   va_list args;
-  int len = strlen (http_header.field);
-  char *p = http_header.field + len;
+  int len = http_header.length, n;
 
-  if (len >= HTTP_HEADER_SIZE)
+  if (len >= HTTP_HEADER_SIZE - 1)
     return;
   va_start (args, fmt);
-  vsnprintf (p, HTTP_HEADER_SIZE - len, fmt, args);
+  n = vsnprintf (http_header.field + len, HTTP_HEADER_SIZE - len, fmt, args);
   va_end (args);
+  if (n > 0)
+    http_header.length = (n < HTTP_HEADER_SIZE - len) ?
+      len + n : HTTP_HEADER_SIZE - 1;
+}
+
+/*
+ * Add the pre-rendered response header FIELD (including its line break)
+ * to the current header.
+ */
+void
+http_add_field (const char *field)
+{
+  size_t n = strlen (field);
+
+  if (http_header.length + n >= HTTP_HEADER_SIZE)
+    return;
+  memcpy (http_header.field + http_header.length, field, n + 1);
+  http_header.length += n;
+}
+
+/*
+ * The "Date" and "Server" header fields, rendered once per second.
+ */
+static char http_date_field[128];
+static int http_date_length = 0;
+static time_t http_date_time = 0;
+
+/*
+ * Append LEN bytes of DATA to the send buffer of SOCK.  Unlike
+ * ‘svz_sock_write’ this does not try to flush the buffer first, so the
+ * parts of a response leave together.
+ */
+static int
+http_queue (svz_socket_t *sock, const char *data, int len)
+{
+  if (sock->send_buffer_fill + len > sock->send_buffer_size)
+    return svz_sock_write (sock, (char *) data, len);
+  memcpy (sock->send_buffer + sock->send_buffer_fill, data, len);
+  sock->send_buffer_fill += len;
+  return 0;
 }
 
 /*
@@ -413,25 +455,26 @@ http_add_header (const char *fmt, ...)
 int
 http_send_header (svz_socket_t *sock)
 {
-  int ret = 0;
-
-  /* send first part of header including response field and static texts */
-  ret = svz_sock_printf (sock,
-                         "%s"
-                         "Date: %s\r\n"
-                         "Server: %s\r\n",
-                         http_header.response,
-                         http_asc_date (time (NULL)),
-                         SERVER_STRING);
-  if (ret)
-    return ret;
+  time_t now = time (NULL);
+  int ret;
 
-  /* send header fields and trailing line break */
-  ret = svz_sock_printf (sock, "%s\r\n", http_header.field);
-  if (ret)
-    return ret;
+  if (now != http_date_time)
+    {
+      http_date_time = now;
+      http_date_length = sprintf (http_date_field,
+                                  "Date: %s\r\n"
+                                  "Server: %s\r\n",
+                                  http_asc_date (now), SERVER_STRING);
+    }
 
-  return 0;
+  /* the response field, static texts, header fields and trailing line
+     break are put into the send buffer at once */
+  if ((ret = http_queue (sock, http_header.response,
+                         strlen (http_header.response))) != 0 ||
+      (ret = http_queue (sock, http_date_field, http_date_length)) != 0 ||
+      (ret = http_queue (sock, http_header.field, http_header.length)) != 0)
+    return ret;
+  return http_queue (sock, "\r\n", 2);
 }
 
 /*
@@ -644,11 +687,12 @@ http_error_response (svz_socket_t *sock, int response)
 }
 
 /*
- * This function is used to re-initialize a HTTP connection for
- * Keep-Alive connections.  Return -1 if it is not 'Keep'able.
+ * Finish the current request of the HTTP connection SOCK and prepare
+ * it for the next one, keeping whatever is still in its send buffer.
+ * Return -1 if it is not 'Keep'able.
  */
 int
-http_keep_alive (svz_socket_t *sock)
+http_next_request (svz_socket_t *sock)
 {
   if (sock->userflags & HTTP_FLAG_KEEP)
     {
@@ -658,8 +702,8 @@ http_keep_alive (svz_socket_t *sock)
       sock->read_socket = svz_tcp_read_socket;
       sock->check_request = http_check_request;
       sock->write_socket = http_default_write;
-      sock->send_buffer_fill = 0;
       sock->idle_func = http_idle;
+      svz_sock_resume_read (sock);
 #if ENABLE_DEBUG
       svz_log (SVZ_LOG_DEBUG, "http: keeping connection alive\n");
 #endif
@@ -668,6 +712,23 @@ http_keep_alive (svz_socket_t *sock)
   return -1;
 }
 
+/*
+ * This function is used to re-initialize a HTTP connection for
+ * Keep-Alive connections when its response has been sent.  Requests
+ * which have been pipelined meanwhile are handled at once.  Return -1
+ * if it is not 'Keep'able.
+ */
+int
+http_keep_alive (svz_socket_t *sock)
+{
+  if (http_next_request (sock))
+    return -1;
+  sock->send_buffer_fill = 0;
+  if (sock->recv_buffer_fill > 0)
+    return http_check_request (sock);
+  return 0;
+}
+
 /*
  * This function is used to check if the connection in SOCK is a
  * Keep-Alive connection and sends the appropriate HTTP header property.
@@ -681,16 +742,14 @@ http_check_keepalive (svz_socket_t *sock)
   if ((sock->userflags & HTTP_FLAG_KEEP) && http->keepalive > 0)
     {
       sock->idle_counter = cfg->timeout;
-      http_add_header ("Connection: Keep-Alive\r\n");
-      http_add_header ("Keep-Alive: timeout=%d, max=%d\r\n",
-                       sock->idle_counter, cfg->keepalive);
+      http_add_field (cfg->keepalive_field);
       http->keepalive--;
     }
   /* tell HTTP/1.1 clients that the connection is closed after delivery */
   else
     {
       sock->userflags &= ~HTTP_FLAG_KEEP;
-      http_add_header ("Connection: close\r\n");
+      http_add_field ("Connection: close\r\n");
     }
 }
 
@@ -797,90 +856,116 @@ http_parse_date (char *date)
 }
 
 /*
- * Parse part of the receive buffer for HTTP request properties
- * and store it in the socket structure SOCK.  Return the amount of
- * properties found in the request.
+ * Names of the well-known request properties, indexed by HTTP_FIELD_*.
+ */
+static struct
+{
+  char *name; /* property identifier */
+  size_t len; /* its length */
+}
+http_field[HTTP_FIELDS] =
+{
+  { "Accept",            6  },
+  { "Accept-Charset",    14 },
+  { "Accept-Encoding",   15 },
+  { "Accept-Language",   15 },
+  { "Connection",        10 },
+  { "Content-Length",    14 },
+  { "Content-Type",      12 },
+  { "Host",              4  },
+  { "If-Modified-Since", 17 },
+  { "Range",             5  },
+  { "Referer",           7  },
+  { "Request-Range",     13 },
+  { "User-Agent",        10 }
+};
+
+/*
+ * Return the index of the well-known request property NAME of LEN
+ * characters, or -1 if it is not one of these.
+ */
+static int
+http_field_index (char *name, size_t len)
+{
+  int n;
+
+  for (n = 0; n < HTTP_FIELDS; n++)
+    if (http_field[n].len == len
+        && !strncasecmp (http_field[n].name, name, len))
+      return n;
+  return -1;
+}
+
+/*
+ * Parse the request properties from REQUEST up to END, which is part of
+ * the request header buffer of the http connection SOCK, in place.  Each
+ * name and value is terminated with a zero and stored as offsets into
+ * the buffer.  Well-known properties are remembered by their index.
+ * Return the amount of properties found in the request.
  */
 int
 http_parse_property (svz_socket_t *sock, char *request, char *end)
 {
-  int properties, n;
-  char *p;
-  http_socket_t *http;
-
-  /* get the http socket structure */
-  http = sock->data;
+  http_socket_t *http = sock->data;
+  char *p, *eol, *value;
+  int field;
 
-  /* reserve data space for the http properties */
-  http->property = svz_malloc (MAX_HTTP_PROPERTIES * 2 * sizeof (char *));
-  properties = 0;
-  n = 0;
+  http->properties = 0;
+  memset (http->field, 0, sizeof (http->field));
 
   /* find out properties if necessary */
-  while (!EOL1_P (request) && properties < MAX_HTTP_PROPERTIES - 1)
+  while (request < end - 1 && !EOL1_P (request) &&
+         http->properties < MAX_HTTP_PROPERTIES)
     {
-      /* get property entity identifier */
-      p = request;
-      while (*p != ':' && p < end)
-        p++;
-      if (p == end)
+      /* find the end of the line and the property entity identifier */
+      if ((eol = memchr (request, '\r', end - request)) == NULL)
         break;
-      http->property[n] = svz_malloc (p - request + 1);
-      strncpy (http->property[n], request, p - request);
-      http->property[n][p - request] = 0;
-      n++;
-      request = p + 2;
-
-      /* get property entity body */
-      while (!EOL1_P (p) && p < end)
-        p++;
-      if (p == end || p <= request)
-        break;
-      http->property[n] = svz_malloc (p - request + 1);
-      strncpy (http->property[n], request, p - request);
-      http->property[n][p - request] = 0;
-      n++;
-      properties++;
-      request = p + 2;
+      if ((p = memchr (request, ':', eol - request)) == NULL)
+        {
+          request = eol + 2;
+          continue;
+        }
+
+      field = http_field_index (request, p - request);
+      *p = '\0';
+
+      /* get property entity body without surrounding white space */
+      value = p + 1;
+      while (value < eol && (*value == ' ' || *value == '\t'))
+        value++;
+      p = eol;
+      while (p > value && (p[-1] == ' ' || p[-1] == '\t'))
+        p--;
+      *p = '\0';
+
+      http->property[http->properties].name = request - http->header;
+      http->property[http->properties].value = value - http->header;
+      http->properties++;
+      if (field != -1 && !http->field[field])
+        http->field[field] = http->properties;
 
 #if 0
-      printf ("http header: {%s} = {%s}\n",
-              http->property[n - 2], http->property[n - 1]);
+      printf ("http header: {%s} = {%s}\n", request, value);
 #endif
+      request = eol + 2;
     }
 
-  request += 2;
-  http->property[n] = NULL;
-
-  return properties;
+  return http->properties;
 }
 
 /*
- * Find a given property entity in the HTTP request properties.
- * Return a NULL pointer if not found.
+ * Find the well-known property entity FIELD (one of the HTTP_FIELD_*
+ * indices) in the HTTP request properties.  Return a NULL pointer if
+ * not found.
  */
 char *
-http_find_property (http_socket_t *http, char *key)
+http_find_property (http_socket_t *http, int field)
 {
   int n;
-  size_t len;
 
-  /* check if there are any properties */
-  if (http->property == NULL)
+  if ((n = http->field[field]) == 0)
     return NULL;
-
-  /* search through all the http properties */
-  n = 0;
-  len = strlen (key);
-  while (http->property[n])
-    {
-      if (!strncasecmp (http->property[n], key, len))
-        {
-          return http->property[n + 1];
-        }
-      n += 2;
-    }
-  return NULL;
+  return HTTP_PROPERTY_VALUE (http, n - 1);
 }
 
 #define ASC_TO_HEX(c)                             \
@@ -1024,6 +1109,116 @@ http_find_content_type (svz_socket_t *sock, char *file)
   return cfg->default_type;
 }
 
+/*
+ * Add the "Content-Type" field for TYPE to the hash FIELDS unless it
+ * is there already.
+ */
+static void
+http_render_type (UNUSED void *suffix, void *type, void *closure)
+{
+  svz_hash_t *fields = closure;
+  char *field;
+
+  if (type == NULL || svz_hash_get (fields, type))
+    return;
+  field = svz_malloc (strlen (type) + 17);
+  sprintf (field, "Content-Type: %s\r\n", (char *) type);
+  svz_hash_put (fields, type, field);
+}
+
+/*
+ * Render the constant response header fields of the http configuration
+ * CFG once: a "Content-Type" field for each known content type and the
+ * fields announcing a persistent connection.
+ */
+void
+http_render_fields (http_config_t *cfg)
+{
+  http_free_fields (cfg);
+  cfg->fields = svz_hash_create (4, svz_free);
+  http_render_type (NULL, cfg->default_type, cfg->fields);
+  if (cfg->types)
+    svz_hash_foreach (http_render_type, cfg->types, cfg->fields);
+
+  cfg->keepalive_field = svz_malloc (128);
+  sprintf (cfg->keepalive_field,
+           "Connection: Keep-Alive\r\n"
+           "Keep-Alive: timeout=%d, max=%d\r\n",
+           cfg->timeout, cfg->keepalive);
+}
+
+/*
+ * Release the response header fields rendered by @code{http_render_fields}.
+ */
+void
+http_free_fields (http_config_t *cfg)
+{
+  if (cfg->fields)
+    {
+      svz_hash_destroy (cfg->fields);
+      cfg->fields = NULL;
+    }
+  svz_free_and_zero (cfg->keepalive_field);
+}
+
+/*
+ * Check whether the content coding CODING is acceptable according to
+ * the value ACCEPT of an "Accept-Encoding" request header field.  A
+ * coding given a quality value of zero is not acceptable, the others
+ * are, as well as all codings not mentioned if "*" is.
+ */
+int
+http_accept_encoding (char *accept, const char *coding)
+{
+  size_t len = strlen (coding), n;
+  int any = 0, ok;
+  char *p, *q;
+
+  for (p = accept; *p; p += strcspn (p, ","))
+    {
+      p += strspn (p, ", \t");
+      n = strcspn (p, ",; \t");
+
+      /* look for a quality value */
+      ok = 1;
+      if ((q = strchr (p, ';')) != NULL && q < p + strcspn (p, ",")
+          && (q = strstr (q, "q=")) != NULL && q < p + strcspn (p, ","))
+        ok = strtod (q + 2, NULL) > 0;
+
+      if (n == len && !strncasecmp (p, coding, len))
+        return ok;
+      if (n == 1 && *p == '*')
+        any = ok;
+    }
+  return any;
+}
+
+/*
+ * Check whether content of the content type TYPE is worth compressing.
+ */
+int
+http_compressible_type (char *type)
+{
+  return type && (!strncmp (type, "text/", 5) ||
+                  strstr (type, "javascript") || strstr (type, "json") ||
+                  strstr (type, "xml"));
+}
+
+/*
+ * Return the pre-rendered "Content-Type" header field for FILE.
+ */
+char *
+http_content_type_field (svz_socket_t *sock, char *file)
+{
+  http_config_t *cfg = sock->cfg;
+  char *type = http_find_content_type (sock, file);
+  char *field = NULL;
+
+  if (type && cfg->fields)
+    field = svz_hash_get (cfg->fields, type);
+  return field ? field : "Content-Type: application/octet-stream\r\n";
+}
+
 /*
  * This routine converts a relative file/path name into an
  * absolute file/path name.  The given argument will be reallocated
@@ -49,6 +49,7 @@ typedef struct
 {
   char *response;               /* text representation of response */
   int code;                     /* response code */
+  int length;                   /* length of the header fields */
   char field[HTTP_HEADER_SIZE]; /* holds header fields */
 }
 http_header_t;
@@ -65,6 +66,36 @@ typedef struct
 }
 http_range_t;
 
+/*
+ * Well-known request properties.  They are recognized when parsing the
+ * request header, and can be found by their index.
+ */
+#define HTTP_FIELD_ACCEPT            0
+#define HTTP_FIELD_ACCEPT_CHARSET    1
+#define HTTP_FIELD_ACCEPT_ENCODING   2
+#define HTTP_FIELD_ACCEPT_LANGUAGE   3
+#define HTTP_FIELD_CONNECTION        4
+#define HTTP_FIELD_CONTENT_LENGTH    5
+#define HTTP_FIELD_CONTENT_TYPE      6
+#define HTTP_FIELD_HOST              7
+#define HTTP_FIELD_IF_MODIFIED_SINCE 8
+#define HTTP_FIELD_RANGE             9
+#define HTTP_FIELD_REFERER           10
+#define HTTP_FIELD_REQUEST_RANGE     11
+#define HTTP_FIELD_USER_AGENT        12
+#define HTTP_FIELDS                  13
+
+/*
+ * A request property.  Name and value are offsets of zero terminated
+ * strings within the request header buffer of a http connection.
+ */
+typedef struct
+{
+  int name;  /* property identifier */
+  int value; /* property body */
+}
+http_property_t;
+
 /*
  * This structure is used to process a http connection.  It will be stored
  * within the original socket structure (sock->data).
@@ -74,14 +105,18 @@ typedef struct http_socket http_socket_t;
 struct http_socket
 {
   http_cache_t *cache;   /* a http file cache structure */
-  char **property;       /* property list of a http request */
+  char *header;          /* copy of the request header, split in place */
+  int header_size;       /* size of this buffer */
+  int properties;        /* number of request properties */
+  http_property_t property[MAX_HTTP_PROPERTIES]; /* the properties */
+  int field[HTTP_FIELDS];                        /* well-known ones + 1 */
   int contentlength;     /* the content length for the cgi pipe */
   int filelength;        /* content length for the http file */
   int keepalive;         /* how many requests left for a connection */
   off_t fileoffset;      /* file offset used by sendfile */
   svz_t_handle pid;      /* the pid of the cgi (process handle) */
   time_t timestamp;      /* connection access time */
-  char *request;         /* the original request */
+  char *request;         /* the original request line */
   char *host;            /* resolved host name of client */
   int response;          /* the server's response code */
   int length;            /* content length sent so far */
@@ -118,6 +153,7 @@ struct http_socket
 #define HTTP_FLAG_KEEP     0x0040 /* keep alive connection */
 #define HTTP_FLAG_SENDFILE 0x0080 /* use sendfile for HTTP requests */
 #define HTTP_FLAG_PARTIAL  0x0100 /* partial content requested */
+#define HTTP_FLAG_FCGI     0x0200 /* http fastcgi request in progress */
 
 /* all of the additional http flags */
 #define HTTP_FLAG (HTTP_FLAG_DONE      | \
@@ -126,17 +162,30 @@ struct http_socket
                    HTTP_FLAG_CACHE     | \
                    HTTP_FLAG_KEEP      | \
                    HTTP_FLAG_SENDFILE  | \
-                   HTTP_FLAG_PARTIAL)
+                   HTTP_FLAG_PARTIAL   | \
+                   HTTP_FLAG_FCGI)
 
 /* exported http core functions */
+int http_next_request (svz_socket_t *sock);
 int http_keep_alive (svz_socket_t *sock);
 void http_check_keepalive (svz_socket_t *sock);
 
 int http_read_types (http_config_t *cfg);
 char *http_find_content_type (svz_socket_t *sock, char *file);
+char *http_content_type_field (svz_socket_t *sock, char *file);
+int http_accept_encoding (char *accept, const char *coding);
+int http_compressible_type (char *type);
+void http_render_fields (http_config_t *cfg);
+void http_free_fields (http_config_t *cfg);
 
 int http_parse_property (svz_socket_t *sock, char *request, char *end);
-char *http_find_property (http_socket_t *sock, char *key);
+char *http_find_property (http_socket_t *sock, int field);
+
+/* name and value of the N-th request property */
+#define HTTP_PROPERTY_NAME(http, n) \
+  ((http)->header + (http)->property[n].name)
+#define HTTP_PROPERTY_VALUE(http, n) \
+  ((http)->header + (http)->property[n].value)
 
 int http_check_range (http_range_t *range, off_t filesize);
 int http_get_range (char *line, http_range_t *range);
@@ -155,6 +204,7 @@ void http_set_header (char *response);
 int http_send_header (svz_socket_t *sock);
 void http_reset_header (void);
 void http_add_header (const char *fmt, ...);
+void http_add_field (const char *field);
 
 #ifdef __MINGW32__
 void http_start_netapi (void);
@@ -0,0 +1,1016 @@
+/*
+ * http-fcgi.c - http fastcgi client implementation
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this package.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifndef __MINGW32__
+# include <sys/socket.h>
+# include <sys/un.h>
+# if HAVE_WAIT_H
+#  include <wait.h>
+# endif
+# if HAVE_SYS_WAIT_H
+#  include <sys/wait.h>
+# endif
+#endif
+
+#include "libserveez.h"
+#include "http-proto.h"
+#include "http-core.h"
+#include "http-cgi.h"
+#include "http-fcgi.h"
+#include "unused.h"
+
+#ifndef __MINGW32__
+
+/*
+ * Instead of running a process for each cgi request, the requests are
+ * passed to a FastCGI application, which is either started by the
+ * server or listens on a Unix domain socket on its own.  Each
+ * connection to the application carries one request at a time, any
+ * further requests wait for a connection to become free.  The request
+ * and the response are streamed by the main loop.
+ */
+
+/* FastCGI protocol definitions */
+#define FCGI_VERSION_1         1
+#define FCGI_HEADER_LEN        8
+#define FCGI_MAX_LENGTH        0xffff
+#define FCGI_LISTENSOCK_FILENO 0
+
+/* record types */
+#define FCGI_BEGIN_REQUEST     1
+#define FCGI_ABORT_REQUEST     2
+#define FCGI_END_REQUEST       3
+#define FCGI_PARAMS            4
+#define FCGI_STDIN             5
+#define FCGI_STDOUT            6
+#define FCGI_STDERR            7
+
+/* role and flags of a request, status of its end */
+#define FCGI_RESPONDER         1
+#define FCGI_KEEP_CONN         1
+#define FCGI_REQUEST_COMPLETE  0
+
+typedef struct http_fcgi http_fcgi_t;
+
+/*
+ * A connection to the FastCGI application.
+ */
+typedef struct
+{
+  http_fcgi_t *pool;    /* the pool it belongs to */
+  svz_socket_t *conn;   /* the connection if established */
+  svz_socket_t *client; /* the http connection of the current request */
+  int busy;             /* non-zero while a request is in progress */
+  int request;          /* the id of this request */
+  int type;             /* type of the record being received or -1 */
+  int id;               /* its request id */
+  int left;             /* content bytes still to come */
+  int padding;          /* padding bytes still to come */
+}
+http_fcgi_slot_t;
+
+/*
+ * A request waiting for a free connection.
+ */
+typedef struct
+{
+  svz_socket_t *sock;   /* the http connection */
+  char *params;         /* the encoded name-value pairs */
+  int size;             /* their length */
+}
+http_fcgi_request_t;
+
+/*
+ * The connections to one FastCGI application.
+ */
+struct http_fcgi
+{
+  char *path;              /* its socket */
+  char *app;               /* the program to run or NULL */
+  char *dir;               /* the directory to run it in */
+  int size;                /* number of connections and processes */
+  http_fcgi_slot_t *slot;  /* the connections */
+  svz_array_t *queue;      /* requests waiting for one of them */
+  int listener;            /* socket passed to the processes or -1 */
+  pid_t *pid;              /* the processes */
+};
+
+static int http_fcgi_check (svz_socket_t *conn);
+static void http_fcgi_dispatch (http_fcgi_t *fcgi);
+
+/*
+ * Append a record of the given TYPE with the content DATA of LEN bytes
+ * to the send buffer of the connection of SLOT.
+ */
+static void
+http_fcgi_record (http_fcgi_slot_t *slot, int type, char *data, int len)
+{
+  svz_socket_t *conn = slot->conn;
+  unsigned char *p;
+  int size;
+
+  size = conn->send_buffer_fill + FCGI_HEADER_LEN + len;
+  if (size > conn->send_buffer_size)
+    svz_sock_resize_buffers (conn, size, conn->recv_buffer_size);
+
+  p = (unsigned char *) conn->send_buffer + conn->send_buffer_fill;
+  p[0] = FCGI_VERSION_1;
+  p[1] = type;
+  p[2] = slot->request >> 8;
+  p[3] = slot->request & 0xff;
+  p[4] = len >> 8;
+  p[5] = len & 0xff;
+  p[6] = 0;
+  p[7] = 0;
+  if (len)
+    memcpy (p + FCGI_HEADER_LEN, data, len);
+  conn->send_buffer_fill += FCGI_HEADER_LEN + len;
+}
+
+/*
+ * Encode the length LEN of a name or value at P.  Return the number of
+ * bytes used.
+ */
+static int
+http_fcgi_length (unsigned char *p, int len)
+{
+  if (len < 0x80)
+    {
+      p[0] = len;
+      return 1;
+    }
+  p[0] = (len >> 24) | 0x80;
+  p[1] = (len >> 16) & 0xff;
+  p[2] = (len >> 8) & 0xff;
+  p[3] = len & 0xff;
+  return 4;
+}
+
+static void
+http_fcgi_free_request (http_fcgi_request_t *req)
+{
+  svz_free (req->params);
+  svz_free (req);
+}
+
+/*
+ * Find a connection without a request in progress.
+ */
+static http_fcgi_slot_t *
+http_fcgi_slot (http_fcgi_t *fcgi)
+{
+  int n;
+
+  for (n = 0; n < fcgi->size; n++)
+    if (!fcgi->slot[n].busy)
+      return &fcgi->slot[n];
+  return NULL;
+}
+
+/*
+ * Find the connection with the request of the http connection SOCK in
+ * progress.
+ */
+static http_fcgi_slot_t *
+http_fcgi_find (svz_socket_t *sock)
+{
+  http_config_t *cfg = sock->cfg;
+  int n;
+
+  if (cfg->fcgi == NULL)
+    return NULL;
+  for (n = 0; n < cfg->fcgi->size; n++)
+    if (cfg->fcgi->slot[n].client == sock)
+      return &cfg->fcgi->slot[n];
+  return NULL;
+}
+
+/*
+ * Respond with an error to the http connection SOCK whose request could
+ * not be passed to the application.
+ */
+static void
+http_fcgi_fail (svz_socket_t *sock)
+{
+  sock->userflags &= ~(HTTP_FLAG_FCGI | HTTP_FLAG_POST);
+  sock->check_request = http_check_request;
+  sock->write_socket = http_default_write;
+  svz_sock_printf (sock, HTTP_INTERNAL_ERROR "\r\n");
+  http_error_response (sock, 500);
+  sock->userflags |= HTTP_FLAG_DONE;
+}
+
+/*
+ * Pass as much of the data posted by the client of SLOT as fits into
+ * the send buffer of the connection, and finish the stream when all of
+ * it has been passed.  The client is not read from while the connection
+ * is busy sending.
+ */
+static void
+http_fcgi_stdin (http_fcgi_slot_t *slot)
+{
+  svz_socket_t *sock = slot->client, *conn = slot->conn;
+  http_socket_t *http = sock->data;
+  int n;
+
+  n = conn->send_buffer_size - conn->send_buffer_fill - 2 * FCGI_HEADER_LEN;
+  if (n > sock->recv_buffer_fill)
+    n = sock->recv_buffer_fill;
+  if (n > http->contentlength)
+    n = http->contentlength;
+  if (n > FCGI_MAX_LENGTH)
+    n = FCGI_MAX_LENGTH;
+  if (n > 0)
+    {
+      http_fcgi_record (slot, FCGI_STDIN, sock->recv_buffer, n);
+      svz_sock_reduce_recv (sock, n);
+      http->contentlength -= n;
+    }
+
+  if (http->contentlength <= 0)
+    {
+#if ENABLE_DEBUG
+      svz_log (SVZ_LOG_DEBUG, "fastcgi: post data sent\n");
+#endif
+      http_fcgi_record (slot, FCGI_STDIN, NULL, 0);
+      sock->userflags &= ~HTTP_FLAG_POST;
+      sock->check_request = http_check_request;
+      svz_sock_pause_read (sock);
+    }
+  else if (sock->recv_buffer_fill > 0)
+    svz_sock_pause_read (sock);
+  else
+    svz_sock_resume_read (sock);
+}
+
+/*
+ * The @code{check_request} callback of a http connection posting data
+ * to the application.
+ */
+static int
+http_fcgi_post (svz_socket_t *sock)
+{
+  http_fcgi_slot_t *slot;
+
+  if ((slot = http_fcgi_find (sock)) == NULL)
+    {
+      svz_sock_pause_read (sock);
+      return 0;
+    }
+  http_fcgi_stdin (slot);
+  return 0;
+}
+
+/*
+ * The @code{write_socket} callback of a http connection receiving the
+ * response of the application.  Continue with the response held back
+ * for lack of room in the send buffer.
+ */
+static int
+http_fcgi_write (svz_socket_t *sock)
+{
+  http_fcgi_slot_t *slot;
+  svz_socket_t *conn;
+  int ret;
+
+  ret = http_default_write (sock);
+  if (ret == 0
+      && (slot = http_fcgi_find (sock)) != NULL
+      && (conn = slot->conn) != NULL
+      && conn->flags & SVZ_SOFLG_PAUSED
+      && sock->send_buffer_fill < sock->send_buffer_size)
+    {
+      svz_sock_resume_read (conn);
+      if (http_fcgi_check (conn))
+        svz_sock_schedule_for_shutdown (conn);
+    }
+  return ret;
+}
+
+/*
+ * The @code{disconnected_socket} callback of a http connection with a
+ * request for the application.  A request in progress is aborted, but
+ * its connection remains busy until the application has ended it.
+ */
+static int
+http_fcgi_disconnect (svz_socket_t *sock)
+{
+  http_config_t *cfg = sock->cfg;
+  http_fcgi_request_t *req;
+  http_fcgi_slot_t *slot;
+  size_t n;
+
+  if ((slot = http_fcgi_find (sock)) != NULL)
+    {
+      if (slot->conn)
+        {
+          if (sock->userflags & HTTP_FLAG_POST)
+            http_fcgi_record (slot, FCGI_STDIN, NULL, 0);
+          http_fcgi_record (slot, FCGI_ABORT_REQUEST, NULL, 0);
+        }
+      slot->client = NULL;
+
+      /* drop the output held back for this client up to the end */
+      if (slot->conn && slot->conn->flags & SVZ_SOFLG_PAUSED)
+        {
+          svz_sock_resume_read (slot->conn);
+          if (http_fcgi_check (slot->conn))
+            svz_sock_schedule_for_shutdown (slot->conn);
+        }
+    }
+  else if (cfg->fcgi)
+    {
+      svz_array_foreach (cfg->fcgi->queue, req, n)
+        if (req->sock == sock)
+          {
+            svz_array_del (cfg->fcgi->queue, n);
+            http_fcgi_free_request (req);
+            break;
+          }
+    }
+
+  return http_disconnect (sock);
+}
+
+/*
+ * The request in progress on SLOT has ended.  Finish the response to
+ * its client and start the next waiting request.
+ */
+static void
+http_fcgi_end (http_fcgi_slot_t *slot)
+{
+  svz_socket_t *sock = slot->client;
+  http_socket_t *http;
+
+  slot->busy = 0;
+  slot->client = NULL;
+  if (sock != NULL)
+    {
+      http = sock->data;
+
+      /* the application failed without responding */
+      if (http->response == 0)
+        http_fcgi_fail (sock);
+      else
+        {
+          sock->userflags &= ~(HTTP_FLAG_FCGI | HTTP_FLAG_POST);
+          sock->check_request = http_check_request;
+          sock->write_socket = http_default_write;
+          sock->userflags |= HTTP_FLAG_DONE;
+        }
+      if (sock->send_buffer_fill == 0)
+        svz_sock_schedule_for_shutdown (sock);
+    }
+
+  http_fcgi_dispatch (slot->pool);
+}
+
+/*
+ * Pass the content DATA of LEN bytes of an output record to the client
+ * of SLOT, as much as fits into its send buffer.  Return the number of
+ * bytes passed.
+ */
+static int
+http_fcgi_output (http_fcgi_slot_t *slot, char *data, int len)
+{
+  svz_socket_t *sock = slot->client;
+  http_socket_t *http = sock->data;
+  int room;
+
+  if (http->response == 0 && http_cgi_accepted (sock) == -1)
+    {
+      svz_sock_schedule_for_shutdown (sock);
+      return len;
+    }
+
+  room = sock->send_buffer_size - sock->send_buffer_fill;
+  if (len > room)
+    len = room;
+  if (len <= 0)
+    {
+      /* continue when the client has sent some of its buffer */
+      svz_sock_pause_read (slot->conn);
+      return 0;
+    }
+
+  if (svz_sock_write (sock, data, len) == -1)
+    svz_sock_schedule_for_shutdown (sock);
+  http->length += len;
+  return len;
+}
+
+/*
+ * Process the content DATA of LEN bytes of the record being received by
+ * SLOT.  Return the number of bytes processed, or zero to wait for more
+ * data or room.
+ */
+static int
+http_fcgi_content (http_fcgi_slot_t *slot, char *data, int len)
+{
+  unsigned char *p = (unsigned char *) data;
+  int n;
+
+  /* records of ended or aborted requests are dropped */
+  if (!slot->busy || slot->id != slot->request)
+    return len;
+
+  switch (slot->type)
+    {
+    case FCGI_STDOUT:
+      if (slot->client == NULL)
+        return len;
+      return http_fcgi_output (slot, data, len);
+
+    case FCGI_STDERR:
+      n = len;
+      while (n > 0 && (data[n - 1] == '\n' || data[n - 1] == '\r'))
+        n--;
+      if (n > 0)
+        svz_log (SVZ_LOG_ERROR, "fastcgi: %.*s\n", n, data);
+      return len;
+
+    case FCGI_END_REQUEST:
+      if (len < slot->left)
+        return 0;
+      if (p[4] != FCGI_REQUEST_COMPLETE)
+        svz_log (SVZ_LOG_ERROR, "fastcgi: request rejected (%d)\n", p[4]);
+      http_fcgi_end (slot);
+      return len;
+
+    default:
+      return len;
+    }
+}
+
+/*
+ * The @code{check_request} callback of a connection to the application.
+ * Records are processed as they arrive, the content of large ones is
+ * passed on piece by piece.
+ */
+static int
+http_fcgi_check (svz_socket_t *conn)
+{
+  http_fcgi_slot_t *slot = conn->data;
+  unsigned char *p;
+  int n;
+
+  if (slot == NULL)
+    return -1;
+
+  for (;;)
+    {
+      p = (unsigned char *) conn->recv_buffer;
+
+      /* the header of the next record */
+      if (slot->type < 0)
+        {
+          if (conn->recv_buffer_fill < FCGI_HEADER_LEN)
+            break;
+          if (p[0] != FCGI_VERSION_1)
+            {
+              svz_log (SVZ_LOG_ERROR, "fastcgi: invalid record\n");
+              return -1;
+            }
+          slot->type = p[1];
+          slot->id = (p[2] << 8) | p[3];
+          slot->left = (p[4] << 8) | p[5];
+          slot->padding = p[6];
+          svz_sock_reduce_recv (conn, FCGI_HEADER_LEN);
+          continue;
+        }
+
+      /* its content and padding */
+      if (slot->left > 0)
+        {
+          n = conn->recv_buffer_fill < slot->left
+            ? conn->recv_buffer_fill : slot->left;
+          if (n == 0
+              || (n = http_fcgi_content (slot, conn->recv_buffer, n)) == 0)
+            break;
+          slot->left -= n;
+        }
+      else if (slot->padding > 0)
+        {
+          n = conn->recv_buffer_fill < slot->padding
+            ? conn->recv_buffer_fill : slot->padding;
+          if (n == 0)
+            break;
+          slot->padding -= n;
+        }
+      else
+        {
+          slot->type = -1;
+          continue;
+        }
+
+      /* the connection may have been shut down meanwhile */
+      if (conn->data == NULL)
+        return -1;
+      svz_sock_reduce_recv (conn, n);
+    }
+
+  return 0;
+}
+
+/*
+ * The @code{read_socket} callback of a connection to the application.
+ */
+static int
+http_fcgi_read (svz_socket_t *conn)
+{
+  int num_read, do_read;
+
+  do_read = conn->recv_buffer_size - conn->recv_buffer_fill;
+  if (do_read <= 0)
+    return 0;
+
+  num_read = read (conn->pipe_desc[SVZ_READ],
+                   conn->recv_buffer + conn->recv_buffer_fill, do_read);
+  if (num_read < 0)
+    {
+      if (errno == EAGAIN)
+        return 0;
+      svz_log_sys_error ("fastcgi: read");
+      return -1;
+    }
+
+  /* the application has closed the connection */
+  if (num_read == 0)
+    return -1;
+
+  conn->last_recv = time (NULL);
+  conn->recv_buffer_fill += num_read;
+  return http_fcgi_check (conn);
+}
+
+/*
+ * The @code{write_socket} callback of a connection to the application.
+ * Take more of the posted data when the send buffer has been flushed.
+ */
+static int
+http_fcgi_send (svz_socket_t *conn)
+{
+  http_fcgi_slot_t *slot = conn->data;
+  int num_written;
+
+  num_written = write (conn->pipe_desc[SVZ_WRITE],
+                       conn->send_buffer, conn->send_buffer_fill);
+  if (num_written < 0)
+    {
+      if (errno == EAGAIN)
+        return 0;
+      svz_log_sys_error ("fastcgi: write");
+      return -1;
+    }
+
+  conn->last_send = time (NULL);
+  svz_sock_reduce_send (conn, num_written);
+  if (slot && slot->client && slot->client->userflags & HTTP_FLAG_POST)
+    http_fcgi_stdin (slot);
+  return 0;
+}
+
+/*
+ * The @code{disconnected_socket} callback of a connection to the
+ * application.  A request in progress is lost.
+ */
+static int
+http_fcgi_closed (svz_socket_t *conn)
+{
+  http_fcgi_slot_t *slot = conn->data;
+
+  if (slot == NULL)
+    return 0;
+
+  conn->data = NULL;
+  slot->conn = NULL;
+  slot->type = -1;
+  slot->left = slot->padding = 0;
+  if (slot->busy)
+    {
+      svz_log (SVZ_LOG_ERROR, "fastcgi: lost connection to %s\n",
+               slot->pool->path);
+      http_fcgi_end (slot);
+    }
+  return 0;
+}
+
+/*
+ * Connect SLOT to the application.  Return zero on success.
+ */
+static int
+http_fcgi_connect (http_fcgi_slot_t *slot)
+{
+  struct sockaddr_un addr;
+  svz_socket_t *conn;
+  int fd, wfd;
+
+  if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+      svz_log_net_error ("fastcgi: socket");
+      return -1;
+    }
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, slot->pool->path);
+
+  if (fcntl (fd, F_SETFL, O_NONBLOCK) == -1
+      || connect (fd, (struct sockaddr *) &addr, sizeof (addr)) == -1)
+    {
+      svz_log_sys_error ("fastcgi: connect (%s)", slot->pool->path);
+      close (fd);
+      return -1;
+    }
+
+  /* the socket is used for both directions */
+  if ((wfd = dup (fd)) == -1)
+    {
+      svz_log_sys_error ("fastcgi: dup");
+      close (fd);
+      return -1;
+    }
+  if ((conn = svz_pipe_create (fd, wfd)) == NULL)
+    {
+      close (fd);
+      close (wfd);
+      return -1;
+    }
+
+  conn->flags |= SVZ_SOFLG_NOFLOOD | SVZ_SOFLG_NOOVERFLOW;
+  conn->read_socket = http_fcgi_read;
+  conn->write_socket = http_fcgi_send;
+  conn->check_request = http_fcgi_check;
+  conn->disconnected_socket = http_fcgi_closed;
+  conn->data = slot;
+  if (svz_sock_enqueue (conn) < 0)
+    {
+      close (fd);
+      close (wfd);
+      return -1;
+    }
+
+  slot->conn = conn;
+  slot->type = -1;
+  slot->left = slot->padding = 0;
+  return 0;
+}
+
+/*
+ * Send the request REQ via SLOT.  Return zero on success.
+ */
+static int
+http_fcgi_start (http_fcgi_slot_t *slot, http_fcgi_request_t *req)
+{
+  static char begin[FCGI_HEADER_LEN] = { 0, FCGI_RESPONDER, FCGI_KEEP_CONN };
+  svz_socket_t *sock = req->sock;
+  char *p;
+  int n, size;
+
+  if (slot->conn == NULL && http_fcgi_connect (slot))
+    return -1;
+
+  /* request ids change, so that records of aborted requests are ignored */
+  if (++slot->request > 0xffff)
+    slot->request = 1;
+
+  http_fcgi_record (slot, FCGI_BEGIN_REQUEST, begin, FCGI_HEADER_LEN);
+  for (p = req->params, size = req->size; size > 0; p += n, size -= n)
+    {
+      n = size > FCGI_MAX_LENGTH ? FCGI_MAX_LENGTH : size;
+      http_fcgi_record (slot, FCGI_PARAMS, p, n);
+    }
+  http_fcgi_record (slot, FCGI_PARAMS, NULL, 0);
+
+  slot->busy = 1;
+  slot->client = sock;
+  sock->write_socket = http_fcgi_write;
+
+  if (sock->userflags & HTTP_FLAG_POST)
+    http_fcgi_stdin (slot);
+  else
+    http_fcgi_record (slot, FCGI_STDIN, NULL, 0);
+  return 0;
+}
+
+/*
+ * Start waiting requests as long as there are free connections.
+ */
+static void
+http_fcgi_dispatch (http_fcgi_t *fcgi)
+{
+  http_fcgi_request_t *req;
+  http_fcgi_slot_t *slot;
+
+  while (svz_array_size (fcgi->queue) > 0
+         && (slot = http_fcgi_slot (fcgi)) != NULL)
+    {
+      req = svz_array_del (fcgi->queue, 0);
+      if (http_fcgi_start (slot, req))
+        http_fcgi_fail (req->sock);
+      http_fcgi_free_request (req);
+    }
+}
+
+/*
+ * Pass the cgi request of the http connection SOCK with the environment
+ * ENV to the application.  POST is non-zero if the request has content
+ * to be passed as well.  On errors, respond to SOCK and return -1.
+ */
+int
+http_fcgi_request (svz_socket_t *sock, svz_envblock_t *env, int post)
+{
+  http_config_t *cfg = sock->cfg;
+  http_fcgi_request_t *req;
+  http_fcgi_slot_t *slot;
+  unsigned char *p;
+  char *value;
+  int n, size, len;
+
+  /* encode the name-value pairs */
+  for (size = 0, n = 0; n < env->size; n++)
+    size += 2 * 4 + strlen (env->entry[n]);
+  req = svz_malloc (sizeof (http_fcgi_request_t));
+  req->sock = sock;
+  req->params = svz_malloc (size);
+  p = (unsigned char *) req->params;
+  for (n = 0; n < env->size; n++)
+    {
+      value = strchr (env->entry[n], '=');
+      len = value++ - env->entry[n];
+      size = strlen (value);
+      p += http_fcgi_length (p, len);
+      p += http_fcgi_length (p, size);
+      memcpy (p, env->entry[n], len);
+      memcpy (p + len, value, size);
+      p += len + size;
+    }
+  req->size = p - (unsigned char *) req->params;
+
+  sock->userflags |= HTTP_FLAG_FCGI;
+  sock->disconnected_socket = http_fcgi_disconnect;
+  if (post)
+    {
+      sock->userflags |= HTTP_FLAG_POST;
+      sock->check_request = http_fcgi_post;
+    }
+
+  /* wait for a free connection */
+  if ((slot = http_fcgi_slot (cfg->fcgi)) == NULL)
+    {
+      svz_array_add (cfg->fcgi->queue, req);
+      svz_sock_pause_read (sock);
+      return 0;
+    }
+
+  n = http_fcgi_start (slot, req);
+  http_fcgi_free_request (req);
+  if (n)
+    http_fcgi_fail (sock);
+  return n;
+}
+
+/*
+ * Create the socket the processes of the application accept their
+ * connections on.  Return zero on success.
+ */
+static int
+http_fcgi_listen (http_fcgi_t *fcgi)
+{
+  struct sockaddr_un addr;
+  struct stat buf;
+  int fd;
+
+  /* replace the socket of a previous instance */
+  if (lstat (fcgi->path, &buf) == 0 && S_ISSOCK (buf.st_mode))
+    unlink (fcgi->path);
+
+  if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+      svz_log_net_error ("fastcgi: socket");
+      return -1;
+    }
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, fcgi->path);
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) == -1
+      || listen (fd, SOMAXCONN) == -1)
+    {
+      svz_log_sys_error ("fastcgi: bind (%s)", fcgi->path);
+      close (fd);
+      return -1;
+    }
+  svz_fd_cloexec (fd);
+  fcgi->listener = fd;
+  return 0;
+}
+
+/*
+ * Start a process of the application.  Return its pid or -1 on errors.
+ */
+static pid_t
+http_fcgi_spawn (http_fcgi_t *fcgi)
+{
+  pid_t pid;
+
+  if ((pid = fork ()) == 0)
+    {
+      if (dup2 (fcgi->listener, FCGI_LISTENSOCK_FILENO)
+          != FCGI_LISTENSOCK_FILENO)
+        {
+          svz_log_sys_error ("fastcgi: dup2");
+          _exit (EXIT_FAILURE);
+        }
+      if (chdir (fcgi->dir) == -1)
+        svz_log_sys_error ("fastcgi: chdir (%s)", fcgi->dir);
+      execl (fcgi->app, fcgi->app, (char *) NULL);
+      svz_log_sys_error ("fastcgi: exec (%s)", fcgi->app);
+      _exit (EXIT_FAILURE);
+    }
+  else if (pid == -1)
+    svz_log_sys_error ("fastcgi: fork");
+#if ENABLE_DEBUG
+  else
+    svz_log (SVZ_LOG_DEBUG, "fastcgi: %s got pid %d\n", fcgi->app, (int) pid);
+#endif
+
+  return pid;
+}
+
+/*
+ * Create the worker pool of the http server configuration CFG if a
+ * FastCGI application is configured, and start its processes.  Return
+ * zero on success.
+ */
+int
+http_fcgi_init (http_config_t *cfg)
+{
+  http_fcgi_t *fcgi;
+  int n;
+
+  if (cfg->fastcgi == NULL)
+    return 0;
+  if (strlen (cfg->fastcgi) >= sizeof (((struct sockaddr_un *) 0)->sun_path))
+    {
+      svz_log (SVZ_LOG_ERROR, "fastcgi: socket name too long: %s\n",
+               cfg->fastcgi);
+      return -1;
+    }
+  if (cfg->fastcgi_workers <= 0)
+    cfg->fastcgi_workers = HTTP_FCGI_WORKERS;
+
+  fcgi = svz_calloc (sizeof (http_fcgi_t));
+  fcgi->path = cfg->fastcgi;
+  fcgi->app = cfg->fastcgi_app;
+  fcgi->dir = cfg->cgidir;
+  fcgi->size = cfg->fastcgi_workers;
+  fcgi->slot = svz_calloc (fcgi->size * sizeof (http_fcgi_slot_t));
+  for (n = 0; n < fcgi->size; n++)
+    {
+      fcgi->slot[n].pool = fcgi;
+      fcgi->slot[n].type = -1;
+    }
+  fcgi->queue = svz_array_create (4, NULL);
+  fcgi->listener = -1;
+  cfg->fcgi = fcgi;
+
+  if (fcgi->app)
+    {
+      if (http_fcgi_listen (fcgi))
+        {
+          http_fcgi_finalize (cfg);
+          return -1;
+        }
+      fcgi->pid = svz_malloc (fcgi->size * sizeof (pid_t));
+      for (n = 0; n < fcgi->size; n++)
+        fcgi->pid[n] = http_fcgi_spawn (fcgi);
+    }
+
+  svz_log (SVZ_LOG_NOTICE, "fastcgi: %d connections to %s\n",
+           fcgi->size, fcgi->path);
+  return 0;
+}
+
+/*
+ * Restart the processes of the application which have died.  This is
+ * done by the server's timer.
+ */
+void
+http_fcgi_notify (http_config_t *cfg)
+{
+  http_fcgi_t *fcgi = cfg->fcgi;
+  int n;
+
+  if (fcgi == NULL || fcgi->pid == NULL)
+    return;
+
+  for (n = 0; n < fcgi->size; n++)
+    {
+      /* the pid may have been collected by the SIGCHLD handler already */
+      if (fcgi->pid[n] != -1 && waitpid (fcgi->pid[n], NULL, WNOHANG) == 0)
+        continue;
+      if (fcgi->pid[n] != -1)
+        svz_log (SVZ_LOG_NOTICE, "fastcgi: %s pid %d died\n",
+                 fcgi->app, (int) fcgi->pid[n]);
+      fcgi->pid[n] = http_fcgi_spawn (fcgi);
+    }
+}
+
+/*
+ * Close the connections to the application, stop its processes, and
+ * destroy the worker pool of CFG.
+ */
+void
+http_fcgi_finalize (http_config_t *cfg)
+{
+  http_fcgi_t *fcgi = cfg->fcgi;
+  http_fcgi_request_t *req;
+  size_t n;
+
+  if (fcgi == NULL)
+    return;
+
+  for (n = 0; n < (size_t) fcgi->size; n++)
+    if (fcgi->slot[n].conn)
+      {
+        fcgi->slot[n].conn->data = NULL;
+        svz_sock_schedule_for_shutdown (fcgi->slot[n].conn);
+      }
+  svz_array_foreach (fcgi->queue, req, n)
+    http_fcgi_free_request (req);
+  svz_array_destroy (fcgi->queue);
+
+  if (fcgi->pid)
+    {
+      for (n = 0; n < (size_t) fcgi->size; n++)
+        if (fcgi->pid[n] != -1 && kill (fcgi->pid[n], SIGTERM) == -1)
+          svz_log_sys_error ("fastcgi: kill");
+      svz_free (fcgi->pid);
+    }
+  if (fcgi->listener != -1)
+    {
+      close (fcgi->listener);
+      unlink (fcgi->path);
+    }
+
+  svz_free (fcgi->slot);
+  svz_free (fcgi);
+  cfg->fcgi = NULL;
+}
+
+#else /* __MINGW32__ */
+
+int
+http_fcgi_init (http_config_t *cfg)
+{
+  if (cfg->fastcgi == NULL)
+    return 0;
+  svz_log (SVZ_LOG_ERROR, "fastcgi: not supported\n");
+  return -1;
+}
+
+void
+http_fcgi_finalize (UNUSED http_config_t *cfg)
+{
+}
+
+void
+http_fcgi_notify (UNUSED http_config_t *cfg)
+{
+}
+
+int
+http_fcgi_request (UNUSED svz_socket_t *sock, UNUSED svz_envblock_t *env,
+                   UNUSED int post)
+{
+  return -1;
+}
+
+#endif /* __MINGW32__ */
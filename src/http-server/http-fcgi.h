@@ -0,0 +1,34 @@
+/*
+ * http-fcgi.h - http fastcgi client header file
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this package.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HTTP_FCGI_H__
+#define __HTTP_FCGI_H__ 1
+
+#include "http-proto.h"
+
+/* default number of connections to (and processes of) the application */
+#define HTTP_FCGI_WORKERS 4
+
+/*
+ * FastCGI client functions.
+ */
+int http_fcgi_init (http_config_t *cfg);
+void http_fcgi_finalize (http_config_t *cfg);
+void http_fcgi_notify (http_config_t *cfg);
+int http_fcgi_request (svz_socket_t *sock, svz_envblock_t *env, int post);
+
+#endif /* __HTTP_FCGI_H__ */
@@ -0,0 +1,309 @@
+/*
+ * http-fd.c - http file descriptor cache
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this package.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "libserveez.h"
+#include "unused.h"
+#include "o-binary.h"
+#include "http-fd.h"
+
+#if HTTP_FD_CACHE
+
+/*
+ * Files which are sent to several clients at once, or one after the
+ * other, are opened only once.  Each client sends from its own offset.
+ * Descriptors which are not currently used are kept in a list in order
+ * of their last use, most recent first, and closed when they become too
+ * old or when room for others is needed.
+ */
+typedef struct http_fd http_fd_t;
+struct http_fd
+{
+  http_fd_t *next;  /* next (less recent) unused descriptor */
+  http_fd_t *prev;  /* previous (more recent) unused descriptor */
+  int fd;           /* the file descriptor */
+  int usage;        /* how many clients are using it */
+  int stale;        /* the file has changed, close it when unused */
+  time_t opened;    /* when it was opened */
+  time_t date;      /* date of last modification */
+  ino_t inode;      /* inode of the file */
+  dev_t device;     /* and its device */
+  char file[1];     /* name of the file (variable length) */
+};
+
+static svz_hash_t *http_fd_files = NULL; /* file name -> descriptor */
+static svz_hash_t *http_fd_descs = NULL; /* descriptor number -> descriptor */
+static http_fd_t *http_fd_first = NULL;  /* most recently used */
+static http_fd_t *http_fd_last = NULL;   /* least recently used */
+
+/*
+ * Write the hash key for the file descriptor FD to KEY.
+ */
+static char *
+http_fd_key (char *key, int fd)
+{
+  sprintf (key, "%d", fd);
+  return key;
+}
+
+/*
+ * Remove the unused descriptor ENTRY from the list.
+ */
+static void
+http_fd_unlink (http_fd_t *entry)
+{
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    http_fd_first = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    http_fd_last = entry->prev;
+  entry->next = entry->prev = NULL;
+}
+
+/*
+ * Put the descriptor ENTRY, which has just become unused, at the head
+ * of the list.
+ */
+static void
+http_fd_link (http_fd_t *entry)
+{
+  entry->prev = NULL;
+  entry->next = http_fd_first;
+  if (http_fd_first)
+    http_fd_first->prev = entry;
+  else
+    http_fd_last = entry;
+  http_fd_first = entry;
+}
+
+/*
+ * Close the descriptor ENTRY and forget about it.
+ */
+static void
+http_fd_destroy (http_fd_t *entry)
+{
+  char key[16];
+
+  if (!entry->stale)
+    svz_hash_delete (http_fd_files, entry->file);
+  svz_hash_delete (http_fd_descs, http_fd_key (key, entry->fd));
+  if (!entry->usage)
+    http_fd_unlink (entry);
+  if (svz_close (entry->fd) == -1)
+    svz_log_sys_error ("close");
+  svz_free (entry);
+}
+
+/*
+ * Close the descriptor ENTRY as soon as no client uses it anymore.
+ */
+static void
+http_fd_invalidate (http_fd_t *entry)
+{
+  if (entry->usage)
+    {
+      svz_hash_delete (http_fd_files, entry->file);
+      entry->stale = 1;
+    }
+  else
+    http_fd_destroy (entry);
+}
+
+/*
+ * Return a descriptor open for reading FILE, whose properties BUF have
+ * just been determined.  The descriptor is shared with other clients
+ * sending the same file, thus its file position must not be used.
+ * Return -1 if the file cannot be opened.
+ */
+int
+http_fd_open (char *file, struct stat *buf)
+{
+  http_fd_t *entry;
+  time_t now = time (NULL);
+  char key[16];
+  int fd;
+
+  if (http_fd_files == NULL)
+    {
+      http_fd_files = svz_hash_create (HTTP_FD_MAX, NULL);
+      http_fd_descs = svz_hash_create (HTTP_FD_MAX, NULL);
+    }
+
+  if ((entry = svz_hash_get (http_fd_files, file)) != NULL)
+    {
+      if (entry->date == buf->st_mtime &&
+          entry->inode == buf->st_ino && entry->device == buf->st_dev &&
+          now - entry->opened < HTTP_FD_AGE)
+        {
+          if (entry->usage++ == 0)
+            http_fd_unlink (entry);
+          return entry->fd;
+        }
+      http_fd_invalidate (entry);
+    }
+
+  if ((fd = svz_open (file, O_RDONLY | O_BINARY, 0)) == -1)
+    return -1;
+
+  /* make room for the new descriptor if possible */
+  while (svz_hash_size (http_fd_descs) >= HTTP_FD_MAX && http_fd_last)
+    http_fd_destroy (http_fd_last);
+  if (svz_hash_size (http_fd_descs) >= HTTP_FD_MAX)
+    return fd;
+
+  entry = svz_malloc (sizeof (http_fd_t) + strlen (file));
+  memset (entry, 0, sizeof (http_fd_t));
+  entry->fd = fd;
+  entry->usage = 1;
+  entry->opened = now;
+  entry->date = buf->st_mtime;
+  entry->inode = buf->st_ino;
+  entry->device = buf->st_dev;
+  strcpy (entry->file, file);
+  svz_hash_put (http_fd_files, file, entry);
+  svz_hash_put (http_fd_descs, http_fd_key (key, fd), entry);
+  return fd;
+}
+
+/*
+ * Release the descriptor FD returned by ‘http_fd_open’.  Descriptors
+ * which are not shared are closed at once.
+ */
+void
+http_fd_close (int fd)
+{
+  http_fd_t *entry;
+  char key[16];
+
+  if (http_fd_descs == NULL
+      || (entry = svz_hash_get (http_fd_descs, http_fd_key (key, fd)))
+      == NULL)
+    {
+      if (svz_close (fd) == -1)
+        svz_log_sys_error ("close");
+      return;
+    }
+
+  if (--entry->usage > 0)
+    return;
+  http_fd_link (entry);
+  if (entry->stale || time (NULL) - entry->opened >= HTTP_FD_AGE)
+    http_fd_destroy (entry);
+}
+
+/*
+ * Close all unused descriptors which are too old to be reused.
+ */
+void
+http_fd_expire (void)
+{
+  time_t now = time (NULL);
+  http_fd_t *entry, *next;
+
+  for (entry = http_fd_first; entry; entry = next)
+    {
+      next = entry->next;
+      if (now - entry->opened >= HTTP_FD_AGE)
+        http_fd_destroy (entry);
+    }
+}
+
+/*
+ * Return the number of open descriptors.
+ */
+int
+http_fd_count (void)
+{
+  return http_fd_descs ? (int) svz_hash_size (http_fd_descs) : 0;
+}
+
+static void
+collect_entry (UNUSED void *k, void *v, void *closure)
+{
+  svz_array_add (closure, v);
+}
+
+/*
+ * Close all unused descriptors and the others as soon as possible.
+ */
+void
+http_fd_finalize (void)
+{
+  svz_array_t *entries;
+  http_fd_t *entry;
+  size_t n;
+
+  if (http_fd_files == NULL)
+    return;
+
+  entries = svz_array_create (svz_hash_size (http_fd_files), NULL);
+  svz_hash_foreach (collect_entry, http_fd_files, entries);
+  svz_array_foreach (entries, entry, n)
+    http_fd_invalidate (entry);
+  svz_array_destroy (entries);
+
+  if (svz_hash_size (http_fd_descs) == 0)
+    {
+      svz_hash_destroy (http_fd_descs);
+      svz_hash_destroy (http_fd_files);
+      http_fd_descs = http_fd_files = NULL;
+    }
+}
+
+#else /* not HTTP_FD_CACHE */
+
+int
+http_fd_open (char *file, UNUSED struct stat *buf)
+{
+  return svz_open (file, O_RDONLY | O_BINARY, 0);
+}
+
+void
+http_fd_close (int fd)
+{
+  if (svz_close (fd) == -1)
+    svz_log_sys_error ("close");
+}
+
+void
+http_fd_expire (void)
+{
+}
+
+int
+http_fd_count (void)
+{
+  return 0;
+}
+
+void
+http_fd_finalize (void)
+{
+}
+
+#endif /* not HTTP_FD_CACHE */
@@ -0,0 +1,46 @@
+/*
+ * http-fd.h - http file descriptor cache header file
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this package.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HTTP_FD_H__
+#define __HTTP_FD_H__ 1
+
+/*
+ * File descriptors can only be shared by clients which never depend on
+ * the file position, i.e. those served via ‘svz_sendfile’.
+ */
+#if ENABLE_SENDFILE && HAVE_SENDFILE && !defined (__MINGW32__)
+# define HTTP_FD_CACHE 1
+#else
+# define HTTP_FD_CACHE 0
+#endif
+
+/*
+ * Limits for the file descriptor cache.
+ */
+#define HTTP_FD_MAX 64 /* maximum number of open descriptors */
+#define HTTP_FD_AGE 60 /* seconds a descriptor may be reused */
+
+/*
+ * Basic file descriptor cache functions.
+ */
+int http_fd_open (char *file, struct stat *buf);
+void http_fd_close (int fd);
+void http_fd_expire (void);
+void http_fd_finalize (void);
+int http_fd_count (void);
+
+#endif /* __HTTP_FD_H__ */
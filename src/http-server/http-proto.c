@@ -59,6 +59,9 @@
 #include "http-cgi.h"
 #include "http-dirlist.h"
 #include "http-cache.h"
+#include "http-watch.h"
+#include "http-fd.h"
+#include "http-fcgi.h"
 #include "unused.h"
 
 /*
@@ -71,7 +74,8 @@ http_config_t http_config =
   "/cgi-bin",         /* how cgi-requests are detected */
   "./cgibin",         /* cgi script root */
   MAX_CACHE_SIZE,     /* maximum file size to cache them */
-  MAX_CACHE,          /* maximum amount of cache entries */
+  MAX_CACHE_LIMIT,    /* maximum cache memory */
+  -1,                 /* maximum amount of cache entries (deprecated) */
   HTTP_TIMEOUT,       /* server shuts connection down after x seconds */
   HTTP_MAXKEEPALIVE,  /* how many files when using keep-alive */
   "text/plain",       /* standard content type */
@@ -85,7 +89,13 @@ http_config_t http_config =
   0,                  /* enable identd requests */
   "http-access.log",  /* log file name */
   HTTP_CLF,           /* custom log file format string */
-  NULL                /* log file stream */
+  NULL,               /* log file stream */
+  NULL,               /* pre-rendered content type header fields */
+  NULL,               /* pre-rendered keep-alive header fields */
+  NULL,               /* socket of the FastCGI application */
+  NULL,               /* FastCGI application run by the server */
+  HTTP_FCGI_WORKERS,  /* number of its connections (and processes) */
+  NULL                /* its worker pool */
 };
 
 /*
@@ -99,6 +109,8 @@ svz_key_value_pair_t http_config_prototype[] =
   SVZ_REGISTER_STR ("cgi-url", http_config.cgiurl, SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_STR ("cgi-dir", http_config.cgidir, SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_INT ("cache-size", http_config.cachesize, SVZ_ITEM_DEFAULTABLE),
+  SVZ_REGISTER_INT ("cache-limit", http_config.cachelimit,
+                    SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_INT ("cache-entries", http_config.cacheentries,
                     SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_INT ("timeout", http_config.timeout, SVZ_ITEM_DEFAULTABLE),
@@ -116,6 +128,11 @@ svz_key_value_pair_t http_config_prototype[] =
   SVZ_REGISTER_STR ("userdir", http_config.userdir, SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_BOOL ("nslookup", http_config.nslookup, SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_BOOL ("ident", http_config.ident, SVZ_ITEM_DEFAULTABLE),
+  SVZ_REGISTER_STR ("fastcgi", http_config.fastcgi, SVZ_ITEM_DEFAULTABLE),
+  SVZ_REGISTER_STR ("fastcgi-application", http_config.fastcgi_app,
+                    SVZ_ITEM_DEFAULTABLE),
+  SVZ_REGISTER_INT ("fastcgi-workers", http_config.fastcgi_workers,
+                    SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_END ()
 };
 
@@ -134,7 +151,7 @@ svz_servertype_t http_server_definition =
   http_global_finalize,  /* global finalizer */
   http_info_client,      /* client info */
   http_info_server,      /* server info */
-  NULL,                  /* server timer */
+  http_notify,           /* server timer */
   NULL,                  /* server reset */
   NULL,                  /* handle request callback */
   SVZ_CONFIG_DEFINE ("http", http_config, http_config_prototype)
@@ -174,7 +191,7 @@ http_global_init (UNUSED svz_servertype_t *server)
 #ifdef __MINGW32__
   http_start_netapi ();
 #endif /* __MINGW32__ */
-  http_alloc_cache (MAX_CACHE);
+  http_alloc_cache (MAX_CACHE_LIMIT);
   return 0;
 }
 
@@ -184,6 +201,8 @@ http_global_init (UNUSED svz_servertype_t *server)
 int
 http_global_finalize (UNUSED svz_servertype_t *server)
 {
+  http_watch_finalize ();
+  http_fd_finalize ();
   http_free_cache ();
 #ifdef __MINGW32__
   http_stop_netapi ();
@@ -242,6 +261,7 @@ http_init (svz_server_t *server)
     }
   svz_log (SVZ_LOG_NOTICE, "http: %d+%d known content types\n",
            types, svz_hash_size (cfg->types) - types);
+  http_render_fields (cfg);
 
   /* check user directory path, snip trailing '/' or '\' */
   if (!cfg->userdir || !strlen (cfg->userdir))
@@ -265,12 +285,21 @@ http_init (svz_server_t *server)
   if (*p == '/' || *p == '\\')
     *p = '\0';
 
-  if (cfg->cacheentries > 0)
-    http_alloc_cache (cfg->cacheentries);
+  if (cfg->cachelimit > 0)
+    http_alloc_cache (cfg->cachelimit);
+
+  /* the cache is not limited by the number of its entries anymore */
+  if (cfg->cacheentries >= 0)
+    svz_log (SVZ_LOG_WARNING, "http: `cache-entries' is deprecated and "
+             "ignored, use `cache-limit'\n");
 
   /* generate cgi associations */
   http_gen_cgi_apps (cfg);
 
+  /* connect cgi requests to a FastCGI application if configured */
+  if (http_fcgi_init (cfg))
+    return -1;
+
   return 0;
 }
 
@@ -284,7 +313,21 @@ http_finalize (svz_server_t *server)
 
   if (cfg->log)
     svz_fclose (cfg->log);
+  http_free_fields (cfg);
+  http_fcgi_finalize (cfg);
+
+  return 0;
+}
 
+/*
+ * The http server's timer routine.  Close the file descriptors which
+ * have not been used for a while and restart died FastCGI processes.
+ */
+int
+http_notify (svz_server_t *server)
+{
+  http_fd_expire ();
+  http_fcgi_notify (server->cfg);
   return 0;
 }
 
@@ -297,48 +340,30 @@ void
 http_free_socket (svz_socket_t *sock)
 {
   http_socket_t *http = sock->data;
-  int n;
 
-  /* log this entry and free the request string */
+  /* log this entry and forget the request, keeping its buffer */
   http_log (sock);
-  if (http->request)
-    {
-      svz_free (http->request);
-      http->request = NULL;
-    }
+  http->request = NULL;
+  http->properties = 0;
+  memset (http->field, 0, sizeof (http->field));
   http->timestamp = 0;
   http->response = 0;
   http->length = 0;
 
-  /* any property at all?  */
-  if (http->property)
-    {
-      /* go through all properties */
-      n = 0;
-      while (http->property[n])
-        {
-          svz_free (http->property[n]);
-          n++;
-        }
-      svz_free (http->property);
-      http->property = NULL;
-    }
-
-  /* decrement usage counter of the cache entry */
+  /* release the cache entry */
   if (sock->userflags & HTTP_FLAG_CACHE)
     {
-      http->cache->entry->usage--;
+      http_cache_release (http->cache->entry);
     }
 
   /* is the cache entry used?  */
   if (http->cache)
     svz_free_and_zero (http->cache);
 
-  /* close the file descriptor for usual http file transfer */
+  /* release the file descriptor for usual http file transfer */
   if (sock->file_desc != -1)
     {
-      if (svz_close (sock->file_desc) == -1)
-        svz_log_sys_error ("close");
+      http_fd_close (sock->file_desc);
       sock->file_desc = -1;
     }
 }
@@ -362,6 +387,8 @@ http_disconnect (svz_socket_t *sock)
         svz_free (http->host);
       if (http->ident)
         svz_free (http->ident);
+      if (http->header)
+        svz_free (http->header);
       svz_free (http);
       sock->data = NULL;
     }
@@ -439,12 +466,11 @@ http_send_file (svz_socket_t *sock)
        * the writers there will not be additional data from now on
        */
       sock->read_socket = svz_tcp_read_socket;
-      sock->recv_buffer_fill = 0;
       sock->send_buffer_fill = 0;
       sock->write_socket = http_default_write;
       sock->userflags &= ~HTTP_FLAG_SENDFILE;
-      num_written = http_keep_alive (sock);
       svz_tcp_cork (sock->sock_desc, 0);
+      num_written = http_keep_alive (sock);
     }
 
   return (num_written < 0) ? -1 : 0;
@@ -695,46 +721,59 @@ http_connect_socket (svz_server_t *server, svz_socket_t *sock)
 
 /*
  * This routine is called from http_check_request if there was
- * seen a full HTTP request (ends with a double CRLF).
+ * seen a full HTTP request (ends with a double CRLF).  The request
+ * header is copied once and split in place, so no memory is allocated
+ * for its parts.  It is removed from the receive buffer before the
+ * request is responded to, thus any content follows right at its start.
  */
 int
 http_handle_request (svz_socket_t *sock, int len)
 {
   http_socket_t *http = sock->data;
-  int n;
-  char *p, *line, *end;
+  int n, size;
+  char *p, *line, *end, *eol;
   char *request;
   char *uri;
   int flag;
   int version[2];
 
-  line = sock->recv_buffer;
-  end = sock->recv_buffer + len;
-  p = line;
+  /* the header ends in a double CRLF, thus there is a first line */
+  eol = memchr (sock->recv_buffer, '\r', len);
+  n = eol - sock->recv_buffer;
+
+  /*
+   * keep the receive buffer's request header, which is going to be
+   * replaced by the following requests: its first line as is for
+   * logging, and then the whole header for splitting it up
+   */
+  size = n + 1 + len + 1;
+  if (size > http->header_size)
+    {
+      http->header = svz_realloc (http->header, size);
+      http->header_size = size;
+    }
+  memcpy (http->header, sock->recv_buffer, n);
+  http->header[n] = '\0';
+  line = http->header + n + 1;
+  memcpy (line, sock->recv_buffer, len);
+  svz_sock_reduce_recv (sock, len);
+  end = line + len;
+  *end = '\0';
+  eol = line + n;
   flag = 0;
 
   /* scan the request type */
-  while (*p != ' ' && p < end - 1)
-    p++;
-  if (p == end || *(p + 1) != '/')
+  if ((p = memchr (line, ' ', eol - line)) == NULL || *(p + 1) != '/')
     {
       return -1;
     }
   *p = 0;
-  request = svz_malloc (p - line + 1);
-  strcpy (request, line);
+  request = line;
   line = p + 1;
 
-  /* scan the URI (file), `line' points to first character */
-  while (*p != '\r' && p < end)
-    p++;
-  if (p == end)
-    {
-      svz_free (request);
-      return -1;
-    }
-
-  /* scan back until beginning of HTTP version */
+  /* scan back from the end of the first line until beginning of
+     HTTP version */
+  p = eol;
   while (*p != ' ' && *p)
     p--;
 
@@ -742,11 +781,8 @@ http_handle_request (svz_socket_t *sock, int len)
   if (!memcmp (request, "GET", 3) && memcmp (p + 1, "HTTP/", 5))
     {
       flag |= HTTP_FLAG_SIMPLE;
-      while (*p != '\r')
-        p++;
-      uri = svz_malloc (p - line + 1);
-      strncpy (uri, line, p - line);
-      uri[p - line] = 0;
+      p = eol;
+      uri = line;
       line = p;
       version[MAJOR_VERSION] = 0;
       version[MINOR_VERSION] = 9;
@@ -756,19 +792,15 @@ http_handle_request (svz_socket_t *sock, int len)
     {
       if (p <= line)
         {
-          svz_free (request);
           return -1;
         }
       *p = 0;
-      uri = svz_malloc (p - line + 1);
-      strcpy (uri, line);
+      uri = line;
       line = p + 1;
 
       /* scan the version string of the HTTP request */
       if (memcmp (line, "HTTP/", 5))
         {
-          svz_free (request);
-          svz_free (uri);
           return -1;
         }
       line += 5;
@@ -783,12 +815,14 @@ http_handle_request (svz_socket_t *sock, int len)
         version[MINOR_VERSION] > 1 || *(line - 2) != '.') && !flag) ||
       !EOL1_P (line))
     {
-      svz_free (request);
-      svz_free (uri);
       return -1;
     }
   line += 2;
 
+  /* the URI of a simple request ends with the first line */
+  if (flag & HTTP_FLAG_SIMPLE)
+    *p = 0;
+
   /* find out properties */
   http_parse_property (sock, line, end);
 
@@ -797,9 +831,7 @@ http_handle_request (svz_socket_t *sock, int len)
 
   /* assign request properties to http structure */
   http->timestamp = time (NULL);
-  http->request = svz_malloc (strlen (request) + strlen (uri) + 11);
-  sprintf (http->request, "%s %s HTTP/%d.%d",
-           request, uri, version[MAJOR_VERSION], version[MINOR_VERSION]);
+  http->request = http->header;
 
   /* find an appropriate request callback */
   for (n = 0; n < HTTP_REQUESTS; n++)
@@ -820,42 +852,48 @@ http_handle_request (svz_socket_t *sock, int len)
       http_default_response (sock, uri, 0);
     }
 
-  svz_free (request);
-  svz_free (uri);
   return 0;
 }
 
 /*
  * Check in the receive buffer of socket SOCK for full
  * http request and call http_handle_request if necessary.
+ * Pipelined requests are handled one after the other: as long as
+ * responses are completely put into the send buffer, the following
+ * request is handled at once, otherwise as soon as the response
+ * has been sent.
  */
 int
 http_check_request (svz_socket_t *sock)
 {
-  char *p;
+  http_socket_t *http = sock->data;
+  char *p, *end;
   int len;
 
-  p = sock->recv_buffer;
-
-  while (p < sock->recv_buffer + sock->recv_buffer_fill - 3 &&
-         !EOL2_P (p))
-    p++;
-
-  if (EOL2_P (p) &&
-      p < sock->recv_buffer + sock->recv_buffer_fill - 3)
+  while (http->request == NULL)
     {
-      len = p - sock->recv_buffer + 4;
+      /* look for the double CRLF at each line feed */
+      p = sock->recv_buffer + 3;
+      end = sock->recv_buffer + sock->recv_buffer_fill;
+      while (p < end && (p = memchr (p, '\n', end - p)) != NULL &&
+             !EOL2_P (p - 3))
+        p++;
+      if (p == NULL || p >= end)
+        break;
+
+      len = p - sock->recv_buffer + 1;
       if (http_handle_request (sock, len))
         return -1;
 
-      if (sock->recv_buffer_fill > len)
-        {
-          memmove (sock->recv_buffer, sock->recv_buffer + len,
-                   sock->recv_buffer_fill - len);
-        }
-      sock->recv_buffer_fill -= len;
+      /* is the response still going on or the last one?  */
+      if (!(sock->userflags & HTTP_FLAG_DONE) || http_next_request (sock))
+        break;
     }
 
+  /* do not read further requests while responding */
+  if (http->request && !(sock->userflags & (HTTP_FLAG_POST | HTTP_FLAG_CGI)))
+    svz_sock_pause_read (sock);
+
   return 0;
 }
 
@@ -878,7 +916,8 @@ http_info_server (svz_server_t *server)
            " cgi url         : %s/\r\n"
            " cgi directory   : %s/\r\n"
            " cache file size : %d byte\r\n"
-           " cache entries   : %d files\r\n"
+           " cache limit     : %d byte (%zu used)\r\n"
+           " open files      : %d\r\n"
            " timeout         : after %d secs\r\n"
            " keep alive      : for %d requests\r\n"
            " default type    : %s\r\n"
@@ -890,7 +929,8 @@ http_info_server (svz_server_t *server)
            cfg->cgiurl,
            cfg->cgidir,
            cfg->cachesize,
-           cfg->cacheentries,
+           cfg->cachelimit, http_cache_bytes,
+           http_fd_count (),
            cfg->timeout,
            cfg->keepalive,
            cfg->default_type,
@@ -938,14 +978,12 @@ http_info_client (UNUSED svz_server_t *server, svz_socket_t *sock)
                "    size    : %d of %d bytes sent\r\n"
                "    usage   : %d\r\n"
                "    hits    : %d\r\n"
-               "    urgency : %d\r\n"
                "    ready   : %s\r\n"
                "    date    : %s\r\n",
                cache->entry->file,
                cache->entry->size - cache->size, cache->entry->size,
                cache->entry->usage,
                cache->entry->hits,
-               http_cache_urgency (cache->entry) + 1,
                cache->entry->ready ? "yes" : "no",
                http_asc_date (cache->entry->date));
       strcat (info, text);
@@ -955,7 +993,9 @@ http_info_client (UNUSED svz_server_t *server, svz_socket_t *sock)
       sprintf (text, "  * sending cgi output (pid: %d)\r\n", (int) http->pid);
       strcat (info, text);
     }
-  if (sock->userflags & HTTP_FLAG_POST)
+  if (sock->userflags & HTTP_FLAG_FCGI)
+    strcat (info, "  * passing request to fastcgi application\r\n");
+  else if (sock->userflags & HTTP_FLAG_POST)
     {
       sprintf (text,
                "  * receiving cgi input\r\n"
@@ -969,15 +1009,14 @@ http_info_client (UNUSED svz_server_t *server, svz_socket_t *sock)
   strcat (info, text);
 
   /* append http header properties is possible */
-  if (http->property)
+  if (http->properties)
     {
       strcat (info, "  * request property list:\r\n");
-      n = 0;
-      while (http->property[n])
+      for (n = 0; n < http->properties; n++)
         {
           sprintf (text, "    %s => %s\r\n",
-                   http->property[n], http->property[n + 1]);
-          n += 2;
+                   HTTP_PROPERTY_NAME (http, n),
+                   HTTP_PROPERTY_VALUE (http, n));
           strcat (info, text);
         }
     }
@@ -985,6 +1024,230 @@ http_info_client (UNUSED svz_server_t *server, svz_socket_t *sock)
   return info;
 }
 
+/*
+ * Start sending the complete cache entry of the http socket SOCK.  As
+ * much of it as fits into the send buffer goes along with the response
+ * header (unless FLAGS says there is none), the rest is sent by the
+ * cache writer.
+ */
+static void
+http_send_cache (svz_socket_t *sock, int flags)
+{
+  http_socket_t *http = sock->data;
+  http_cache_t *cache = http->cache;
+  int size;
+
+  cache->entry->hits++;
+  http_cache_pin (cache->entry);
+
+  if (!(flags & HTTP_FLAG_SIMPLE))
+    {
+      size = sock->send_buffer_size - sock->send_buffer_fill;
+      if (size > cache->size)
+        size = cache->size;
+      memcpy (sock->send_buffer + sock->send_buffer_fill,
+              cache->buffer, size);
+      sock->send_buffer_fill += size;
+      cache->buffer += size;
+      cache->size -= size;
+      http->length += size;
+    }
+
+  /* small files are done with that */
+  if (cache->size <= 0)
+    {
+      http_cache_release (cache->entry);
+      cache->entry = NULL;
+      sock->userflags |= HTTP_FLAG_DONE;
+    }
+  /* otherwise initialize the cache routines */
+  else
+    {
+      sock->userflags |= HTTP_FLAG_CACHE;
+      if (sock->send_buffer_fill == 0)
+        {
+          sock->send_buffer_fill = 42;
+          sock->write_socket = http_cache_write;
+        }
+    }
+}
+
+/*
+ * Send a listing of the directory DIR of the http socket SOCK.  Listings
+ * are kept in the http file cache until the directory or one of its
+ * entries changes.  The name of DIR must end in a slash.  If the
+ * listing has been requested via "~user" syntax, USERDIR is the
+ * request.  Return zero on success.
+ */
+static int
+http_send_dirlist (svz_socket_t *sock, char *dir, char *userdir)
+{
+  http_socket_t *http = sock->data;
+  http_config_t *cfg = sock->cfg;
+  http_cache_t *cache;
+  struct stat buf;
+  char *name, *list;
+  int length, status = HTTP_CACHE_INHIBIT;
+
+  cache = svz_calloc (sizeof (http_cache_t));
+  http->cache = cache;
+  http->response = 200;
+
+  /* is there a listing of the unchanged directory?  */
+  if (stat (dir, &buf) != -1)
+    {
+      status = http_check_cache (dir, cache);
+      if (status == HTTP_CACHE_COMPLETE &&
+          (buf.st_mtime != cache->entry->date ||
+           buf.st_ino != cache->entry->inode ||
+           buf.st_dev != cache->entry->device))
+        {
+          http_cache_invalidate (cache->entry);
+          cache->entry = NULL;
+          status = HTTP_CACHE_NO;
+        }
+      if (status == HTTP_CACHE_COMPLETE)
+        {
+          http_send_cache (sock, 0);
+          return 0;
+        }
+    }
+
+  /* ‘http_dirlist’ snips the trailing slash of its argument */
+  name = svz_strdup (dir);
+  list = http_dirlist (name, cfg->docs, userdir);
+  svz_free (name);
+  if (list == NULL)
+    return -1;
+  length = strlen (list);
+
+  /* remember the listing if possible */
+  if (status == HTTP_CACHE_NO && http_init_cache (dir, length, cache) != -1)
+    {
+      cache->entry->date = buf.st_mtime;
+      cache->entry->inode = buf.st_ino;
+      cache->entry->device = buf.st_dev;
+      http_cache_store (cache, svz_realloc (list, length), length);
+      http_send_cache (sock, 0);
+      return 0;
+    }
+
+  /* otherwise send it once */
+  http->length = length;
+  if (sock->send_buffer_fill == 0)
+    {
+      svz_free (sock->send_buffer);
+      sock->send_buffer = list;
+      sock->send_buffer_size = http_dirlist_size;
+      sock->send_buffer_fill = length;
+    }
+  else
+    {
+      svz_sock_write (sock, list, length);
+      svz_free (list);
+    }
+  sock->userflags |= HTTP_FLAG_DONE;
+  return 0;
+}
+
+/*
+ * Content codings of precompressed files, most preferred first.  The
+ * precompressed variant of a file has got the same name plus a suffix.
+ */
+static struct
+{
+  char *coding;
+  char *suffix;
+}
+http_precompressed[] =
+{
+  { "br",   ".br" },
+  { "gzip", ".gz" },
+  { NULL,   NULL  }
+};
+
+/*
+ * Look for a precompressed variant of FILE with the properties BUF in one
+ * of the content codings the "Accept-Encoding" field ACCEPT allows.  If
+ * there is one which is not older than FILE, replace FILE and BUF with
+ * it and return its content coding.  Otherwise return NULL.
+ */
+static char *
+http_find_precompressed (char *accept, char **file, struct stat *buf)
+{
+  struct stat vbuf;
+  char *variant;
+  int n;
+
+  for (n = 0; http_precompressed[n].coding; n++)
+    {
+      if (!http_accept_encoding (accept, http_precompressed[n].coding))
+        continue;
+      variant = svz_malloc (strlen (*file) +
+                            strlen (http_precompressed[n].suffix) + 1);
+      sprintf (variant, "%s%s", *file, http_precompressed[n].suffix);
+      if (http_watch_stat (variant, &vbuf) != -1 &&
+          S_ISREG (vbuf.st_mode) && vbuf.st_mtime >= buf->st_mtime)
+        {
+          svz_free (*file);
+          *file = variant;
+          *buf = vbuf;
+          return http_precompressed[n].coding;
+        }
+      svz_free (variant);
+    }
+  return NULL;
+}
+
+/*
+ * Look up the content of FILE with the properties BUF compressed by the
+ * gzip codec in the http file cache and put it there if necessary.
+ * Return the cache status like ‘http_check_cache’ does for CACHE.
+ */
+static int
+http_check_gzip (char *file, struct stat *buf, http_cache_t *cache)
+{
+  svz_codec_t *codec;
+  char *key;
+  int status;
+
+  if ((codec = svz_codec_get ("gzip", SVZ_CODEC_ENCODER)) == NULL)
+    return HTTP_CACHE_NO;
+
+  key = http_cache_variant (file, "gzip");
+  status = http_check_cache (key, cache);
+  if (status == HTTP_CACHE_COMPLETE &&
+      (buf->st_mtime != cache->entry->date ||
+       buf->st_ino != cache->entry->inode ||
+       buf->st_dev != cache->entry->device))
+    {
+      http_cache_invalidate (cache->entry);
+      cache->entry = NULL;
+      status = HTTP_CACHE_NO;
+    }
+
+  /* compress the file once */
+  if (status == HTTP_CACHE_NO &&
+      http_init_cache (key, buf->st_size, cache) != -1)
+    {
+      cache->entry->date = buf->st_mtime;
+      cache->entry->inode = buf->st_ino;
+      cache->entry->device = buf->st_dev;
+      if (http_cache_encode (cache, codec, file) == 0)
+        status = HTTP_CACHE_COMPLETE;
+    }
+  svz_free (key);
+
+  /* an empty entry tells that compression does not pay off */
+  if (status == HTTP_CACHE_COMPLETE && cache->size == 0)
+    {
+      cache->entry = NULL;
+      cache->buffer = NULL;
+      status = HTTP_CACHE_NO;
+    }
+  return status;
+}
+
 /*
  * Respond to a http GET request.  This could be either a usual file
  * request or a CGI request.
@@ -995,7 +1258,9 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
   int fd;
   int size, status;
   struct stat buf;
-  char *dir, *host, *p, *file;
+  char *host, *p, *file, *type;
+  char *accept = NULL, *encoding = NULL;
+  int vary = 0;
   time_t date;
   http_cache_t *cache;
   http_socket_t *http = sock->data;
@@ -1036,11 +1301,10 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
       strcat (file, cfg->indexfile);
 
       /* get directory listing if there is no index file */
-      if ((fd = open (file, O_RDONLY)) == -1)
+      if (http_watch_stat (file, &buf) == -1)
         {
           *p = '\0';
-          if ((dir = http_dirlist (file, cfg->docs,
-                                   status ? request : NULL)) == NULL)
+          if (http_send_dirlist (sock, file, status ? request : NULL))
             {
               svz_log_sys_error ("http: dirlist: %s", file);
               svz_sock_printf (sock, HTTP_FILE_NOT_FOUND "\r\n");
@@ -1049,18 +1313,9 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
               svz_free (file);
               return -1;
             }
-          /* send the directory listing */
-          http->response = 200;
-          http->length = strlen (dir);
-          svz_free (sock->send_buffer);
-          sock->send_buffer = dir;
-          sock->send_buffer_size = http_dirlist_size;
-          sock->send_buffer_fill = strlen (dir);
-          sock->userflags |= HTTP_FLAG_DONE;
           svz_free (file);
           return 0;
         }
-      close (fd);
     }
 
   /* check if there are '..' in the requested file's path */
@@ -1074,7 +1329,7 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
     }
 
   /* get length of file and other properties */
-  if (stat (file, &buf) == -1)
+  if (http_watch_stat (file, &buf) == -1)
     {
       svz_log_sys_error ("stat (%s)", file);
       svz_sock_printf (sock, HTTP_FILE_NOT_FOUND "\r\n");
@@ -1102,7 +1357,7 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
   /* if directory then relocate to it */
   if (S_ISDIR (buf.st_mode))
     {
-      host = http_find_property (http, "Host");
+      host = http_find_property (http, HTTP_FIELD_HOST);
       http->response = 302;
       http_set_header (HTTP_RELOCATE);
       http_add_header ("Location: %s%s%s/\r\n",
@@ -1113,18 +1368,8 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
       return 0;
     }
 
-  /* open the file for reading */
-  if ((fd = svz_open (file, O_RDONLY | O_BINARY, 0)) == -1)
-    {
-      svz_sock_printf (sock, HTTP_FILE_NOT_FOUND "\r\n");
-      http_error_response (sock, 404);
-      sock->userflags |= HTTP_FLAG_DONE;
-      svz_free (file);
-      return -1;
-    }
-
   /* check if this it could be a Keep-Alive connection */
-  if ((p = http_find_property (http, "Connection")) != NULL)
+  if ((p = http_find_property (http, HTTP_FIELD_CONNECTION)) != NULL)
     {
       if (strstr (p, "Keep-Alive"))
         {
@@ -1133,7 +1378,7 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
     }
 
   /* check if this a If-Modified-Since request */
-  if ((p = http_find_property (http, "If-Modified-Since")) != NULL)
+  if ((p = http_find_property (http, HTTP_FIELD_IF_MODIFIED_SINCE)) != NULL)
     {
       date = http_parse_date (p);
       if (date >= buf.st_mtime)
@@ -1145,7 +1390,6 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
           http_set_header (HTTP_NOT_MODIFIED);
           http_check_keepalive (sock);
           http_send_header (sock);
-          svz_close (fd);
           sock->userflags |= HTTP_FLAG_DONE;
           svz_free (file);
           return 0;
@@ -1153,12 +1397,12 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
     }
 
   /* check content range requests */
-  if ((p = http_find_property (http, "Range")) != NULL)
+  if ((p = http_find_property (http, HTTP_FIELD_RANGE)) != NULL)
     {
       if (http_get_range (p, &http->range) != -1)
         flags |= HTTP_FLAG_PARTIAL;
     }
-  else if ((p = http_find_property (http, "Request-Range")) != NULL)
+  else if ((p = http_find_property (http, HTTP_FIELD_REQUEST_RANGE)) != NULL)
     {
       if (http_get_range (p, &http->range) != -1)
         flags |= HTTP_FLAG_PARTIAL;
@@ -1181,13 +1425,8 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
                    http->range.first, http->range.last, http->range.length);
 #endif
 
-          /* setup file descriptor and size */
+          /* setup size */
           buf.st_size = http->range.last - http->range.first + 1;
-          if (lseek (fd, http->range.first, SEEK_SET) != http->range.first)
-            {
-              svz_log_sys_error ("http: lseek");
-              flags &= ~HTTP_FLAG_PARTIAL;
-            }
         }
 
       /* return an error reponse if necessary */
@@ -1196,12 +1435,102 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
           svz_sock_printf (sock, HTTP_INVALID_RANGE "\r\n");
           http_error_response (sock, 416);
           sock->userflags |= HTTP_FLAG_DONE;
-          svz_close (fd);
           svz_free (file);
           return -1;
         }
     }
 
+  /* prefer a precompressed variant of compressible full content */
+  type = http_content_type_field (sock, file);
+  if (!(flags & (HTTP_FLAG_PARTIAL | HTTP_FLAG_SIMPLE)) &&
+      http_compressible_type (http_find_content_type (sock, file)))
+    {
+      vary = 1;
+      if ((accept = http_find_property (http, HTTP_FIELD_ACCEPT_ENCODING)))
+        encoding = http_find_precompressed (accept, &file, &buf);
+    }
+
+  /* create a cache structure for the http socket structure */
+  cache = svz_calloc (sizeof (http_cache_t));
+  http->cache = cache;
+
+  /* disable caching if delivering partial content or no content */
+  if (flags & (HTTP_FLAG_PARTIAL | HTTP_FLAG_NOFILE))
+    {
+      status = HTTP_CACHE_INHIBIT;
+    }
+  else
+    {
+      /* otherwise use a compressed variant kept in the cache */
+      status = HTTP_CACHE_NO;
+      if (vary && !encoding && accept &&
+          http_accept_encoding (accept, "gzip") &&
+          buf.st_size >= MIN_ENCODE_SIZE && buf.st_size < cfg->cachesize &&
+          (status = http_check_gzip (file, &buf, cache))
+          == HTTP_CACHE_COMPLETE)
+        {
+          encoding = "gzip";
+          buf.st_size = cache->size;
+        }
+
+      /* return the file's current cache status */
+      if (status != HTTP_CACHE_COMPLETE)
+        status = http_check_cache (file, cache);
+    }
+
+  /* the file on disk has changed?  */
+  if (status == HTTP_CACHE_COMPLETE &&
+      (buf.st_mtime != cache->entry->date ||
+       buf.st_size != cache->entry->size ||
+       buf.st_ino != cache->entry->inode ||
+       buf.st_dev != cache->entry->device))
+    {
+#if ENABLE_DEBUG
+      svz_log (SVZ_LOG_DEBUG, "cache: %s has changed\n", file);
+#endif
+      http_cache_invalidate (cache->entry);
+      cache->entry = NULL;
+      status = HTTP_CACHE_NO;
+    }
+
+  /*
+   * open the file for reading unless it is in the cache, a file which
+   * is not going to be read into the cache is sent via a shared
+   * descriptor
+   */
+  fd = -1;
+  if (status != HTTP_CACHE_COMPLETE && !(flags & HTTP_FLAG_NOFILE))
+    {
+      if (status == HTTP_CACHE_NO &&
+          buf.st_size > 0 && buf.st_size < cfg->cachesize)
+        fd = svz_open (file, O_RDONLY | O_BINARY, 0);
+      else
+        fd = http_fd_open (file, &buf);
+      if (fd == -1)
+        {
+          svz_sock_printf (sock, HTTP_FILE_NOT_FOUND "\r\n");
+          http_error_response (sock, 404);
+          sock->userflags |= HTTP_FLAG_DONE;
+          svz_free (file);
+          return -1;
+        }
+      /* ‘svz_sendfile’ sends from the given offset */
+      http->fileoffset = (flags & HTTP_FLAG_PARTIAL) ? http->range.first : 0;
+#if !HTTP_FD_CACHE
+      if ((flags & HTTP_FLAG_PARTIAL) &&
+          lseek (fd, http->range.first, SEEK_SET) != http->range.first)
+        {
+          svz_log_sys_error ("http: lseek");
+          svz_sock_printf (sock, HTTP_INVALID_RANGE "\r\n");
+          http_error_response (sock, 416);
+          sock->userflags |= HTTP_FLAG_DONE;
+          http_fd_close (fd);
+          svz_free (file);
+          return -1;
+        }
+#endif
+    }
+
   /* send a http header to the client */
   if (!(flags & HTTP_FLAG_SIMPLE))
     {
@@ -1217,8 +1546,11 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
           http_set_header (HTTP_OK);
         }
 
-      http_add_header ("Content-Type: %s\r\n",
-                       http_find_content_type (sock, file));
+      http_add_field (type);
+      if (encoding)
+        http_add_header ("Content-Encoding: %s\r\n", encoding);
+      if (vary)
+        http_add_field ("Vary: Accept-Encoding\r\n");
 
       /* set content range if possible */
       if (flags & HTTP_FLAG_PARTIAL)
@@ -1233,7 +1565,8 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
         http_add_header ("Content-Length: %ld\r\n", buf.st_size);
 
       http_add_header ("Last-Modified: %s\r\n", http_asc_date (buf.st_mtime));
-      http_add_header ("Accept-Ranges: bytes\r\n");
+      if (!encoding)
+        http_add_field ("Accept-Ranges: bytes\r\n");
       http_check_keepalive (sock);
       http_send_header (sock);
     }
@@ -1241,58 +1574,33 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
   /* just a HEAD response handled by this GET handler */
   if (flags & HTTP_FLAG_NOFILE)
     {
-      svz_close (fd);
       sock->userflags |= HTTP_FLAG_DONE;
       svz_free (file);
       return 0;
     }
 
-  /* create a cache structure for the http socket structure */
-  cache = svz_calloc (sizeof (http_cache_t));
-  http->cache = cache;
-
-  /* disable caching if delivering partial content */
-  if (flags & HTTP_FLAG_PARTIAL)
-    {
-      status = HTTP_CACHE_INHIBIT;
-    }
-  else
+  /*
+   * find a free slot for the new file if it is not larger
+   * than a certain size and is not "partly" in the cache,
+   * and map it into memory at once if possible
+   */
+  if (status == HTTP_CACHE_NO &&
+      buf.st_size > 0 && buf.st_size < cfg->cachesize &&
+      http_init_cache (file, buf.st_size, cache) != -1)
     {
-      /* return the file's current cache status */
-      status = http_check_cache (file, cache);
+      cache->entry->date = buf.st_mtime;
+      cache->entry->inode = buf.st_ino;
+      cache->entry->device = buf.st_dev;
+      if (http_cache_map (cache, fd) == 0)
+        status = HTTP_CACHE_COMPLETE;
     }
 
   /* is the requested file already fully in the cache?  */
   if (status == HTTP_CACHE_COMPLETE)
     {
-      if (buf.st_mtime > cache->entry->date ||
-          buf.st_size != cache->entry->size)
-        {
-          /* the file on disk has changed?  */
-#if ENABLE_DEBUG
-          svz_log (SVZ_LOG_DEBUG, "cache: %s has changed\n", file);
-#endif
-          http_refresh_cache (cache);
-          cache->entry->date = buf.st_mtime;
-          sock->flags |= SVZ_SOFLG_FILE;
-          sock->file_desc = fd;
-          http->filelength = buf.st_size;
-          sock->read_socket = http_cache_read;
-          sock->disconnected_socket = http_cache_disconnect;
-        }
-      else
-        {
-          /* no, initialize the cache routines */
-          cache->entry->hits++;
-          cache->entry->usage++;
-          sock->userflags |= HTTP_FLAG_CACHE;
-          if (flags & HTTP_FLAG_SIMPLE)
-            {
-              sock->send_buffer_fill = 42;
-              sock->write_socket = http_cache_write;
-            }
-          svz_close (fd);
-        }
+      http_send_cache (sock, flags);
+      if (fd != -1)
+        http_fd_close (fd);
     }
   /* the file is not in the cache structures yet */
   else
@@ -1301,17 +1609,11 @@ http_get_response (svz_socket_t *sock, char *request, int flags)
       http->filelength = buf.st_size;
       sock->flags |= SVZ_SOFLG_FILE;
 
-      /*
-       * find a free slot for the new file if it is not larger
-       * than a certain size and is not "partly" in the cache
-       */
-      if (status == HTTP_CACHE_NO &&
-          buf.st_size > 0 && buf.st_size < cfg->cachesize &&
-          http_init_cache (file, cache) != -1)
+      /* read the file into its new cache entry */
+      if (cache->entry)
         {
           sock->read_socket = http_cache_read;
           sock->disconnected_socket = http_cache_disconnect;
-          cache->entry->date = buf.st_mtime;
         }
       /*
        * either the file is not cacheable or it is currently
@@ -33,7 +33,8 @@ typedef struct
   char *cgiurl;         /* cgi url (this is for its detection) */
   char *cgidir;         /* cgi directory where all cgi scripts are located */
   int cachesize;        /* maximum cache file size */
-  int cacheentries;     /* maximum cache entries */
+  int cachelimit;       /* maximum cache memory */
+  int cacheentries;     /* maximum amount of cache entries (ignored) */
   int timeout;          /* timeout in seconds for keep-alive connections */
   int keepalive;        /* maximum amount of requests on a connection */
   char *default_type;   /* the default content type */
@@ -48,6 +49,12 @@ typedef struct
   char *logfile;        /* log file name */
   char *logformat;      /* custom log file format string */
   FILE *log;            /* log file stream */
+  svz_hash_t *fields;   /* content type -> pre-rendered header field */
+  char *keepalive_field; /* pre-rendered keep-alive header fields */
+  char *fastcgi;        /* socket of the FastCGI application */
+  char *fastcgi_app;    /* FastCGI application run by the server */
+  int fastcgi_workers;  /* number of its connections (and processes) */
+  struct http_fcgi *fcgi; /* its worker pool */
 }
 http_config_t;
 
@@ -59,6 +66,7 @@ int http_init (svz_server_t *server);
 int http_finalize (svz_server_t *server);
 int http_global_init (svz_servertype_t *server);
 int http_global_finalize (svz_servertype_t *server);
+int http_notify (svz_server_t *server);
 
 /* basic protocol functions */
 int http_detect_proto (svz_server_t *server, svz_socket_t *sock);
@@ -0,0 +1,454 @@
+/*
+ * http-watch.c - http file properties cache
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this package.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+#include "libserveez.h"
+#include "unused.h"
+#include "http-cache.h"
+#include "http-watch.h"
+
+#if HAVE_SYS_INOTIFY_H
+
+/*
+ * The properties of files (including the fact that they do not exist)
+ * are remembered as long as none of the directories leading to them
+ * changes.  Each of these directories is watched via inotify(7).  This
+ * saves the file system lookups for files which have not changed.
+ */
+
+/* Events of a watched directory invalidating remembered properties.  */
+#define HTTP_WATCH_MASK                                         \
+  (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |    \
+   IN_ONLYDIR)
+
+/*
+ * The remembered properties of a file.
+ */
+typedef struct http_watch_file
+{
+  struct http_watch_file *prev; /* more recently used file */
+  struct http_watch_file *next; /* less recently used file */
+  int exists;                   /* zero if the file does not exist */
+  struct stat buf;              /* its properties otherwise */
+  char path[1];                 /* name of the file (variable length) */
+}
+http_watch_file_t;
+
+/*
+ * A watched directory.
+ */
+typedef struct
+{
+  int wd;          /* inotify watch descriptor */
+  char path[1];    /* name of the directory (variable length) */
+}
+http_watch_dir_t;
+
+static int http_watch_fd = -1;                 /* inotify descriptor */
+static svz_socket_t *http_watch_sock = NULL;   /* and its socket */
+static svz_hash_t *http_watch_files = NULL;    /* file name -> properties */
+static svz_hash_t *http_watch_dirs = NULL;     /* directory -> watch */
+static svz_hash_t *http_watch_wds = NULL;      /* watch descriptor -> watch */
+static http_watch_file_t *http_watch_first = NULL; /* most recently used */
+static http_watch_file_t *http_watch_last = NULL;  /* least recently used */
+
+/*
+ * Write the hash key for the watch descriptor WD to KEY.
+ */
+static char *
+http_watch_wdkey (char *key, int wd)
+{
+  sprintf (key, "%d", wd);
+  return key;
+}
+
+static void
+http_watch_rm (UNUSED void *k, void *v, UNUSED void *closure)
+{
+  http_watch_dir_t *dir = v;
+
+  inotify_rm_watch (http_watch_fd, dir->wd);
+}
+
+/*
+ * Take the remembered file ENTRY out of the list of recently used ones.
+ */
+static void
+http_watch_unlink (http_watch_file_t *entry)
+{
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    http_watch_first = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    http_watch_last = entry->prev;
+}
+
+/*
+ * Put the remembered file ENTRY in front of the list of recently used
+ * ones.
+ */
+static void
+http_watch_link (http_watch_file_t *entry)
+{
+  entry->prev = NULL;
+  entry->next = http_watch_first;
+  if (http_watch_first)
+    http_watch_first->prev = entry;
+  else
+    http_watch_last = entry;
+  http_watch_first = entry;
+}
+
+/*
+ * Forget the properties of the remembered file ENTRY.
+ */
+static void
+http_watch_forget (http_watch_file_t *entry)
+{
+  http_watch_unlink (entry);
+  svz_hash_delete (http_watch_files, entry->path);
+  svz_free (entry);
+}
+
+/*
+ * Forget the properties of all files and stop watching all directories.
+ */
+void
+http_watch_flush (void)
+{
+  if (http_watch_dirs)
+    svz_hash_foreach (http_watch_rm, http_watch_dirs, NULL);
+  svz_hash_destroy (http_watch_wds);
+  svz_hash_destroy (http_watch_dirs);
+  svz_hash_destroy (http_watch_files);
+  http_watch_wds = http_watch_dirs = http_watch_files = NULL;
+  http_watch_first = http_watch_last = NULL;
+}
+
+/*
+ * Forget everything about the file PATH in the directory DIR which has
+ * changed, including the listing of DIR.
+ */
+static void
+http_watch_changed (http_watch_dir_t *dir, char *path)
+{
+  http_cache_entry_t *cache;
+  http_watch_file_t *entry;
+  char *key, *p;
+
+  if ((entry = svz_hash_get (http_watch_files, path)) != NULL)
+    http_watch_forget (entry);
+  if (http_cache == NULL)
+    return;
+  if ((cache = svz_hash_get (http_cache, path)) != NULL)
+    http_cache_invalidate (cache);
+  key = http_cache_variant (path, "gzip");
+  if ((cache = svz_hash_get (http_cache, key)) != NULL)
+    http_cache_invalidate (cache);
+  svz_free (key);
+
+  /* directory listings are cached by the name with a trailing slash */
+  p = path + strlen (dir->path);
+  if (!dir->path[1])
+    p--;
+  p[1] = '\0';
+  if ((cache = svz_hash_get (http_cache, path)) != NULL)
+    http_cache_invalidate (cache);
+}
+
+/*
+ * The @code{read_socket} callback of the inotify descriptor.  Process
+ * the events of the watched directories.
+ */
+static int
+http_watch_read (svz_socket_t *sock)
+{
+  char buf[4096]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  char key[16], *path;
+  struct inotify_event *event;
+  http_watch_dir_t *dir;
+  ssize_t n;
+  char *p;
+
+  while ((n = read (sock->pipe_desc[SVZ_READ], buf, sizeof (buf))) > 0)
+    {
+      for (p = buf; p < buf + n; p += sizeof (*event) + event->len)
+        {
+          event = (struct inotify_event *) p;
+          if (event->mask & IN_Q_OVERFLOW)
+            {
+              http_watch_flush ();
+              continue;
+            }
+          if (http_watch_wds == NULL
+              || (dir = svz_hash_get (http_watch_wds,
+                                      http_watch_wdkey (key, event->wd)))
+              == NULL)
+            continue;
+
+          /* the directory itself has gone */
+          if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+              http_watch_flush ();
+              continue;
+            }
+          if (!event->len)
+            continue;
+
+          path = svz_malloc (strlen (dir->path) + event->len + 2);
+          sprintf (path, "%s%s%s", dir->path, dir->path[1] ? "/" : "",
+                   event->name);
+#if ENABLE_DEBUG
+          svz_log (SVZ_LOG_DEBUG, "http: %s changed (0x%x)\n",
+                   path, event->mask);
+#endif
+          /* a watched directory has been replaced */
+          if ((event->mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))
+              && svz_hash_get (http_watch_dirs, path))
+            http_watch_flush ();
+          else
+            http_watch_changed (dir, path);
+          svz_free (path);
+        }
+    }
+
+  if (n < 0 && errno != EAGAIN)
+    {
+      svz_log_sys_error ("http: inotify");
+      return -1;
+    }
+  return 0;
+}
+
+/*
+ * The inotify descriptor's socket has been shut down.
+ */
+static int
+http_watch_disconnected (UNUSED svz_socket_t *sock)
+{
+  http_watch_flush ();
+  http_watch_sock = NULL;
+  http_watch_fd = -1;
+  return 0;
+}
+
+/*
+ * Create the inotify descriptor and its socket structure unless this has
+ * been done before.  Return zero on success.
+ */
+static int
+http_watch_init (void)
+{
+  int fd;
+
+  if (http_watch_sock)
+    return 0;
+
+  if ((fd = inotify_init ()) < 0)
+    {
+      svz_log_sys_error ("http: inotify_init");
+      return -1;
+    }
+  if ((http_watch_sock = svz_pipe_create (fd, fd)) == NULL)
+    {
+      close (fd);
+      return -1;
+    }
+
+  /* there is nothing to send */
+  http_watch_sock->flags &= ~SVZ_SOFLG_SEND_PIPE;
+  svz_invalidate_handle (&http_watch_sock->pipe_desc[SVZ_WRITE]);
+  http_watch_sock->flags |= SVZ_SOFLG_NOFLOOD;
+  http_watch_sock->read_socket = http_watch_read;
+  http_watch_sock->disconnected_socket = http_watch_disconnected;
+  if (svz_sock_enqueue (http_watch_sock) < 0)
+    {
+      close (fd);
+      http_watch_sock = NULL;
+      return -1;
+    }
+  http_watch_fd = fd;
+  return 0;
+}
+
+/*
+ * Watch all the directories leading to FILE unless this is done
+ * already.  Return zero on success.
+ */
+static int
+http_watch_add (char *file)
+{
+  char *path, *p, key[16];
+  http_watch_dir_t *dir;
+  int wd, ret = 0;
+
+  /* the current directory cannot be watched reliably */
+  if (strchr (file, '/') == NULL)
+    return -1;
+
+  if (http_watch_dirs == NULL)
+    {
+      http_watch_dirs = svz_hash_create (64, svz_free);
+      http_watch_wds = svz_hash_create (64, NULL);
+      http_watch_files = svz_hash_create (256, svz_free);
+    }
+
+  path = svz_strdup (file);
+  while ((p = strrchr (path, '/')) != NULL)
+    {
+      /* the root directory is "/" */
+      if (p == path)
+        p[1] = '\0';
+      else
+        *p = '\0';
+
+      /* the directories above are watched as well */
+      if (svz_hash_get (http_watch_dirs, path))
+        break;
+      if (svz_hash_size (http_watch_dirs) >= HTTP_WATCH_DIRS
+          || (wd = inotify_add_watch (http_watch_fd, path,
+                                      HTTP_WATCH_MASK)) < 0)
+        {
+          ret = -1;
+          break;
+        }
+
+      /* another name for an already watched directory */
+      if (svz_hash_get (http_watch_wds, http_watch_wdkey (key, wd)))
+        {
+          ret = -1;
+          break;
+        }
+
+      dir = svz_malloc (sizeof (http_watch_dir_t) + strlen (path));
+      dir->wd = wd;
+      strcpy (dir->path, path);
+      svz_hash_put (http_watch_dirs, path, dir);
+      svz_hash_put (http_watch_wds, key, dir);
+      if (p == path)
+        break;
+    }
+  svz_free (path);
+  return ret;
+}
+
+/*
+ * Get the properties of FILE in BUF just like @code{stat} does, but
+ * remember them until the file changes.  Return zero on success and
+ * -1 with @code{errno} set otherwise.  If there are too many files, the
+ * least recently used one is forgotten.  Missing files are remembered
+ * only while the table is less than half full, so that a flood of
+ * requests for them cannot push out the existing ones.
+ */
+int
+http_watch_stat (char *file, struct stat *buf)
+{
+  http_watch_file_t *entry;
+  int ret;
+
+  if (http_watch_files
+      && (entry = svz_hash_get (http_watch_files, file)) != NULL)
+    {
+      http_watch_unlink (entry);
+      http_watch_link (entry);
+      if (!entry->exists)
+        {
+          errno = ENOENT;
+          return -1;
+        }
+      *buf = entry->buf;
+      return 0;
+    }
+
+  /* watch the directories before looking so as not to miss a change */
+  if (http_watch_init () || http_watch_add (file))
+    return stat (file, buf);
+
+  /* symbolic links may point anywhere */
+  if ((ret = lstat (file, buf)) == 0 && S_ISLNK (buf->st_mode))
+    return stat (file, buf);
+  if (ret == -1
+      && (errno != ENOENT
+          || svz_hash_size (http_watch_files) >= HTTP_WATCH_FILES / 2))
+    return -1;
+
+  if (svz_hash_size (http_watch_files) >= HTTP_WATCH_FILES)
+    http_watch_forget (http_watch_last);
+  entry = svz_malloc (sizeof (http_watch_file_t) + strlen (file));
+  entry->exists = (ret == 0);
+  entry->buf = *buf;
+  strcpy (entry->path, file);
+  svz_hash_put (http_watch_files, file, entry);
+  http_watch_link (entry);
+  if (!entry->exists)
+    errno = ENOENT;
+  return ret;
+}
+
+/*
+ * Stop watching.
+ */
+void
+http_watch_finalize (void)
+{
+  http_watch_flush ();
+  if (http_watch_sock)
+    {
+      http_watch_sock->disconnected_socket = NULL;
+      svz_sock_schedule_for_shutdown (http_watch_sock);
+      http_watch_sock = NULL;
+      http_watch_fd = -1;
+    }
+}
+
+#else /* not HAVE_SYS_INOTIFY_H */
+
+int
+http_watch_stat (char *file, struct stat *buf)
+{
+  return stat (file, buf);
+}
+
+void
+http_watch_flush (void)
+{
+}
+
+void
+http_watch_finalize (void)
+{
+}
+
+#endif /* not HAVE_SYS_INOTIFY_H */
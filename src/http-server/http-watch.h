@@ -0,0 +1,34 @@
+/*
+ * http-watch.h - http file properties cache header file
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this package.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HTTP_WATCH_H__
+#define __HTTP_WATCH_H__ 1
+
+/*
+ * Limits for the file properties cache.
+ */
+#define HTTP_WATCH_FILES 4096 /* maximum number of files */
+#define HTTP_WATCH_DIRS  1024 /* maximum number of watched directories */
+
+/*
+ * Basic file properties cache functions.
+ */
+int http_watch_stat (char *file, struct stat *buf);
+void http_watch_flush (void);
+void http_watch_finalize (void);
+
+#endif /* __HTTP_WATCH_H__ */
@@ -126,12 +126,15 @@ irc_start_auth (svz_socket_t *sock)
   if (!cfg->pass)
     client->flag |= UMODE_PASS;
 
-  /* Start here the reverse-dns and ident lookup.  */
-  ENQ_COSERVER_REQUEST (sock->remote_addr, rdns);
+  /*
+   * Start here the reverse-dns and ident lookup.  Their callbacks may
+   * run at once, so announce them first.
+   */
   irc_printf (sock, "NOTICE AUTH :" IRC_DNS_INIT "\n");
+  ENQ_COSERVER_REQUEST (sock->remote_addr, rdns);
 
-  ENQ_COSERVER_REQUEST (sock, ident);
   irc_printf (sock, "NOTICE AUTH :" IRC_IDENT_INIT "\n");
+  ENQ_COSERVER_REQUEST (sock, ident);
 }
 
 /*
@@ -157,6 +157,7 @@ UPDN (sock_table);
 UPDN (signal);
 UPDN (interface);
 UPDN (pipe);
+UPDN (zerocopy);
 UPDN (dynload);
 UPDN (codec);
 UPDN (config_type);
@@ -175,6 +176,7 @@ svz_boot (char const *client)
   THE (client) = svz_strdup (client ? client : "anonymous");
   THE (boot) = time (NULL);
   SVZ_RUNPARM_X (MAX_SOCKETS, 100);
+  SVZ_RUNPARM_X (MAX_COSERVERS, 4);
   SVZ_RUNPARM_X (VERBOSITY, SVZ_LOG_DEBUG);
 
 #define UP(x)  svz__ ## x ## _updn (1)
@@ -186,6 +188,7 @@ svz_boot (char const *client)
   UP (interface);
   UP (net);
   UP (pipe);
+  UP (zerocopy);
   UP (dynload);
   UP (codec);
   UP (config_type);
@@ -227,9 +230,10 @@ svz_runparm (int a, int b)
     case -1:
       switch (b)
         {
-        case SVZ_RUNPARM_VERBOSITY:   return log_verbosity;
-        case SVZ_RUNPARM_MAX_SOCKETS: return THE (nclient_max);
-        default:                      return bad_runparm (b);
+        case SVZ_RUNPARM_VERBOSITY:     return log_verbosity;
+        case SVZ_RUNPARM_MAX_SOCKETS:   return THE (nclient_max);
+        case SVZ_RUNPARM_MAX_COSERVERS: return THE (ncoserver_max);
+        default:                        return bad_runparm (b);
         }
 
     case SVZ_RUNPARM_VERBOSITY:
@@ -240,6 +244,10 @@ svz_runparm (int a, int b)
       THE (nclient_max) = b;
       break;
 
+    case SVZ_RUNPARM_MAX_COSERVERS:
+      THE (ncoserver_max) = b;
+      break;
+
     default:
       return bad_runparm (b);
     }
@@ -258,6 +266,7 @@ svz_halt (void)
   DN (config_type);
   DN (codec);
   DN (dynload);
+  DN (zerocopy);
   DN (pipe);
   DN (net);
   DN (interface);
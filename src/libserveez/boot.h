@@ -26,8 +26,9 @@
 /* end svzint */
 
 /* Runtime parameters.  */
-#define SVZ_RUNPARM_VERBOSITY    0
-#define SVZ_RUNPARM_MAX_SOCKETS  1
+#define SVZ_RUNPARM_VERBOSITY      0
+#define SVZ_RUNPARM_MAX_SOCKETS    1
+#define SVZ_RUNPARM_MAX_COSERVERS  2
 
 __BEGIN_DECLS
 
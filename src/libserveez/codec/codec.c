@@ -98,6 +98,8 @@ svz_codec_init (void)
 #if HAVE_LIBZ && HAVE_ZLIB_H
   svz_codec_register (&zlib_encoder);
   svz_codec_register (&zlib_decoder);
+  svz_codec_register (&gzip_encoder);
+  svz_codec_register (&gzip_decoder);
 #endif /* HAVE_LIBZ && HAVE_ZLIB_H */
 #if HAVE_LIBBZ2
   svz_codec_register (&bzip2_encoder);
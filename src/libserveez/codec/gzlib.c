@@ -56,6 +56,33 @@ svz_codec_t zlib_decoder = {
   2
 };
 
+/* Definition of the 'gzip' encoder.  It shares everything but the
+   initialization with the 'zlib' encoder.  */
+svz_codec_t gzip_encoder = {
+  "gzip",
+  SVZ_CODEC_ENCODER,
+  gzip_encoder_init,
+  zlib_encoder_finalize,
+  zlib_encode,
+  zlib_error,
+  zlib_ratio,
+  NULL,
+  0
+};
+
+/* Definition of the 'gzip' decoder.  */
+svz_codec_t gzip_decoder = {
+  "gzip",
+  SVZ_CODEC_DECODER,
+  gzip_decoder_init,
+  zlib_decoder_finalize,
+  zlib_decode,
+  zlib_error,
+  zlib_ratio,
+  "\x1f\x8b",
+  2
+};
+
 /* Internal 'zlib' data structure.  The arbitrary `data' field of the
    @code{svz_codec_data_t} structure is used to hold this data structure
    and is thus passed to each codec callback.  */
@@ -121,12 +148,10 @@ zlib_ratio (svz_codec_data_t *data, size_t *in, size_t *out)
   return SVZ_CODEC_ERROR;
 }
 
-/* Codec `init' callback:
-   Initialization routine for the 'zlib' encoder.  This callback is run when
-   the codec is setup for sending or receiving.  It should return
-   @code{SVZ_CODEC_ERROR} on failure and @code{SVZ_CODEC_OK} otherwise.  */
-int
-zlib_encoder_init (svz_codec_data_t *data)
+/* Set up the 'zlib' stream of DATA for the 'zlib' and 'gzip' codecs
+   and return it.  */
+static zlib_data_t *
+zlib_stream_create (svz_codec_data_t *data)
 {
   zlib_data_t *z;
 
@@ -136,12 +161,40 @@ zlib_encoder_init (svz_codec_data_t *data)
   z->stream.zalloc = zlib_alloc;
   z->stream.zfree = zlib_free;
   z->stream.opaque = Z_NULL;
+  return z;
+}
+
+/* Initialize the encoder of DATA with the window size WBITS as given to
+   @code{deflateInit2}, which also selects the 'zlib' or gzip(1) format.  */
+static int
+zlib_deflate_init (svz_codec_data_t *data, int wbits)
+{
+  zlib_data_t *z = zlib_stream_create (data);
 
-  if (deflateInit (&z->stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+  if (deflateInit2 (&z->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                    wbits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
     return SVZ_CODEC_ERROR;
   return SVZ_CODEC_OK;
 }
 
+/* Codec `init' callback:
+   Initialization routine for the 'zlib' encoder.  This callback is run when
+   the codec is setup for sending or receiving.  It should return
+   @code{SVZ_CODEC_ERROR} on failure and @code{SVZ_CODEC_OK} otherwise.  */
+int
+zlib_encoder_init (svz_codec_data_t *data)
+{
+  return zlib_deflate_init (data, MAX_WBITS);
+}
+
+/* Initialization routine for the 'gzip' encoder.  The 'zlib' stream is
+   wrapped into a gzip(1) header and trailer instead of the 'zlib' ones.  */
+int
+gzip_encoder_init (svz_codec_data_t *data)
+{
+  return zlib_deflate_init (data, MAX_WBITS + 16);
+}
+
 /* Codec `finalize' callback:
    Finalizer routine for the 'zlib' encoder.  This callback is called by
    Serveez's codec interface if encoding has ended and should revert the
@@ -204,22 +257,30 @@ zlib_encode (svz_codec_data_t *data)
   return ret == Z_STREAM_END ? SVZ_CODEC_FINISHED : SVZ_CODEC_OK;
 }
 
+/* Initialize the decoder of DATA with the window size WBITS as given to
+   @code{inflateInit2}.  */
+static int
+zlib_inflate_init (svz_codec_data_t *data, int wbits)
+{
+  zlib_data_t *z = zlib_stream_create (data);
+
+  if (inflateInit2 (&z->stream, wbits) != Z_OK)
+    return SVZ_CODEC_ERROR;
+  return SVZ_CODEC_OK;
+}
+
 /* Initialization routine for the 'zlib' decoder.  */
 int
 zlib_decoder_init (svz_codec_data_t *data)
 {
-  zlib_data_t *z;
-
-  z = (zlib_data_t *) zlib_alloc (NULL, 1, sizeof (zlib_data_t));
-  memset (z, 0, sizeof (zlib_data_t));
-  data->data = (void *) z;
-  z->stream.zalloc = zlib_alloc;
-  z->stream.zfree = zlib_free;
-  z->stream.opaque = Z_NULL;
+  return zlib_inflate_init (data, MAX_WBITS);
+}
 
-  if (inflateInit (&z->stream) != Z_OK)
-    return SVZ_CODEC_ERROR;
-  return SVZ_CODEC_OK;
+/* Initialization routine for the 'gzip' decoder.  */
+int
+gzip_decoder_init (svz_codec_data_t *data)
+{
+  return zlib_inflate_init (data, MAX_WBITS + 16);
 }
 
 /* Finalizer routine for the 'zlib' decoder.  */
@@ -26,11 +26,15 @@
 __BEGIN_DECLS
 SBO svz_codec_t zlib_encoder;
 SBO svz_codec_t zlib_decoder;
+SBO svz_codec_t gzip_encoder;
+SBO svz_codec_t gzip_decoder;
 SBO char * zlib_error (svz_codec_data_t *);
 SBO int zlib_encoder_init (svz_codec_data_t *);
+SBO int gzip_encoder_init (svz_codec_data_t *);
 SBO int zlib_encoder_finalize (svz_codec_data_t *);
 SBO int zlib_encode (svz_codec_data_t *);
 SBO int zlib_decoder_init (svz_codec_data_t *);
+SBO int gzip_decoder_init (svz_codec_data_t *);
 SBO int zlib_decoder_finalize (svz_codec_data_t *);
 SBO int zlib_decode (svz_codec_data_t *);
 SBO int zlib_ratio (svz_codec_data_t *, size_t *, size_t *);
@@ -370,6 +370,11 @@ svz_inet_aton (char *str, struct sockaddr_in *addr)
   return svz_pton (str, &addr->sin_addr);
 }
 
+/* M$-Windows compatibility definition.  */
+#ifndef SOL_TCP
+#define SOL_TCP IPPROTO_TCP
+#endif
+
 /**
  * Enable or disable the @code{TCP_CORK} socket option of the socket
  * @var{fd}.  This is useful for performance reasons when using
@@ -380,34 +385,19 @@ int
 svz_tcp_cork (svz_t_socket fd, int set)
 {
 #ifdef TCP_CORK
-  int flags;
-
-  /* get current socket options */
-  if ((flags = fcntl (fd, F_GETFL)) < 0)
-    {
-      svz_log_net_error ("fcntl");
-      return -1;
-    }
+  int optval = set ? 1 : 0;
 
   /* set or unset the cork option */
-  flags = set ? flags | TCP_CORK : flags & ~TCP_CORK;
-
-  /* apply new socket option */
-  if (fcntl (fd, F_SETFL, flags) < 0)
+  if (setsockopt (fd, SOL_TCP, TCP_CORK,
+                  (void *) &optval, sizeof (optval)) < 0)
     {
-      svz_log_net_error ("fcntl");
+      svz_log_net_error ("setsockopt");
       return -1;
     }
-
 #endif /* TCP_CORK */
   return 0;
 }
 
-/* M$-Windows compatibility definition.  */
-#ifndef SOL_TCP
-#define SOL_TCP IPPROTO_TCP
-#endif
-
 /**
  * Enable or disable the @code{TCP_NODELAY} setting for the socket
  * @var{fd} depending on the flag @var{set}, effectively enabling
@@ -0,0 +1,270 @@
+/*
+ * cache.c - DNS and reverse DNS result cache
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this package.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "networking-headers.h"
+
+#include "libserveez/alloc.h"
+#include "libserveez/util.h"
+#include "libserveez/hash.h"
+#include "libserveez/coserver/coserver.h"
+#include "libserveez/coserver/cache.h"
+
+/* Seconds a successful lookup is kept.  */
+#define CACHE_TTL          300
+
+/* Seconds a failed lookup is kept.  */
+#define CACHE_NEGATIVE_TTL 30
+
+/* Maximum number of cached lookups.  */
+#define CACHE_ENTRIES      1024
+
+/*
+ * The hash keys are binary: the length of the data, the coserver type
+ * and the data itself, which is the address in network byte order for
+ * reverse DNS lookups and the lowercased host name for DNS lookups.
+ */
+#define CACHE_KEY_SIZE (2 + 255)
+
+/*
+ * A cached lookup.  All entries are additionally kept in a list in
+ * order of their last use, most recent first.
+ */
+typedef struct cache_entry cache_entry_t;
+struct cache_entry
+{
+  cache_entry_t *prev;              /* more recently used entry */
+  cache_entry_t *next;              /* less recently used entry */
+  long expires;                     /* time stamp of expiry */
+  char *result;                     /* NULL for failed lookups */
+  char key[CACHE_KEY_SIZE];         /* hash key */
+};
+
+static svz_hash_t *cache = NULL;
+static cache_entry_t *cache_head = NULL;
+static cache_entry_t *cache_tail = NULL;
+
+/* Hit and miss counters for each coserver type.  */
+static unsigned long cache_hits[SVZ_MAX_COSERVER_TYPES];
+static unsigned long cache_misses[SVZ_MAX_COSERVER_TYPES];
+
+static size_t
+cache_keylen (const char *key)
+{
+  return 2 + (unsigned char) key[0];
+}
+
+static int
+cache_equals (const char *key1, const char *key2)
+{
+  return memcmp (key1, key2, cache_keylen (key1));
+}
+
+static unsigned long
+cache_code (const char *key)
+{
+  size_t n, len = cache_keylen (key);
+  unsigned long code = 0;
+
+  for (n = 0; n < len; n++)
+    code = (code * 31) ^ (unsigned char) key[n];
+  return code;
+}
+
+/*
+ * Build the hash key for the @var{request} of the coserver type @var{type}
+ * in @var{key}.  Return zero on success and non-zero if the request
+ * cannot be cached.
+ */
+static int
+cache_key (char *key, int type, const char *request)
+{
+  size_t n, len;
+
+  key[1] = (char) type;
+  if (type == SVZ_COSERVER_REVERSE_DNS)
+    {
+      if (svz_pton (request, key + 2) != 0)
+        return -1;
+      key[0] = sizeof (in_addr_t);
+      return 0;
+    }
+  if (type == SVZ_COSERVER_DNS)
+    {
+      if ((len = strlen (request)) > CACHE_KEY_SIZE - 2 || len == 0)
+        return -1;
+      for (n = 0; n < len; n++)
+        key[2 + n] = tolower ((unsigned char) request[n]);
+      key[0] = (char) len;
+      return 0;
+    }
+  return -1;
+}
+
+static void
+cache_unlink (cache_entry_t *entry)
+{
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    cache_head = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    cache_tail = entry->prev;
+}
+
+static void
+cache_link (cache_entry_t *entry)
+{
+  entry->prev = NULL;
+  entry->next = cache_head;
+  if (cache_head)
+    cache_head->prev = entry;
+  else
+    cache_tail = entry;
+  cache_head = entry;
+}
+
+static void
+cache_remove (cache_entry_t *entry)
+{
+  cache_unlink (entry);
+  svz_hash_delete (cache, entry->key);
+  svz_free (entry->result);
+  svz_free (entry);
+}
+
+/*
+ * Look up the result of the @var{request} for the coserver type @var{type}
+ * and copy it to @var{result} (which must hold @code{COSERVER_BUFSIZE}
+ * bytes).  @var{result} is empty for a cached failure.  Return non-zero
+ * if the result has been found.
+ */
+int
+svz_coserver_cache_get (int type, const char *request, char *result)
+{
+  char key[CACHE_KEY_SIZE];
+  cache_entry_t *entry;
+
+  if (cache_key (key, type, request))
+    return 0;
+
+  if (cache == NULL || (entry = svz_hash_get (cache, key)) == NULL)
+    {
+      cache_misses[type]++;
+      return 0;
+    }
+  if ((long) time (NULL) >= entry->expires)
+    {
+      cache_remove (entry);
+      cache_misses[type]++;
+      return 0;
+    }
+
+  cache_unlink (entry);
+  cache_link (entry);
+  cache_hits[type]++;
+  snprintf (result, COSERVER_BUFSIZE, "%s",
+            entry->result ? entry->result : "");
+  return 1;
+}
+
+/*
+ * Remember @var{result} as the result of the @var{request} for the
+ * coserver type @var{type}.  A @code{NULL} @var{result} denotes a
+ * failed lookup which is remembered for a shorter time.
+ */
+void
+svz_coserver_cache_put (int type, const char *request, const char *result)
+{
+  char key[CACHE_KEY_SIZE];
+  cache_entry_t *entry;
+
+  if (cache_key (key, type, request))
+    return;
+
+  if (cache == NULL)
+    cache = svz_hash_configure (svz_hash_create (CACHE_ENTRIES / 4, NULL),
+                                cache_keylen, cache_code, cache_equals);
+
+  if ((entry = svz_hash_get (cache, key)) != NULL)
+    {
+      svz_free (entry->result);
+      cache_unlink (entry);
+    }
+  else
+    {
+      if (svz_hash_size (cache) >= CACHE_ENTRIES)
+        cache_remove (cache_tail);
+      entry = svz_malloc (sizeof (cache_entry_t));
+      memcpy (entry->key, key, cache_keylen (key));
+      svz_hash_put (cache, entry->key, entry);
+    }
+
+  entry->result = result ? svz_strdup (result) : NULL;
+  entry->expires = (long) time (NULL)
+    + (result ? CACHE_TTL : CACHE_NEGATIVE_TTL);
+  cache_link (entry);
+}
+
+/*
+ * Drop all cached results and reset the statistics.
+ */
+void
+svz_coserver_cache_destroy (void)
+{
+  while (cache_head)
+    cache_remove (cache_head);
+  if (cache)
+    {
+      svz_hash_destroy (cache);
+      cache = NULL;
+    }
+  memset (cache_hits, 0, sizeof (cache_hits));
+  memset (cache_misses, 0, sizeof (cache_misses));
+}
+
+/**
+ * Store the number of results cached for the coserver type @var{type}
+ * in @var{entries} and the number of requests answered from the cache
+ * and of those which were not in @var{hits} and @var{misses}.  Return
+ * non-zero if results of that type are not cached at all.
+ */
+int
+svz_coserver_cache_stats (int type, size_t *entries,
+                          unsigned long *hits, unsigned long *misses)
+{
+  cache_entry_t *entry;
+
+  if (type != SVZ_COSERVER_DNS && type != SVZ_COSERVER_REVERSE_DNS)
+    return -1;
+
+  *entries = 0;
+  for (entry = cache_head; entry; entry = entry->next)
+    if (entry->key[1] == type)
+      (*entries)++;
+  *hits = cache_hits[type];
+  *misses = cache_misses[type];
+  return 0;
+}
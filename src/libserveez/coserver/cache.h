@@ -0,0 +1,31 @@
+/*
+ * cache.h - coserver result cache header definitions
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this package.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__ 1
+
+#include "libserveez/defines.h"
+
+__BEGIN_DECLS
+
+SBO int svz_coserver_cache_get (int, const char *, char *);
+SBO void svz_coserver_cache_put (int, const char *, const char *);
+SBO void svz_coserver_cache_destroy (void);
+
+__END_DECLS
+
+#endif /* not __CACHE_H__ */
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <errno.h>
 #if HAVE_UNISTD_H
@@ -44,24 +45,55 @@
 #include "libserveez/alloc.h"
 #include "libserveez/util.h"
 #include "libserveez/core.h"
-#include "libserveez/hash.h"
 #include "libserveez/array.h"
+#include "libserveez/hash.h"
 #include "libserveez/pipe-socket.h"
 #include "libserveez/server-core.h"
+#include "libserveez/boot.h"
 #include "libserveez/coserver/coserver.h"
 
 /* coserver-TODO: include header here */
 #include "dns.h"
 #include "reverse-dns.h"
 #include "ident.h"
+#include "resolver.h"
+#include "cache.h"
 
 #ifdef __MINGW32__
 /* define for the thread priority in Win32 */
 #define COSERVER_THREAD_PRIORITY THREAD_PRIORITY_IDLE
 #endif /* not __MINGW32__ */
 
-#define COSERVER_PACKET_BOUNDARY '\n' /* packet boundary */
-#define COSERVER_ID_BOUNDARY     ':'  /* id boundary */
+/*
+ * Requests and responses are preceded by a header holding the callback
+ * id (32 bits) and the length of the data following it (16 bits), both
+ * in host byte order.  The data itself is not NUL terminated.
+ */
+#define COSERVER_HEADER_SIZE 6
+
+/* Size of the coserver's input and output buffers.  */
+#define COSERVER_BATCH_SIZE (8 * (COSERVER_HEADER_SIZE + COSERVER_BUFSIZE))
+
+/*
+ * Limits for adapting the number of coserver instances to the load.
+ * Another instance is started if the average response time exceeds
+ * COSERVER_SLOW milliseconds or there are more than COSERVER_BACKLOG
+ * requests per instance waiting.  Instances above the configured number
+ * which have been idle for COSERVER_IDLE seconds are stopped again.
+ * Requests fail at once if COSERVER_MAX_QUEUED requests of that type are
+ * waiting already, and fail after COSERVER_TIMEOUT seconds otherwise.
+ */
+#define COSERVER_SLOW       500
+#define COSERVER_BACKLOG    16
+#define COSERVER_IDLE       60
+#define COSERVER_MAX_QUEUED 1024
+#define COSERVER_TIMEOUT    30
+
+/*
+ * The ring of callbacks waiting for a result is kept at most half full
+ * and never grows beyond COSERVER_MAX_SLOTS slots.
+ */
+#define COSERVER_MAX_SLOTS  8192
 
 /*
  * This structure contains the type id and the callback
@@ -76,21 +108,300 @@ typedef struct
   int instances;                  /* the amount of coserver instances */
   void (* init) (void);           /* coserver initialization routine */
   long last_start;                /* time stamp of the last instance ‘fork’ */
+  int queued;                     /* requests waiting for their result */
+  long latency;                   /* average response time (msec) */
 }
 svz_coservertype_t;
 
 /*
- * Both of these variables are for storing the given callbacks which get
- * called when the coservers delivered some result.
+ * A callback waiting for a coserver result.
+ */
+typedef struct
+{
+  unsigned id;                                /* zero if unused */
+  int type;                                   /* coserver type id */
+  svz_sock_iv_t instance;                     /* socket of the coserver */
+  long sent;                                  /* time stamp (msec) */
+  svz_coserver_handle_result_t handle_result; /* any code callback */
+  void *closure;                              /* opaque to libserveez */
+}
+svz_coserver_slot_t;
+
+/*
+ * These variables are for storing the given callbacks which get called
+ * when the coservers delivered some result.  The callbacks are kept in
+ * a ring of slots indexed by the lower bits of their id, or one of the
+ * following slots if that is taken.  No callback is further away from
+ * its slot than @code{svz_coserver_callbacks_probe}.
  */
 static unsigned svz_coserver_callback_id = 1;
-static svz_hash_t *svz_coserver_callbacks = NULL;
+static svz_coserver_slot_t *svz_coserver_callbacks = NULL;
+static unsigned svz_coserver_callbacks_size = 0;
+static unsigned svz_coserver_callbacks_used = 0;
+static unsigned svz_coserver_callbacks_probe = 0;
 
 /*
  * Internal coserver instances.
  */
 static svz_array_t *svz_coservers = NULL;
 
+/*
+ * Further callbacks waiting for the result of a request already sent.
+ */
+typedef struct svz_coserver_waiter svz_coserver_waiter_t;
+struct svz_coserver_waiter
+{
+  svz_coserver_waiter_t *next;                /* next waiter */
+  svz_coserver_handle_result_t handle_result; /* callback */
+  void *closure;                              /* and its argument */
+};
+
+/*
+ * A request sent to a coserver or the resolver threads and not yet
+ * answered.  It wraps the callback and its argument of the first
+ * caller as well as those of further callers with the same request.
+ */
+typedef struct
+{
+  int type;                                   /* coserver type id */
+  svz_coserver_handle_result_t handle_result; /* original callback */
+  void *closure;                              /* and its argument */
+  svz_coserver_waiter_t *waiters;             /* identical requests */
+  svz_coserver_waiter_t *last;                /* last of them */
+  int cache;                                  /* remember the result */
+  char request[COSERVER_BUFSIZE];             /* the request */
+}
+svz_coserver_pending_t;
+
+/*
+ * The requests in flight for each coserver type, hashed by the request
+ * string.
+ */
+static svz_hash_t *svz_coserver_pending[SVZ_MAX_COSERVER_TYPES];
+
+/*
+ * Release the pending request @var{closure} without running any of its
+ * callbacks.
+ */
+static void
+svz_coserver_pending_destroy (void *closure)
+{
+  svz_coserver_pending_t *pending = closure;
+  svz_coserver_waiter_t *waiter;
+
+  while ((waiter = pending->waiters) != NULL)
+    {
+      pending->waiters = waiter->next;
+      svz_free (waiter);
+    }
+  svz_free (pending);
+}
+
+/*
+ * Release the @var{pending} request and forget about it.
+ */
+static void
+svz_coserver_pending_free (svz_coserver_pending_t *pending)
+{
+  svz_hash_delete (svz_coserver_pending[pending->type], pending->request);
+  svz_coserver_pending_destroy (pending);
+}
+
+/*
+ * Pass the @var{result} of a request to all callbacks waiting for it,
+ * remembering it in the cache for DNS and reverse DNS lookups if it
+ * has come from a coserver or the resolver threads.  Return the value
+ * returned by the callback of the first caller.
+ */
+static int
+svz_coserver_pending_result (char *result, void *closure)
+{
+  svz_coserver_pending_t *pending = closure;
+  svz_coserver_waiter_t *waiter;
+  char copy[COSERVER_BUFSIZE], buf[COSERVER_BUFSIZE];
+  int ret;
+
+  /* Further requests issued by the callbacks are sent anew.  */
+  svz_hash_delete (svz_coserver_pending[pending->type], pending->request);
+  if (pending->cache
+      && (pending->type == SVZ_COSERVER_DNS
+          || pending->type == SVZ_COSERVER_REVERSE_DNS))
+    svz_coserver_cache_put (pending->type, pending->request, result);
+
+  /* Each callback gets its own copy of the result.  */
+  if (result)
+    snprintf (copy, sizeof (copy), "%s", result);
+  ret = pending->handle_result (result, pending->closure);
+  while ((waiter = pending->waiters) != NULL)
+    {
+      pending->waiters = waiter->next;
+      if (result)
+        {
+          memcpy (buf, copy, sizeof (buf));
+          waiter->handle_result (buf, waiter->closure);
+        }
+      else
+        waiter->handle_result (NULL, waiter->closure);
+      svz_free (waiter);
+    }
+  svz_free (pending);
+  return ret;
+}
+
+/*
+ * This static array contains the coserver structure for each type of
+ * internal coserver the core library provides.
+ */
+static svz_coservertype_t svz_coservertypes[] =
+{
+  /* coserver-TODO:
+     place coserver callbacks and identification here */
+
+  { SVZ_COSERVER_REVERSE_DNS, "reverse dns",
+    reverse_dns_handle_request, 1, NULL, 0, 0, 0 },
+
+  { SVZ_COSERVER_IDENT, "ident",
+    ident_handle_request, 0, NULL, 0, 0, 0 },
+
+  { SVZ_COSERVER_DNS, "dns",
+    dns_handle_request, 1, NULL, 0, 0, 0 }
+};
+
+/*
+ * Return the current time in milliseconds.
+ */
+static long
+svz_coserver_msec (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+/*
+ * Write the header for a packet of @var{len} bytes with the callback id
+ * @var{id} to @var{header}.
+ */
+static void
+svz_coserver_put_header (char *header, unsigned id, size_t len)
+{
+  uint32_t n = id;
+  uint16_t l = len;
+
+  memcpy (header, &n, sizeof (n));
+  memcpy (header + sizeof (n), &l, sizeof (l));
+}
+
+/*
+ * Read the callback id and the data length of a packet from
+ * @var{header}.
+ */
+static void
+svz_coserver_get_header (const char *header, unsigned *id, size_t *len)
+{
+  uint32_t n;
+  uint16_t l;
+
+  memcpy (&n, header, sizeof (n));
+  memcpy (&l, header + sizeof (n), sizeof (l));
+  *id = n;
+  *len = l;
+}
+
+/*
+ * Return a free slot of the callbacks ring for the callback
+ * with the given @var{id}.
+ */
+static svz_coserver_slot_t *
+svz_coserver_callback_slot (unsigned id)
+{
+  unsigned size = svz_coserver_callbacks_size;
+  unsigned n;
+
+  for (n = 0; svz_coserver_callbacks[(id + n) & (size - 1)].id; n++);
+  if (n > svz_coserver_callbacks_probe)
+    svz_coserver_callbacks_probe = n;
+  return &svz_coserver_callbacks[(id + n) & (size - 1)];
+}
+
+/*
+ * Return the slot of the callback with the given @var{id} or
+ * @code{NULL} if there is none.
+ */
+static svz_coserver_slot_t *
+svz_coserver_callback_find (unsigned id)
+{
+  unsigned size = svz_coserver_callbacks_size;
+  svz_coserver_slot_t *slot;
+  unsigned n;
+
+  if (id == 0)
+    return NULL;
+  for (n = 0; n <= svz_coserver_callbacks_probe && n < size; n++)
+    {
+      slot = &svz_coserver_callbacks[(id + n) & (size - 1)];
+      if (slot->id == id)
+        return slot;
+    }
+  return NULL;
+}
+
+/*
+ * Move the callbacks into a ring of @var{size} slots.
+ */
+static void
+svz_coserver_callbacks_resize (unsigned size)
+{
+  svz_coserver_slot_t *ring = svz_coserver_callbacks;
+  unsigned n, old = svz_coserver_callbacks_size;
+
+  svz_coserver_callbacks = svz_calloc (size * sizeof (svz_coserver_slot_t));
+  svz_coserver_callbacks_size = size;
+  svz_coserver_callbacks_probe = 0;
+  for (n = 0; n < old; n++)
+    if (ring[n].id)
+      *svz_coserver_callback_slot (ring[n].id) = ring[n];
+  svz_free (ring);
+}
+
+/*
+ * Store the callback @var{handle_result} and its argument @var{closure}
+ * for a request sent to the coserver instance @var{coserver} and return
+ * the id under which it can be found.  Return zero if there are too many
+ * callbacks waiting already.
+ */
+static unsigned
+svz_coserver_callback_add (svz_coserver_t *coserver,
+                           svz_coserver_handle_result_t handle_result,
+                           void *closure)
+{
+  svz_coserver_slot_t *slot;
+  unsigned id, size = svz_coserver_callbacks_size;
+
+  /* Keep the ring at most half full.  */
+  if (svz_coserver_callbacks_used >= size / 2)
+    {
+      if (size >= COSERVER_MAX_SLOTS)
+        return 0;
+      svz_coserver_callbacks_resize (size * 2);
+    }
+
+  if ((id = svz_coserver_callback_id++) == 0)
+    id = svz_coserver_callback_id++;
+
+  slot = svz_coserver_callback_slot (id);
+  slot->id = id;
+  slot->type = coserver->type;
+  slot->instance.id = coserver->sock->id;
+  slot->instance.version = coserver->sock->version;
+  slot->sent = svz_coserver_msec ();
+  slot->handle_result = handle_result;
+  slot->closure = closure;
+  svz_coserver_callbacks_used++;
+  return id;
+}
+
 /*
  * Invoke a @var{request} for one of the running internal coservers
  * with type @var{type}.  @var{handle_result} and @var{arg} specify what
@@ -103,8 +414,67 @@ svz_coserver_send_request (int type, const char *request,
 {
   size_t n;
   int busy;
+  unsigned id;
   svz_coserver_t *coserver, *current;
-  svz_coserver_callback_t *cb;
+  svz_coserver_pending_t *pending;
+  svz_coserver_waiter_t *waiter;
+  char result[COSERVER_BUFSIZE];
+  char packet[COSERVER_HEADER_SIZE + COSERVER_BUFSIZE];
+  size_t len;
+
+  if ((len = strlen (request)) >= COSERVER_BUFSIZE)
+    {
+      svz_log (SVZ_LOG_ERROR, "coserver: request too long (%zu bytes)\n",
+               len);
+      handle_result (NULL, closure);
+      return;
+    }
+
+  /* Answer from the cache if possible.  */
+  if (svz_coserver_cache_get (type, request, result))
+    {
+      handle_result (*result ? result : NULL, closure);
+      return;
+    }
+
+  /* Wait for the result of an identical request already in flight.  */
+  if (svz_coserver_pending[type] != NULL
+      && (pending = svz_hash_get (svz_coserver_pending[type], request)))
+    {
+      waiter = svz_malloc (sizeof (svz_coserver_waiter_t));
+      waiter->next = NULL;
+      waiter->handle_result = handle_result;
+      waiter->closure = closure;
+      if (pending->last)
+        pending->last->next = waiter;
+      else
+        pending->waiters = waiter;
+      pending->last = waiter;
+#if ENABLE_DEBUG
+      svz_log (SVZ_LOG_DEBUG, "%s: joined request for %s\n",
+               svz_coservertypes[type].name, request);
+#endif
+      return;
+    }
+
+  /* Otherwise send it, letting identical requests join it.  */
+  pending = svz_malloc (sizeof (svz_coserver_pending_t));
+  pending->type = type;
+  pending->handle_result = handle_result;
+  pending->closure = closure;
+  pending->waiters = pending->last = NULL;
+  pending->cache = 1;
+  memcpy (pending->request, request, len + 1);
+  if (svz_coserver_pending[type] == NULL)
+    svz_coserver_pending[type] =
+      svz_hash_create (4, svz_coserver_pending_destroy);
+  svz_hash_put (svz_coserver_pending[type], request, pending);
+  handle_result = svz_coserver_pending_result;
+  closure = pending;
+
+  /* Lookups done by the resolver threads do not need a coserver.  */
+  if (!svz_resolver_submit (type, request, handle_result, closure))
+    return;
 
   /*
    * Go through all coservers and find out which coserver
@@ -128,34 +498,46 @@ svz_coserver_send_request (int type, const char *request,
         }
     }
 
+  /*
+   * Fail at once if too many requests are waiting already.  Otherwise
+   * store the callback for this coserver request and pass the request
+   * with the callback's id to the coserver.
+   */
+  if (coserver
+      && (svz_coservertypes[type].queued >= COSERVER_MAX_QUEUED
+          || !(id = svz_coserver_callback_add (coserver, handle_result,
+                                                closure))))
+    {
+      svz_log (SVZ_LOG_WARNING, "%s: too many requests waiting\n",
+               svz_coservertypes[type].name);
+      pending->cache = 0;
+      handle_result (NULL, closure);
+      return;
+    }
+
   /* found an appropriate coserver */
   if (coserver)
     {
-      /*
-       * Create new callback hash entry for this coserver request and
-       * put it into the global coserver callback hash.
-       */
-      cb = svz_malloc (sizeof (svz_coserver_callback_t));
-      cb->handle_result = handle_result;
-      cb->closure = closure;
-      svz_hash_put (svz_coserver_callbacks,
-                    svz_itoa (svz_coserver_callback_id), cb);
+      svz_coserver_put_header (packet, id, len);
+      memcpy (packet + COSERVER_HEADER_SIZE, request, len);
 
       coserver->busy++;
+      coserver->last_used = (long) time (NULL);
+      svz_coservertypes[type].queued++;
 #ifdef __MINGW32__
       EnterCriticalSection (&coserver->sync);
 #endif /* __MINGW32__ */
-      if (svz_sock_printf (coserver->sock, "%u:%s\n",
-                           svz_coserver_callback_id, request))
+      if (svz_sock_write (coserver->sock, packet, COSERVER_HEADER_SIZE + len))
         {
           svz_sock_schedule_for_shutdown (coserver->sock);
         }
-      svz_coserver_callback_id++;
 #ifdef __MINGW32__
       LeaveCriticalSection (&coserver->sync);
       svz_coserver_activate (coserver->type);
 #endif /* __MINGW32__ */
     }
+  else
+    svz_coserver_pending_free (pending);
 }
 
 svz_sock_iv_t *
@@ -176,6 +558,8 @@ svz_make_sock_iv (svz_socket_t *sock)
  * to resolve address @var{addr},
  * arranging for callback @var{cb} to be called with two args:
  * the hostname (a string) and the opaque data @var{closure}.
+ * If the answer is known already (e.g., it is cached), @var{cb}
+ * is called before this function returns.
  */
 void
 svz_coserver_rdns_invoke (svz_address_t *addr,
@@ -194,7 +578,8 @@ svz_coserver_rdns_invoke (svz_address_t *addr,
  * Enqueue a request for the DNS coserver to resolve @var{host},
  * arranging for callback @var{cb} to be called with two args:
  * the ip address in dots-and-numbers notation and the opaque
- * data @var{closure}.
+ * data @var{closure}.  Like @code{svz_coserver_rdns_invoke},
+ * this may call @var{cb} at once.
  */
 void
 svz_coserver_dns_invoke (char *host,
@@ -205,43 +590,21 @@ svz_coserver_dns_invoke (char *host,
 }
 
 /**
- * Enqueue a request for the ident coserver to resolve the client
- * identity at @var{sock}, arranging for callback @var{cb} to be called
- * with two args: the identity (string) and the opaque data @var{closure}.
+ * Start a query of the ident server of the client at @var{sock},
+ * arranging for callback @var{cb} to be called with two args: the
+ * identity (string) and the opaque data @var{closure}.  The query is
+ * done by the main loop, not by a coserver.  If it cannot be started,
+ * @var{cb} is called before this function returns.
  */
 void
 svz_coserver_ident_invoke (svz_socket_t *sock,
                            svz_coserver_handle_result_t cb,
                            void *closure)
 {
-  char addrbuf[64];
-  char buffer[COSERVER_BUFSIZE];
-
-  snprintf (buffer, COSERVER_BUFSIZE, "%s:%u",
-            SVZ_PP_ADDR_PORT (addrbuf, sock->remote_addr, sock->remote_port),
-            ntohs (sock->local_port));
-  svz_coserver_send_request (SVZ_COSERVER_IDENT, buffer, cb, closure);
+  ident_query (sock->remote_addr, sock->remote_port, sock->local_port,
+               cb, closure);
 }
 
-/*
- * This static array contains the coserver structure for each type of
- * internal coserver the core library provides.
- */
-static svz_coservertype_t svz_coservertypes[] =
-{
-  /* coserver-TODO:
-     place coserver callbacks and identification here */
-
-  { SVZ_COSERVER_REVERSE_DNS, "reverse dns",
-    reverse_dns_handle_request, 1, reverse_dns_init, 0 },
-
-  { SVZ_COSERVER_IDENT, "ident",
-    ident_handle_request, 1, NULL, 0},
-
-  { SVZ_COSERVER_DNS, "dns",
-    dns_handle_request, 1, NULL, 0 }
-};
-
 /**
  * Call @var{func} for each coserver, passing additionally the second arg
  * @var{closure}.  If @var{func} returns a negative value, return immediately
@@ -262,50 +625,6 @@ svz_foreach_coserver (svz_coserver_do_t *func, void *closure)
   return 0;
 }
 
-/*
- * This routine gets the coserver hash id from a given response and
- * cuts it from the given response buffer.
- */
-static unsigned
-svz_coserver_get_id (char *response)
-{
-  char *p = response;
-  unsigned id = 0;
-
-  while (*p >= '0' && *p <= '9')
-    {
-      id *= 10;
-      id += *p - '0';
-      p++;
-    }
-  if (*p != COSERVER_ID_BOUNDARY)
-    {
-      svz_log (SVZ_LOG_WARNING,
-               "coserver: invalid protocol character (0x%02x)\n", *p);
-      return 0;
-    }
-  p++;
-
-  while (*p != COSERVER_PACKET_BOUNDARY)
-    {
-      *response++ = *p++;
-    }
-  *response = '\0';
-  return id;
-}
-
-/*
- * This function adds a given coserver hash id to the response.
- */
-static void
-svz_coserver_put_id (unsigned id, char *response)
-{
-  char buffer[COSERVER_BUFSIZE];
-
-  snprintf (buffer, COSERVER_BUFSIZE, "%u:%s\n", id, response);
-  strcpy (response, buffer);
-}
-
 /*************************************************************************/
 /*            This is part of the coserver process / thread.             */
 /*************************************************************************/
@@ -345,29 +664,43 @@ svz_coserver_put_id (unsigned id, char *response)
 # define COSERVER_RESULT()
 #endif
 
-/* Pre-Processing Macro.  */
-#define COSERVER_REQUEST()                                   \
-  COSERVER_REQUEST_INFO ();                                  \
-  /* Process the request here.  Might be blocking indeed!  */ \
-  if ((id = svz_coserver_get_id (request)) != 0)             \
-    {                                                        \
-      if ((result = coserver->callback (request)) == NULL)   \
-        {                                                    \
-          result = request;                                  \
-          *result = '\0';                                    \
-        }                                                    \
-      svz_coserver_put_id (id, result);                      \
-    }                                                        \
+/*
+ * Process the @var{len} bytes of the request at @var{request} with the
+ * callback id @var{id} and write the response packet to @var{response},
+ * which must hold @code{COSERVER_HEADER_SIZE + COSERVER_BUFSIZE} bytes.
+ * Return the size of the response packet.
+ */
+static size_t
+svz_coserver_process (svz_coserver_t *coserver, unsigned id,
+                      const char *request, size_t len, char *response)
+{
+  char buffer[COSERVER_BUFSIZE];
+  char *result;
+
+  COSERVER_REQUEST_INFO ();
+  memcpy (buffer, request, len);
+  buffer[len] = '\0';
+
+  /* Process the request here.  Might be blocking indeed!  */
+  if ((result = coserver->callback (buffer)) == NULL)
+    len = 0;
+  else if ((len = strlen (result)) >= COSERVER_BUFSIZE)
+    len = COSERVER_BUFSIZE - 1;
+  svz_coserver_put_header (response, id, len);
+  if (len > 0)
+    memcpy (response + COSERVER_HEADER_SIZE, result, len);
+  COSERVER_RESULT ();
+  return COSERVER_HEADER_SIZE + len;
+}
 
 
 #ifdef __MINGW32__
 static void
 svz_coserver_loop (svz_coserver_t *coserver, svz_socket_t *sock)
 {
-  char *p;
-  int len;
   char request[COSERVER_BUFSIZE];
-  char *result = NULL;
+  char response[COSERVER_HEADER_SIZE + COSERVER_BUFSIZE];
+  size_t len, size;
   unsigned id;
 
   /* wait until the thread handle has been passed */
@@ -377,39 +710,24 @@ svz_coserver_loop (svz_coserver_t *coserver, svz_socket_t *sock)
   for (;;)
     {
       /* check if there is anything in the receive buffer */
-      while (sock->send_buffer_fill > 0)
+      while (sock->send_buffer_fill >= COSERVER_HEADER_SIZE)
         {
-          p = sock->send_buffer;
-          while (*p != COSERVER_PACKET_BOUNDARY &&
-                 p < sock->send_buffer + sock->send_buffer_fill)
-            p++;
-          len = p - sock->send_buffer + 1;
-
-          /* Copy the coserver request to static buffer.  */
-          assert (len <= COSERVER_BUFSIZE);
-          memcpy (request, sock->send_buffer, len);
-
-          /* Enter a synchronized section (exclusive access to all data).  */
+          /* Enter a synchronized section (exclusive access to all data)
+             and copy the coserver request to a static buffer.  */
           EnterCriticalSection (&coserver->sync);
-          if (sock->send_buffer_fill > len)
-            {
-              memmove (sock->send_buffer, p + 1,
-                       sock->send_buffer_fill - len);
-            }
-          sock->send_buffer_fill -= len;
+          svz_coserver_get_header (sock->send_buffer, &id, &len);
+          assert (len < COSERVER_BUFSIZE);
+          assert (sock->send_buffer_fill >= COSERVER_HEADER_SIZE + len);
+          memcpy (request, sock->send_buffer + COSERVER_HEADER_SIZE, len);
+          svz_sock_reduce_send (sock, COSERVER_HEADER_SIZE + len);
           LeaveCriticalSection (&coserver->sync);
 
-          COSERVER_REQUEST ();
+          size = svz_coserver_process (coserver, id, request, len, response);
 
-          if (id && result)
-            {
-              EnterCriticalSection (&coserver->sync);
-              memcpy (sock->recv_buffer + sock->recv_buffer_fill,
-                      result, strlen (result));
-              sock->recv_buffer_fill += strlen (result);
-              LeaveCriticalSection (&coserver->sync);
-              COSERVER_RESULT ();
-            }
+          EnterCriticalSection (&coserver->sync);
+          memcpy (sock->recv_buffer + sock->recv_buffer_fill, response, size);
+          sock->recv_buffer_fill += size;
+          LeaveCriticalSection (&coserver->sync);
         }
 
       /* suspend myself and wait for being resumed ...  */
@@ -422,43 +740,84 @@ svz_coserver_loop (svz_coserver_t *coserver, svz_socket_t *sock)
 
 #else /* not __MINGW32__ */
 
-static void
-svz_coserver_loop (svz_coserver_t *coserver, int in_pipe, int out_pipe)
+/*
+ * Write all of the @var{len} bytes at @var{buf} to the descriptor
+ * @var{fd}.  Return zero on success.
+ */
+static int
+svz_coserver_write_all (int fd, const char *buf, size_t len)
 {
-  FILE *in, *out;
-  char request[COSERVER_BUFSIZE];
-  char *result = NULL;
-  unsigned id;
+  ssize_t n;
 
-  if ((in = fdopen (in_pipe, "r")) == NULL)
+  while (len > 0)
     {
-      svz_log_sys_error ("coserver: fdopen (%d)", in_pipe);
-      return;
-    }
-  if ((out = fdopen (out_pipe, "w")) == NULL)
-    {
-      svz_log_sys_error ("coserver: fdopen (%d)", out_pipe);
-      return;
+      if ((n = write (fd, buf, len)) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          svz_log_sys_error ("coserver: write");
+          return -1;
+        }
+      buf += n;
+      len -= n;
     }
+  return 0;
+}
 
-  while (NULL != fgets (request, COSERVER_BUFSIZE, in))
-    {
+static void
+svz_coserver_loop (svz_coserver_t *coserver, int in_pipe, int out_pipe)
+{
+  char in[COSERVER_BATCH_SIZE], out[COSERVER_BATCH_SIZE];
+  size_t fill = 0, done, ofill, len;
+  ssize_t n;
+  unsigned id;
 
-      COSERVER_REQUEST ();
+  /* Read as many requests as are available at once and send back all
+     of their responses at once.  */
+  for (;;)
+    {
+      if ((n = read (in_pipe, in + fill, sizeof (in) - fill)) <= 0)
+        {
+          if (n < 0 && errno == EINTR)
+            continue;
+          break;
+        }
+      fill += n;
 
-      if (id && result)
+      for (done = ofill = 0; fill - done >= COSERVER_HEADER_SIZE;
+           done += COSERVER_HEADER_SIZE + len)
         {
-          fprintf (out, "%s", result);
-          fflush (out);
-          COSERVER_RESULT ();
+          svz_coserver_get_header (in + done, &id, &len);
+          if (len >= COSERVER_BUFSIZE)
+            {
+              svz_log (SVZ_LOG_ERROR, "coserver: invalid request length\n");
+              return;
+            }
+          if (fill - done < COSERVER_HEADER_SIZE + len)
+            break;
+          if (sizeof (out) - ofill < COSERVER_HEADER_SIZE + COSERVER_BUFSIZE)
+            {
+              if (svz_coserver_write_all (out_pipe, out, ofill))
+                return;
+              ofill = 0;
+            }
+          ofill += svz_coserver_process (coserver, id,
+                                         in + done + COSERVER_HEADER_SIZE,
+                                         len, out + ofill);
         }
+
+      if (ofill > 0 && svz_coserver_write_all (out_pipe, out, ofill))
+        return;
+      if (done > 0 && fill > done)
+        memmove (in, in + done, fill - done);
+      fill -= done;
     }
 
   /* error in reading pipe */
-  if (fclose (in))
-    svz_log_sys_error ("fclose");
-  if (fclose (out))
-    svz_log_sys_error ("fclose");
+  if (n < 0)
+    svz_log_sys_error ("coserver: read");
+  close (in_pipe);
+  close (out_pipe);
 }
 
 #endif /* not __MINGW32__ */
@@ -590,41 +949,46 @@ svz_coserver_disconnect (svz_socket_t *sock)
 }
 #endif /* not __MINGW32__ */
 
+/*
+ * Update the statistics of the coserver type of the request in
+ * @var{slot} which has just been answered or given up.
+ */
+static void
+svz_coserver_account (svz_coserver_slot_t *slot)
+{
+  svz_coservertype_t *ctype = &svz_coservertypes[slot->type];
+  long elapsed = svz_coserver_msec () - slot->sent;
+
+  if (ctype->queued > 0)
+    ctype->queued--;
+  ctype->latency = (ctype->latency * 7 + elapsed) / 8;
+}
+
 /*
  * This routine has to be called for coservers requests.  It is the default
- * @code{check_request} routine for coservers detecting full responses as
- * lines (trailing '\n').
+ * @code{check_request} routine for coservers detecting full responses.
  */
 static int
 svz_coserver_check_request (svz_socket_t *sock)
 {
   char *packet = sock->recv_buffer;
-  char *p = packet;
-  int request_len;
   int len = 0;
+  size_t size;
+  unsigned id;
   svz_coserver_t *coserver = sock->data;
 
   assert (coserver);
-  do
+  while (sock->recv_buffer_fill - len >= COSERVER_HEADER_SIZE)
     {
-      /* find a line (trailing '\n') */
-      while (*p != COSERVER_PACKET_BOUNDARY &&
-             p < sock->recv_buffer + sock->recv_buffer_fill)
-        p++;
-
-      if (*p == COSERVER_PACKET_BOUNDARY &&
-          p < sock->recv_buffer + sock->recv_buffer_fill)
-        {
-          coserver->busy--;
-          p++;
-          request_len = p - packet;
-          len += request_len;
-          if (sock->handle_request)
-            sock->handle_request (sock, packet, request_len);
-          packet = p;
-        }
+      svz_coserver_get_header (packet, &id, &size);
+      if (sock->recv_buffer_fill - len < (int) (COSERVER_HEADER_SIZE + size))
+        break;
+      coserver->busy--;
+      if (sock->handle_request)
+        sock->handle_request (sock, packet, COSERVER_HEADER_SIZE + size);
+      packet += COSERVER_HEADER_SIZE + size;
+      len += COSERVER_HEADER_SIZE + size;
     }
-  while (p < sock->recv_buffer + sock->recv_buffer_fill);
 
 #if ENABLE_DEBUG
   svz_log (SVZ_LOG_DEBUG, "%s: %d byte response\n",
@@ -632,11 +996,8 @@ svz_coserver_check_request (svz_socket_t *sock)
 #endif
 
   /* remove data from receive buffer if necessary */
-  if (len > 0 && sock->recv_buffer_fill > len)
-    {
-      memmove (sock->recv_buffer, packet, sock->recv_buffer_fill - len);
-    }
-  sock->recv_buffer_fill -= len;
+  if (len > 0)
+    svz_sock_reduce_recv (sock, len);
 
   return 0;
 }
@@ -647,64 +1008,44 @@ svz_coserver_check_request (svz_socket_t *sock)
  */
 static int
 svz_coserver_handle_request (UNUSED svz_socket_t *sock,
-                             char *request, int len)
+                             char *request, UNUSED int len)
 {
-  int ret;
+  char result[COSERVER_BUFSIZE];
+  svz_coserver_slot_t *slot;
+  svz_coserver_handle_result_t handle_result;
+  void *closure;
   unsigned id;
-  char *p, *end, *data;
-  svz_coserver_callback_t *cb;
-
-  /* Search for coserver hash id.  */
-  id = 0;
-  p = request;
-  end = p + len;
-  while (*p != COSERVER_ID_BOUNDARY && p < end)
-    {
-      if (*p < '0' || *p > '9')
-        {
-          svz_log (SVZ_LOG_WARNING,
-                   "coserver: invalid character in id (0x%02X)\n", *p);
-          return -1;
-        }
-      id *= 10;
-      id += *p - '0';
-      p++;
-    }
-  if (p == end)
-    {
-      svz_log (SVZ_LOG_WARNING, "coserver: invalid coserver response (no id)\n");
-      return -1;
-    }
-  data = ++p;
+  size_t size;
 
-  /* Search for packet end.  */
-  while (*p != COSERVER_PACKET_BOUNDARY && p < end)
-    p++;
-  if (p == end)
+  svz_coserver_get_header (request, &id, &size);
+  if (size >= COSERVER_BUFSIZE)
     {
       svz_log (SVZ_LOG_WARNING,
-               "coserver: invalid coserver response (no data)\n");
+               "coserver: invalid coserver response (%zu bytes)\n", size);
       return -1;
     }
-  *p = '\0';
+  memcpy (result, request + COSERVER_HEADER_SIZE, size);
+  result[size] = '\0';
 
-  /* Have a look at the coserver callback hash.  */
-  if (NULL == (cb = svz_hash_get (svz_coserver_callbacks, svz_itoa (id))))
+  /* Have a look at the coserver callbacks.  */
+  if ((slot = svz_coserver_callback_find (id)) == NULL)
     {
       svz_log (SVZ_LOG_ERROR, "coserver: invalid callback for id %u\n", id);
       return -1;
     }
 
   /*
-   * Run the callback inclusive its arg.  Second arg is either NULL for
-   * error detection or the actual result string.  Afterwards free the
-   * callback structure and delete it from the coserver callback hash.
+   * Run the callback inclusive its arg.  First arg is either NULL for
+   * error detection or the actual result string.  The slot is freed
+   * beforehand since the callback might issue further requests.
    */
-  ret = cb->handle_result (*data ? data : NULL, cb->closure);
-  svz_hash_delete (svz_coserver_callbacks, svz_itoa (id));
-  svz_free (cb);
+  handle_result = slot->handle_result;
+  closure = slot->closure;
+  slot->id = 0;
+  svz_coserver_callbacks_used--;
+  svz_coserver_account (slot);
 
-  return ret;
+  return handle_result (size ? result : NULL, closure);
 }
 
 #ifndef __MINGW32__
@@ -845,6 +1186,25 @@ svz_coserver_destroy (int type)
 #endif /* ENABLE_DEBUG */
 }
 
+/**
+ * Store the number of running instances of the coserver type @var{type},
+ * the number of requests waiting for their result and the average
+ * response time in milliseconds in @var{count}, @var{queued} and
+ * @var{latency}.  Return the name of the coserver type or @code{NULL}
+ * if there is no such type.
+ */
+const char *
+svz_coserver_load (int type, int *count, int *queued, long *latency)
+{
+  if (type < 0 || type >= SVZ_MAX_COSERVER_TYPES)
+    return NULL;
+
+  *count = svz_coserver_count (type);
+  *queued = svz_coservertypes[type].queued;
+  *latency = svz_coservertypes[type].latency;
+  return svz_coservertypes[type].name;
+}
+
 /**
  * Return the type name of @var{coserver}.
  */
@@ -880,6 +1240,7 @@ svz_coserver_start (int type)
   coserver = svz_malloc (sizeof (svz_coserver_t));
   coserver->type = type;
   coserver->busy = 0;
+  coserver->last_used = (long) time (NULL);
   coserver->sock = NULL;
 
   if (svz_coservers == NULL)
@@ -1043,6 +1404,139 @@ svz_coserver_start (int type)
   return sock;
 }
 
+#ifndef __MINGW32__
+/*
+ * Stop the coserver instance @var{coserver} at once.
+ */
+static void
+svz_coserver_stop (svz_coserver_t *coserver)
+{
+  svz_socket_t *sock = coserver->sock;
+
+  svz_sock_schedule_for_shutdown (sock);
+  sock->disconnected_socket = NULL;
+  svz_coserver_disconnect (sock);
+}
+#endif /* not __MINGW32__ */
+
+/*
+ * Return the running coserver instance whose socket is described by
+ * @var{instance} or @code{NULL} if there is none.
+ */
+static svz_coserver_t *
+svz_coserver_find (svz_sock_iv_t *instance)
+{
+  svz_coserver_t *coserver;
+  size_t n;
+
+  svz_array_foreach (svz_coservers, coserver, n)
+    if (coserver->sock && coserver->sock->id == instance->id
+        && coserver->sock->version == instance->version)
+      return coserver;
+  return NULL;
+}
+
+/*
+ * Give up waiting for the results of requests sent more than
+ * @code{COSERVER_TIMEOUT} seconds ago, and of those sent to instances
+ * which are gone.  Their callbacks get @code{NULL}.  An instance which
+ * has not answered in time is hanging and gets replaced.
+ */
+static void
+svz_coserver_expire (void)
+{
+  svz_coserver_slot_t *slot;
+  svz_coserver_handle_result_t handle_result;
+  svz_coserver_t *coserver;
+  void *closure;
+  long now = svz_coserver_msec ();
+  unsigned n;
+
+  for (n = 0; n < svz_coserver_callbacks_size; n++)
+    {
+      slot = &svz_coserver_callbacks[n];
+      if (slot->id == 0)
+        continue;
+      coserver = svz_coserver_find (&slot->instance);
+      if (coserver && now - slot->sent < COSERVER_TIMEOUT * 1000L)
+        continue;
+
+      svz_log (SVZ_LOG_ERROR, "%s: request timed out\n",
+               svz_coservertypes[slot->type].name);
+#ifndef __MINGW32__
+      /* the instance answers in order, so the requests it has taken
+         after this one are lost, too */
+      if (coserver)
+        {
+          svz_log (SVZ_LOG_NOTICE, "%s: restarting hanging coserver\n",
+                   svz_coservertypes[slot->type].name);
+          svz_coserver_stop (coserver);
+          svz_coserver_start (slot->type);
+        }
+#endif /* not __MINGW32__ */
+      handle_result = slot->handle_result;
+      closure = slot->closure;
+      slot->id = 0;
+      svz_coserver_callbacks_used--;
+      svz_coserver_account (slot);
+
+      /* a failure on our side is not worth remembering */
+      if (handle_result == svz_coserver_pending_result)
+        ((svz_coserver_pending_t *) closure)->cache = 0;
+      handle_result (NULL, closure);
+    }
+}
+
+/*
+ * Adapt the number of instances of each coserver type to the load:
+ * start another one if requests pile up or take too long and stop
+ * surplus instances which have not been used for a while.  The number
+ * of instances per type is limited by the runtime parameter
+ * @code{SVZ_RUNPARM_MAX_COSERVERS}.
+ */
+static void
+svz_coserver_adapt (void)
+{
+  svz_coservertype_t *ctype;
+  svz_coserver_t *coserver;
+  long now = (long) time (NULL);
+  int count;
+  size_t n;
+
+  for (n = 0; n < SVZ_MAX_COSERVER_TYPES; n++)
+    {
+      ctype = &svz_coservertypes[n];
+      if (svz_resolver_handles (ctype->type) || ctype->queued == 0)
+        continue;
+      count = svz_coserver_count (ctype->type);
+      if (count > 0 && count < SVZ_RUNPARM (MAX_COSERVERS)
+          && now - ctype->last_start >= 3
+          && (ctype->latency > COSERVER_SLOW
+              || ctype->queued > count * COSERVER_BACKLOG))
+        {
+          svz_log (SVZ_LOG_NOTICE, "%s: %d requests waiting, "
+                   "%ld msec response time\n",
+                   ctype->name, ctype->queued, ctype->latency);
+          svz_coserver_start (ctype->type);
+        }
+    }
+
+#ifndef __MINGW32__
+  svz_array_foreach (svz_coservers, coserver, n)
+    {
+      ctype = &svz_coservertypes[coserver->type];
+      if (coserver->busy <= 0 && now - coserver->last_used >= COSERVER_IDLE
+          && svz_coserver_count (ctype->type) > ctype->instances)
+        {
+          svz_log (SVZ_LOG_NOTICE, "%s: stopping idle coserver\n",
+                   ctype->name);
+          svz_coserver_stop (coserver);
+          break;
+        }
+    }
+#endif /* not __MINGW32__ */
+}
+
 /**
  * Under woe32 check if there was any response from an active coserver.
  * Moreover keep the coserver threads/processes alive.  If one of the
@@ -1086,6 +1580,8 @@ svz_coserver_check (void)
   for (n = 0; n < SVZ_MAX_COSERVER_TYPES; n++)
     {
       ctype = &svz_coservertypes[n];
+      if (svz_resolver_handles (ctype->type))
+        continue;
       if (svz_coserver_count (ctype->type) < ctype->instances &&
           ((long) time (NULL)) - ctype->last_start >= 3)
         svz_coserver_start (ctype->type);
@@ -1102,6 +1598,9 @@ svz_coserver_check (void)
           svz_coserver_count (ctype->type) <= ctype->instances)
         svz_coserver_start (coserver->type);
     }
+
+  svz_coserver_expire ();
+  svz_coserver_adapt ();
 }
 
 /**
@@ -1134,12 +1633,18 @@ svz_coserver_init (void)
   int i, n;
   svz_coservertype_t *coserver;
 
-  svz_coserver_callbacks = svz_hash_create (4, svz_free);
+  svz_coserver_callbacks_size = 64;
+  svz_coserver_callbacks = svz_calloc (svz_coserver_callbacks_size
+                                       * sizeof (svz_coserver_slot_t));
+  svz_coserver_callbacks_used = 0;
+  svz_coserver_callbacks_probe = 0;
   svz_coserver_callback_id = 1;
 
   for (n = 0; n < SVZ_MAX_COSERVER_TYPES; n++)
     {
       coserver = &svz_coservertypes[n];
+      if (coserver->instances > 0 && !svz_resolver_start (coserver->type))
+        continue;
       if (coserver->init)
         coserver->init ();
       for (i = 0; i < coserver->instances; i++)
@@ -1158,19 +1663,28 @@ svz_coserver_finalize (void)
   int n;
   svz_coservertype_t *coserver;
 
+  svz_resolver_stop ();
+  svz_coserver_cache_destroy ();
+  ident_finalize ();
   for (n = 0; n < SVZ_MAX_COSERVER_TYPES; n++)
     {
       coserver = &svz_coservertypes[n];
       svz_coserver_destroy (coserver->type);
+      /* drop the requests not answered, including those of the
+         resolver threads */
+      svz_hash_destroy (svz_coserver_pending[n]);
+      svz_coserver_pending[n] = NULL;
     }
 
 #if ENABLE_DEBUG
-  svz_log (SVZ_LOG_DEBUG, "coserver: %d callback(s) left\n",
-           svz_hash_size (svz_coserver_callbacks));
+  svz_log (SVZ_LOG_DEBUG, "coserver: %u callback(s) left\n",
+           svz_coserver_callbacks_used);
 #endif
 
   /* Destroy all callbacks left so far.  */
-  svz_hash_destroy (svz_coserver_callbacks);
+  svz_free (svz_coserver_callbacks);
+  svz_coserver_callbacks = NULL;
+  svz_coserver_callbacks_size = 0;
   return 0;
 }
 
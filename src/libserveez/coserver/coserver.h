@@ -52,12 +52,13 @@ typedef struct
   svz_socket_t *sock;           /* socket structure for this coserver */
   int type;                     /* coserver type id */
   int busy;                     /* is this thread currently busy?  */
+  long last_used;               /* time stamp of the last request */
 }
 svz_coserver_t;
 
 /* begin svzint */
 /* Buffer size for the coservers.  */
-#define COSERVER_BUFSIZE 256
+#define COSERVER_BUFSIZE 1024
 /* end svzint */
 
 /*
@@ -107,6 +108,9 @@ SERVEEZ_API int svz_updn_all_coservers (int);
 SERVEEZ_API void svz_coserver_destroy (int);
 SERVEEZ_API svz_coserver_t *svz_coserver_create (int);
 SERVEEZ_API const char *svz_coserver_type_name (const svz_coserver_t *);
+SERVEEZ_API const char *svz_coserver_load (int, int *, int *, long *);
+SERVEEZ_API int svz_coserver_cache_stats (int, size_t *,
+                                          unsigned long *, unsigned long *);
 
 /*
  * These are the three wrappers for our existing coservers.
@@ -1,5 +1,5 @@
 /*
- * ident.c - ident coserver implementation
+ * ident.c - ident coserver and client implementation
  *
  * Copyright (C) 2011-2013 Thien-Thi Nguyen
  * Copyright (C) 2000, 2001, 2003 Stefan Jahn <stefan@lkcc.org>
@@ -33,13 +33,108 @@
 # include <netdb.h>
 #endif
 
+#include "libserveez/alloc.h"
 #include "libserveez/core.h"
 #include "libserveez/socket.h"
+#include "libserveez/tcp-socket.h"
+#include "libserveez/server-core.h"
 #include "libserveez/util.h"
 #include "libserveez/coserver/coserver.h"
 #include "libserveez/coserver/ident.h"
 
-#define IDENT_PORT 113 /* the identd port */
+#define IDENT_PORT        113 /* the identd port */
+#define IDENT_TIMEOUT      30 /* seconds to wait for a response */
+#define IDENT_MAX_QUERIES  64 /* queries in progress at once */
+
+/*
+ * Parse the ident server's @var{response} and return the user name
+ * found in it or @code{NULL} if there is none.
+ */
+static char *
+ident_parse_response (char *response)
+{
+  static char user[64];
+  char *p, *p_end, *u;
+
+  p = response;
+  p_end = p + strlen (p);
+
+  /* Parse client port.  */
+  if (p >= p_end || !(*p >= '0' && *p <= '9'))
+    return NULL;
+  while (p < p_end && *p >= '0' && *p <= '9')
+    p++;
+
+  /* Skip whitespace and separating comma.  */
+  while (p < p_end && *p == ' ')
+    p++;
+  if (p >= p_end || *p != ',')
+    return NULL;
+  p++;
+  while (p < p_end && *p == ' ')
+    p++;
+
+  /* Parse server port.  */
+  if (p >= p_end || !(*p >= '0' && *p <= '9'))
+    return NULL;
+  while (p < p_end && *p >= '0' && *p <= '9')
+    p++;
+
+  /* Skip whitespace and separating colon.  */
+  while (p < p_end && *p == ' ')
+    p++;
+  if (p >= p_end || *p != ':')
+    return NULL;
+  p++;
+  while (p < p_end && *p == ' ')
+    p++;
+
+  /* Parse response type.  (USERID or ERROR possible) */
+  if (p_end - p < 6 || memcmp (p, "USERID", 6))
+    return NULL;
+  while (p < p_end && *p != ' ')
+    p++;
+
+  /* Skip whitespace and separating colon.  */
+  while (p < p_end && *p == ' ')
+    p++;
+  if (p >= p_end || *p != ':')
+    return NULL;
+  p++;
+  while (p < p_end && *p == ' ')
+    p++;
+  if (p >= p_end)
+    return NULL;
+
+  /* Parse OS type.  */
+  while (p < p_end && *p != ' ')
+    p++;
+
+  /* Skip whitespace and separating colon.  */
+  while (p < p_end && *p == ' ')
+    p++;
+  if (p >= p_end || *p != ':')
+    return NULL;
+  p++;
+  while (p < p_end && *p == ' ')
+    p++;
+
+  /* Finally parse the user name.  */
+  u = user;
+  while (p < p_end && *p != '\0' && *p != '\n' && *p != '\r')
+    {
+      if (u < user + (sizeof (user) - 1))
+        *u++ = *p;
+      p++;
+    }
+  *u = '\0';
+
+#if ENABLE_DEBUG
+  svz_log (SVZ_LOG_DEBUG, "ident: received identified user `%s'\n", user);
+#endif
+
+  return user;
+}
 
 /*
  * The following routine takes the input buffer in the format "%s:%u:%u"
@@ -55,9 +150,7 @@ ident_handle_request (char *inbuf)
   in_addr_t addr;
   unsigned lport, rport;
   static char ident_response[COSERVER_BUFSIZE];
-  char *p_end;
-  char user[64];
-  char *p, *u;
+  char *p, *user;
   int r;
   char *rp;
 
@@ -106,10 +199,10 @@ ident_handle_request (char *inbuf)
 
   r = 1;
   rp = ident_response;
-  while (rp < ident_response + COSERVER_BUFSIZE && r != 0)
+  while (rp < ident_response + COSERVER_BUFSIZE - 1 && r != 0)
     {
       if ((r = recv (sock, rp,
-                     COSERVER_BUFSIZE - (rp - ident_response), 0)) < 0)
+                     COSERVER_BUFSIZE - 1 - (rp - ident_response), 0)) < 0)
         {
           svz_log_net_error ("ident: recv");
           svz_closesocket (sock);
@@ -124,85 +217,234 @@ ident_handle_request (char *inbuf)
   if (svz_closesocket (sock) < 0)
     svz_log_net_error ("ident: close");
 
+  *rp = '\0';
   svz_log (SVZ_LOG_NOTICE, "ident: %s", ident_response);
 
-  p = ident_response;
-  p_end = p + strlen (p);
-
-  /* Parse client port.  */
-  if (p >= p_end || !(*p >= '0' && *p <= '9'))
+  if ((user = ident_parse_response (ident_response)) == NULL)
     return NULL;
-  while (p < p_end && *p >= '0' && *p <= '9')
-    p++;
+  sprintf (ident_response, "%s", user);
+  return ident_response;
+}
 
-  /* Skip whitespace and separating comma.  */
-  while (p < p_end && *p == ' ')
-    p++;
-  if (p >= p_end || *p != ',')
-    return NULL;
-  p++;
-  while (p < p_end && *p == ' ')
-    p++;
+/*
+ * An ident query done by the server itself.  It is either waiting for
+ * a free slot or in progress on the socket @code{sock}.
+ */
+typedef struct ident_query ident_query_t;
+struct ident_query
+{
+  ident_query_t *next;                        /* next query in list */
+  svz_socket_t *sock;                         /* connection to identd */
+  svz_address_t *addr;                        /* remote address */
+  in_port_t rport;                            /* remote port */
+  in_port_t lport;                            /* local port */
+  svz_coserver_handle_result_t handle_result; /* callback */
+  void *closure;                              /* its argument */
+};
 
-  /* Parse server port.  */
-  if (p >= p_end || !(*p >= '0' && *p <= '9'))
-    return NULL;
-  while (p < p_end && *p >= '0' && *p <= '9')
-    p++;
+/* Queries in progress and those waiting for one of them to finish.  */
+static ident_query_t *ident_running = NULL;
+static ident_query_t *ident_waiting = NULL;
+static ident_query_t *ident_waiting_tail = NULL;
+static int ident_queries = 0;
 
-  /* Skip whitespace and separating colon.  */
-  while (p < p_end && *p == ' ')
-    p++;
-  if (p >= p_end || *p != ':')
-    return NULL;
-  p++;
-  while (p < p_end && *p == ' ')
-    p++;
+static void ident_start (ident_query_t *);
 
-  /* Parse response type.  (USERID or ERROR possible) */
-  if (memcmp (p, "USERID", 6))
-    return NULL;
-  while (p < p_end && *p != ' ')
-    p++;
+static void
+ident_free (ident_query_t *query)
+{
+  svz_free (query->addr);
+  svz_free (query);
+}
 
-  /* Skip whitespace and separating colon.  */
-  while (p < p_end && *p == ' ')
-    p++;
-  if (p >= p_end || *p != ':')
-    return NULL;
-  p++;
-  while (p < p_end && *p == ' ')
-    p++;
-  if (p >= p_end)
-    return NULL;
+/*
+ * Finish the query of the ident connection @var{sock} passing
+ * @var{user} to its callback and start the next waiting queries.
+ */
+static void
+ident_finish (svz_socket_t *sock, char *user)
+{
+  ident_query_t *query = sock->data, **prev;
 
-  /* Parse OS type.  */
-  while (p < p_end && *p != ' ')
-    p++;
+  if (query == NULL)
+    return;
+  sock->data = NULL;
+  for (prev = &ident_running; *prev != query; prev = &(*prev)->next)
+    ;
+  *prev = query->next;
+  ident_queries--;
 
-  /* Skip whitespace and separating colon.  */
-  while (p < p_end && *p == ' ')
-    p++;
-  if (p >= p_end || *p != ':')
-    return NULL;
-  p++;
-  while (p < p_end && *p == ' ')
-    p++;
+  query->handle_result (user, query->closure);
+  ident_free (query);
 
-  /* Finally parse the user name.  */
-  u = user;
-  while (p < p_end && *p != '\0' && *p != '\n' && *p != '\r')
+  /* Starting a query may fail at once, so fill all free slots.  */
+  while (ident_waiting && ident_queries < IDENT_MAX_QUERIES)
     {
-      if (u < user + (sizeof (user) - 1))
-        *u++ = *p;
-      p++;
+      query = ident_waiting;
+      if ((ident_waiting = query->next) == NULL)
+        ident_waiting_tail = NULL;
+      ident_start (query);
     }
-  *u = '\0';
+}
 
-#if ENABLE_DEBUG
-  svz_log (SVZ_LOG_DEBUG, "ident: received identified user `%s'\n", user);
-#endif
+/*
+ * Parse the response received on the ident connection @var{sock}.
+ */
+static void
+ident_response (svz_socket_t *sock, int len)
+{
+  char response[COSERVER_BUFSIZE];
 
-  sprintf (ident_response, "%s", user);
-  return ident_response;
+  if (len > COSERVER_BUFSIZE - 1)
+    len = COSERVER_BUFSIZE - 1;
+  memcpy (response, sock->recv_buffer, len);
+  response[len] = '\0';
+  svz_log (SVZ_LOG_NOTICE, "ident: %s", response);
+  ident_finish (sock, ident_parse_response (response));
+}
+
+/*
+ * The @code{check_request} callback of an ident connection.  Wait for
+ * a full line.
+ */
+static int
+ident_check_request (svz_socket_t *sock)
+{
+  char *p;
+
+  if ((p = memchr (sock->recv_buffer, '\n', sock->recv_buffer_fill)) != NULL
+      || sock->recv_buffer_fill >= COSERVER_BUFSIZE - 1)
+    {
+      ident_response (sock, p ? p - sock->recv_buffer + 1
+                      : sock->recv_buffer_fill);
+      svz_sock_schedule_for_shutdown (sock);
+    }
+  return 0;
+}
+
+/*
+ * The @code{disconnected_socket} callback of an ident connection.  Make
+ * the best of what has been received so far.
+ */
+static int
+ident_disconnect (svz_socket_t *sock)
+{
+  if (sock->data && sock->recv_buffer_fill > 0)
+    ident_response (sock, sock->recv_buffer_fill);
+  ident_finish (sock, NULL);
+  return 0;
+}
+
+/*
+ * The @code{idle_func} of an ident connection.  Give up waiting.
+ */
+static int
+ident_timeout (svz_socket_t *sock)
+{
+  char buf[64];
+  ident_query_t *query = sock->data;
+
+  if (query)
+    svz_log (SVZ_LOG_ERROR, "ident: timeout (%s)\n",
+             SVZ_PP_ADDR (buf, query->addr));
+  svz_sock_schedule_for_shutdown (sock);
+  return 0;
+}
+
+/*
+ * Connect to the ident server for @var{query}.
+ */
+static void
+ident_start (ident_query_t *query)
+{
+  svz_socket_t *sock;
+
+  if ((sock = svz_tcp_connect (query->addr, htons (IDENT_PORT))) == NULL)
+    {
+      query->handle_result (NULL, query->closure);
+      ident_free (query);
+      return;
+    }
+
+  query->sock = sock;
+  query->next = ident_running;
+  ident_running = query;
+  ident_queries++;
+
+  sock->data = query;
+  sock->flags |= SVZ_SOFLG_NOFLOOD;
+  sock->check_request = ident_check_request;
+  sock->disconnected_socket = ident_disconnect;
+  sock->idle_func = ident_timeout;
+  sock->idle_counter = IDENT_TIMEOUT;
+  svz_sock_printf (sock, "%u , %u\r\n", query->rport, query->lport);
+}
+
+/*
+ * Ask the ident server at @var{addr} for the user owning the connection
+ * from its port @var{rport} to our port @var{lport} (both in network
+ * byte order).  Run @var{handle_result} with the user name (or
+ * @code{NULL}) and @var{closure} as soon as it is known.  This does not
+ * block: the query is done by the main loop.
+ */
+void
+ident_query (svz_address_t *addr, in_port_t rport, in_port_t lport,
+             svz_coserver_handle_result_t handle_result, void *closure)
+{
+  ident_query_t *query;
+
+  /* Only IPv4 connections can be queried so far.  */
+  if (svz_address_family (addr) != AF_INET)
+    {
+      handle_result (NULL, closure);
+      return;
+    }
+
+  query = svz_malloc (sizeof (ident_query_t));
+  query->next = NULL;
+  query->sock = NULL;
+  query->addr = svz_address_copy (addr);
+  query->rport = ntohs (rport);
+  query->lport = ntohs (lport);
+  query->handle_result = handle_result;
+  query->closure = closure;
+
+  if (ident_waiting == NULL && ident_queries < IDENT_MAX_QUERIES)
+    {
+      ident_start (query);
+      return;
+    }
+
+  /* Too many queries in progress, wait behind the others.  */
+  if (ident_waiting_tail)
+    ident_waiting_tail->next = query;
+  else
+    ident_waiting = query;
+  ident_waiting_tail = query;
+}
+
+/*
+ * Abort all ident queries, passing @code{NULL} to their callbacks.
+ */
+void
+ident_finalize (void)
+{
+  ident_query_t *query;
+
+  while ((query = ident_running) != NULL)
+    {
+      ident_running = query->next;
+      ident_queries--;
+      query->sock->data = NULL;
+      svz_sock_schedule_for_shutdown (query->sock);
+      query->handle_result (NULL, query->closure);
+      ident_free (query);
+    }
+  while ((query = ident_waiting) != NULL)
+    {
+      if ((ident_waiting = query->next) == NULL)
+        ident_waiting_tail = NULL;
+      query->handle_result (NULL, query->closure);
+      ident_free (query);
+    }
 }
@@ -22,10 +22,15 @@
 #define __IDENT_H__ 1
 
 #include "libserveez/defines.h"
+#include "libserveez/address.h"
+#include "libserveez/coserver/coserver.h"
 
 __BEGIN_DECLS
 
 SBO char *ident_handle_request (char *);
+SBO void ident_query (svz_address_t *, in_port_t, in_port_t,
+                      svz_coserver_handle_result_t, void *);
+SBO void ident_finalize (void);
 
 __END_DECLS
 
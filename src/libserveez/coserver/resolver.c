@@ -0,0 +1,430 @@
+/*
+ * resolver.c - threaded DNS and reverse DNS lookups
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this package.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#include "networking-headers.h"
+
+#if ENABLE_RESOLVER_THREADS
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netdb.h>
+# include <signal.h>
+# include <pthread.h>
+# if HAVE_SYS_EVENTFD_H
+#  include <sys/eventfd.h>
+# endif
+#endif /* ENABLE_RESOLVER_THREADS */
+
+#include "unused.h"
+
+#include "libserveez/alloc.h"
+#include "libserveez/util.h"
+#include "libserveez/core.h"
+#include "libserveez/socket.h"
+#include "libserveez/server-core.h"
+#include "libserveez/coserver/coserver.h"
+#include "libserveez/coserver/resolver.h"
+
+#if ENABLE_RESOLVER_THREADS
+
+/* Number of lookups which can be in flight at once.  */
+#define RESOLVER_THREADS 4
+
+/*
+ * A single lookup.  It is passed from the main loop to one of the
+ * resolver threads and back again.
+ */
+typedef struct resolver_job resolver_job_t;
+struct resolver_job
+{
+  resolver_job_t *next;                       /* next job in list */
+  int type;                                   /* coserver type id */
+  int error;                                  /* ‘getaddrinfo’ error code */
+  char request[COSERVER_BUFSIZE];             /* host name or address */
+  char result[COSERVER_BUFSIZE];              /* empty on failure */
+  svz_coserver_handle_result_t handle_result; /* callback */
+  void *closure;                              /* its argument */
+};
+
+/* Coserver types handled by the threads (bit mask).  */
+static int resolver_types = 0;
+
+/* The threads and the condition they wait on for new jobs.  */
+static pthread_t resolver_thread[RESOLVER_THREADS];
+static int resolver_threads = 0;
+static pthread_mutex_t resolver_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolver_cond = PTHREAD_COND_INITIALIZER;
+static int resolver_quit = 0;
+
+/* Pending jobs in order of submission, protected by ‘resolver_lock’.  */
+static resolver_job_t *resolver_head = NULL;
+static resolver_job_t *resolver_tail = NULL;
+
+/* Finished jobs, most recent first.  The threads push onto this list
+   without locking, the main loop takes it over as a whole.  */
+static resolver_job_t *resolver_done = NULL;
+
+/* Descriptors waking up the main loop: an eventfd (used twice) or the
+   two ends of a pipe.  */
+static int resolver_wake[2] = { -1, -1 };
+static svz_socket_t *resolver_sock = NULL;
+
+/*
+ * Resolve the host name or dotted decimal address of @var{job} depending
+ * on its type.  Runs in one of the resolver threads and thus must not
+ * touch anything but @var{job}.
+ */
+static void
+resolver_lookup (resolver_job_t *job)
+{
+  struct addrinfo hints, *res;
+  struct sockaddr_in addr;
+
+  job->result[0] = '\0';
+  if (job->type == SVZ_COSERVER_DNS)
+    {
+      memset (&hints, 0, sizeof (hints));
+      hints.ai_family = AF_INET;
+      hints.ai_socktype = SOCK_STREAM;
+      if ((job->error = getaddrinfo (job->request, NULL, &hints, &res)) != 0)
+        return;
+      if (inet_ntop (AF_INET,
+                     &((struct sockaddr_in *) res->ai_addr)->sin_addr,
+                     job->result, sizeof (job->result)) == NULL)
+        job->result[0] = '\0';
+      freeaddrinfo (res);
+    }
+  else
+    {
+      memset (&addr, 0, sizeof (addr));
+      addr.sin_family = AF_INET;
+      if (inet_pton (AF_INET, job->request, &addr.sin_addr) != 1)
+        {
+          job->error = EAI_NONAME;
+          return;
+        }
+      job->error = getnameinfo ((struct sockaddr *) &addr, sizeof (addr),
+                                job->result, sizeof (job->result),
+                                NULL, 0, NI_NAMEREQD);
+      if (job->error != 0)
+        job->result[0] = '\0';
+    }
+}
+
+/*
+ * The resolver thread routine.  Take jobs off the pending list, process
+ * them and pass them back to the main loop until ‘svz_resolver_stop’
+ * says otherwise.
+ */
+static void *
+resolver_thread_loop (UNUSED void *arg)
+{
+  resolver_job_t *job;
+  uint64_t one = 1;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&resolver_lock);
+      while (resolver_head == NULL && !resolver_quit)
+        pthread_cond_wait (&resolver_cond, &resolver_lock);
+      if (resolver_quit)
+        {
+          pthread_mutex_unlock (&resolver_lock);
+          break;
+        }
+      job = resolver_head;
+      if ((resolver_head = job->next) == NULL)
+        resolver_tail = NULL;
+      pthread_mutex_unlock (&resolver_lock);
+
+      resolver_lookup (job);
+
+      /* Push the result and wake up the main loop if it has not been
+         woken up for earlier results already.  */
+      job->next = __atomic_load_n (&resolver_done, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n (&resolver_done, &job->next, job, 1,
+                                           __ATOMIC_RELEASE,
+                                           __ATOMIC_RELAXED))
+        ;
+      if (job->next == NULL)
+        if (write (resolver_wake[SVZ_WRITE], &one, sizeof (one)) < 0)
+          continue;
+    }
+  return NULL;
+}
+
+/*
+ * The @code{read_socket} callback of the resolver's wake-up descriptor.
+ * Run the callbacks of all finished lookups in the order they finished.
+ */
+static int
+resolver_read_socket (svz_socket_t *sock)
+{
+  resolver_job_t *job, *list = NULL, *next;
+  uint64_t count;
+
+  /* Reset the descriptor.  A pipe might hold more than one event.  */
+  while (read (sock->pipe_desc[SVZ_READ], &count, sizeof (count)) > 0)
+    if (resolver_wake[SVZ_READ] == resolver_wake[SVZ_WRITE])
+      break;
+
+  /* Take over the finished jobs and restore their order.  */
+  job = __atomic_exchange_n (&resolver_done, NULL, __ATOMIC_ACQUIRE);
+  for (; job != NULL; job = next)
+    {
+      next = job->next;
+      job->next = list;
+      list = job;
+    }
+
+  for (job = list; job != NULL; job = next)
+    {
+      next = job->next;
+      if (job->result[0])
+        {
+#if ENABLE_DEBUG
+          svz_log (SVZ_LOG_DEBUG, "%s: %s is %s\n",
+                   job->type == SVZ_COSERVER_DNS ? "dns" : "reverse dns",
+                   job->request, job->result);
+#endif /* ENABLE_DEBUG */
+        }
+      else
+        svz_log (SVZ_LOG_ERROR, "%s: %s (%s)\n",
+                 job->type == SVZ_COSERVER_DNS ? "dns" : "reverse dns",
+                 job->error ? gai_strerror (job->error) : "no address",
+                 job->request);
+      job->handle_result (job->result[0] ? job->result : NULL, job->closure);
+      svz_free (job);
+    }
+  return 0;
+}
+
+/*
+ * Create the descriptors waking up the main loop and the socket
+ * structure watching them.  Return zero on success.
+ */
+static int
+resolver_wake_create (void)
+{
+#if HAVE_SYS_EVENTFD_H
+  if ((resolver_wake[SVZ_READ] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+      svz_log_sys_error ("resolver: eventfd");
+      return -1;
+    }
+  resolver_wake[SVZ_WRITE] = resolver_wake[SVZ_READ];
+#else /* not HAVE_SYS_EVENTFD_H */
+  if (pipe (resolver_wake) < 0)
+    {
+      svz_log_sys_error ("resolver: pipe");
+      return -1;
+    }
+  if (svz_fd_nonblock (resolver_wake[SVZ_READ])
+      || svz_fd_nonblock (resolver_wake[SVZ_WRITE])
+      || svz_fd_cloexec (resolver_wake[SVZ_READ])
+      || svz_fd_cloexec (resolver_wake[SVZ_WRITE]))
+    {
+      close (resolver_wake[SVZ_READ]);
+      close (resolver_wake[SVZ_WRITE]);
+      resolver_wake[SVZ_READ] = resolver_wake[SVZ_WRITE] = -1;
+      return -1;
+    }
+#endif /* not HAVE_SYS_EVENTFD_H */
+
+  if ((resolver_sock = svz_sock_alloc ()) == NULL)
+    return -1;
+  svz_sock_unique_id (resolver_sock);
+  resolver_sock->pipe_desc[SVZ_READ] = resolver_wake[SVZ_READ];
+  resolver_sock->flags |= (SVZ_SOFLG_RECV_PIPE | SVZ_SOFLG_CONNECTED |
+                           SVZ_SOFLG_NOFLOOD | SVZ_SOFLG_COSERVER);
+  resolver_sock->read_socket = resolver_read_socket;
+  svz_sock_enqueue (resolver_sock);
+  return 0;
+}
+
+/*
+ * Let the resolver threads handle the requests for the coserver type
+ * @var{type} (either @code{SVZ_COSERVER_DNS} or
+ * @code{SVZ_COSERVER_REVERSE_DNS}), starting them if necessary.  Return
+ * zero on success and non-zero if the coserver processes should be used
+ * instead.
+ */
+int
+svz_resolver_start (int type)
+{
+  sigset_t all, old;
+  int n;
+
+  if (type != SVZ_COSERVER_DNS && type != SVZ_COSERVER_REVERSE_DNS)
+    return -1;
+
+  if (resolver_threads == 0)
+    {
+      if (resolver_wake_create ())
+        return -1;
+
+      /* Leave signal handling to the main thread.  */
+      resolver_quit = 0;
+      sigfillset (&all);
+      pthread_sigmask (SIG_SETMASK, &all, &old);
+      for (n = 0; n < RESOLVER_THREADS; n++)
+        {
+          if (pthread_create (&resolver_thread[n], NULL,
+                              resolver_thread_loop, NULL) != 0)
+            break;
+          resolver_threads++;
+        }
+      pthread_sigmask (SIG_SETMASK, &old, NULL);
+
+      if (resolver_threads == 0)
+        {
+          svz_log (SVZ_LOG_ERROR, "resolver: cannot create threads\n");
+          svz_resolver_stop ();
+          return -1;
+        }
+      svz_log (SVZ_LOG_NOTICE, "started %d resolver threads\n",
+               resolver_threads);
+    }
+
+  resolver_types |= (1 << type);
+  return 0;
+}
+
+/*
+ * Return non-zero if requests of the coserver type @var{type} are
+ * handled by the resolver threads.
+ */
+int
+svz_resolver_handles (int type)
+{
+  return resolver_types & (1 << type);
+}
+
+/*
+ * Pass the @var{request} for the coserver type @var{type} to the resolver
+ * threads.  @var{handle_result} is run with @var{closure} as soon as
+ * it has been processed.  Return non-zero if the resolver threads do not
+ * handle this type of requests.
+ */
+int
+svz_resolver_submit (int type, const char *request,
+                     svz_coserver_handle_result_t handle_result,
+                     void *closure)
+{
+  resolver_job_t *job;
+
+  if (!svz_resolver_handles (type))
+    return -1;
+
+  job = svz_malloc (sizeof (resolver_job_t));
+  job->next = NULL;
+  job->type = type;
+  job->error = 0;
+  snprintf (job->request, sizeof (job->request), "%s", request);
+  job->handle_result = handle_result;
+  job->closure = closure;
+
+  pthread_mutex_lock (&resolver_lock);
+  if (resolver_tail)
+    resolver_tail->next = job;
+  else
+    resolver_head = job;
+  resolver_tail = job;
+  pthread_cond_signal (&resolver_cond);
+  pthread_mutex_unlock (&resolver_lock);
+  return 0;
+}
+
+/*
+ * Stop the resolver threads and drop all lookups not yet delivered.
+ */
+void
+svz_resolver_stop (void)
+{
+  resolver_job_t *job, *next;
+
+  pthread_mutex_lock (&resolver_lock);
+  resolver_quit = 1;
+  pthread_cond_broadcast (&resolver_cond);
+  pthread_mutex_unlock (&resolver_lock);
+  while (resolver_threads > 0)
+    pthread_join (resolver_thread[--resolver_threads], NULL);
+
+  for (job = resolver_head; job != NULL; job = next)
+    {
+      next = job->next;
+      svz_free (job);
+    }
+  resolver_head = resolver_tail = NULL;
+  for (job = resolver_done; job != NULL; job = next)
+    {
+      next = job->next;
+      svz_free (job);
+    }
+  resolver_done = NULL;
+
+  /* The socket structure closes the receiving end.  */
+  if (resolver_sock)
+    {
+      resolver_sock->read_socket = NULL;
+      svz_sock_schedule_for_shutdown (resolver_sock);
+      resolver_sock = NULL;
+    }
+  else if (resolver_wake[SVZ_READ] != -1)
+    close (resolver_wake[SVZ_READ]);
+  if (resolver_wake[SVZ_WRITE] != resolver_wake[SVZ_READ])
+    close (resolver_wake[SVZ_WRITE]);
+  resolver_wake[SVZ_READ] = resolver_wake[SVZ_WRITE] = -1;
+  resolver_types = 0;
+}
+
+#else /* not ENABLE_RESOLVER_THREADS */
+
+int
+svz_resolver_start (UNUSED int type)
+{
+  return -1;
+}
+
+int
+svz_resolver_handles (UNUSED int type)
+{
+  return 0;
+}
+
+int
+svz_resolver_submit (UNUSED int type, UNUSED const char *request,
+                     UNUSED svz_coserver_handle_result_t handle_result,
+                     UNUSED void *closure)
+{
+  return -1;
+}
+
+void
+svz_resolver_stop (void)
+{
+}
+
+#endif /* not ENABLE_RESOLVER_THREADS */
@@ -0,0 +1,34 @@
+/*
+ * resolver.h - threaded DNS resolver header definitions
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this package.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RESOLVER_H__
+#define __RESOLVER_H__ 1
+
+#include "libserveez/defines.h"
+#include "libserveez/coserver/coserver.h"
+
+__BEGIN_DECLS
+
+SBO int svz_resolver_start (int);
+SBO int svz_resolver_handles (int);
+SBO int svz_resolver_submit (int, const char *,
+                             svz_coserver_handle_result_t, void *);
+SBO void svz_resolver_stop (void);
+
+__END_DECLS
+
+#endif /* not __RESOLVER_H__ */
@@ -41,30 +41,6 @@
 #include "libserveez/coserver/reverse-dns.h"
 #include "libserveez/coserver/xerror.h"
 
-#define MAX_CACHE_ENTRIES 1024 /* nslookup cache entries */
-
-/*
- * Reverse DNS lookup cache structure.
- */
-typedef struct
-{
-  int entries;
-  in_addr_t ip[MAX_CACHE_ENTRIES];
-  char resolved[COSERVER_BUFSIZE][MAX_CACHE_ENTRIES];
-}
-reverse_dns_cache_t;
-
-static reverse_dns_cache_t reverse_dns_cache;
-
-/*
- * Initialize the cache structure.
- */
-void
-reverse_dns_init (void)
-{
-  reverse_dns_cache.entries = 0;
-}
-
 #define MAX_IP_STRING_LENGTH  15        /* www.xxx.yyy.zzz */
 
 /*
@@ -77,25 +53,12 @@ reverse_dns_handle_request (char *inbuf)
   in_addr_t addr[2];
   struct hostent *host;
   static char resolved[COSERVER_BUFSIZE];
-  int n;
 
   if ((1 == sscanf (inbuf, PERCENT_N_S (MAX_IP_STRING_LENGTH), ip)))
     {
       svz_pton (ip, &addr[0]);
       addr[1] = 0;
 
-      /*
-       * look up the ip->host cache first
-       */
-      for (n = 0; n < reverse_dns_cache.entries; n++)
-        {
-          if (reverse_dns_cache.ip[n] == addr[0])
-            {
-              sprintf (resolved, "%s", reverse_dns_cache.resolved[n]);
-              return resolved;
-            }
-        }
-
       if ((host = gethostbyaddr ((char *) addr, sizeof (addr[0]), AF_INET))
           == NULL)
         {
@@ -105,13 +68,6 @@ reverse_dns_handle_request (char *inbuf)
         }
       else
         {
-          if (n < MAX_CACHE_ENTRIES)
-            {
-              strcpy (reverse_dns_cache.resolved[n], host->h_name);
-              reverse_dns_cache.ip[n] = addr[0];
-              reverse_dns_cache.entries++;
-            }
-
 #if ENABLE_DEBUG
           svz_log (SVZ_LOG_DEBUG, "reverse dns: %s is %s\n", ip, host->h_name);
 #endif /* ENABLE_DEBUG */
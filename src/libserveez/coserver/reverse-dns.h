@@ -25,7 +25,6 @@
 
 __BEGIN_DECLS
 
-SBO void reverse_dns_init (void);
 SBO char *reverse_dns_handle_request (char *);
 
 __END_DECLS
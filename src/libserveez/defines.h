@@ -93,6 +93,9 @@ typedef struct
 
   int nclient_max;
   /* Maxium number of clients allowed to connect.  */
+
+  int ncoserver_max;
+  /* Maximum number of instances of each coserver type.  */
 } svz_private_t;
 
 __BEGIN_DECLS
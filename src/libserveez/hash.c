@@ -369,8 +369,8 @@ svz_hash_rehash (svz_hash_t *hash, int type)
                     hash->fill++;
                 }
               svz_free (bucket->entry);
+              hash->fill--;
             }
-          hash->fill--;
         }
       hash->table = svz_realloc (hash->table,
                                  sizeof (svz_hash_bucket_t) * hash->buckets);
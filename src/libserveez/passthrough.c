@@ -53,6 +53,7 @@
 #else
 # include <sys/types.h>
 # include <sys/socket.h>
+# include <fcntl.h>
 #endif
 
 #include "libserveez/alloc.h"
@@ -61,6 +62,7 @@
 #include "libserveez/core.h"
 #include "libserveez/server-core.h"
 #include "libserveez/pipe-socket.h"
+#include "libserveez/tcp-socket.h"
 #include "libserveez/passthrough.h"
 #include "misc-macros.h"
 
@@ -69,6 +71,14 @@
 #define SVZ_PROCESS_SHUFFLE_SOCK 2
 #define SVZ_PROCESS_SHUFFLE_PIPE 3
 
+/* Capacity of the pipes to and from shuffled child processes.  */
+#define SVZ_PROCESS_PIPE_SIZE    (1024 * 1024)
+
+#ifdef F_SETPIPE_SZ
+/* Set once the failure to resize the pipes has been reported.  */
+static int svz_process_pipe_size_warned = 0;
+#endif
+
 struct svz_process_t
 {
   svz_socket_t *sock;   /* Socket structure to pass through.  */
@@ -232,6 +242,36 @@ svz_process_send_update (svz_socket_t *sock, int set)
   return 0;
 }
 
+/*
+ * The @code{high_water} callback of both the passthrough connection and
+ * its shuffle socket structure @var{sock}.  Stop reading data from the
+ * referrer until @var{sock} has sent most of what it holds.
+ */
+static int
+svz_process_high_water (svz_socket_t *sock)
+{
+  svz_socket_t *xsock;
+
+  if ((xsock = svz_sock_getreferrer (sock)) != NULL)
+    svz_sock_pause_read (xsock);
+  return 0;
+}
+
+/*
+ * The @code{low_water} callback of both the passthrough connection and
+ * its shuffle socket structure @var{sock}.  Continue reading data from the
+ * referrer.
+ */
+static int
+svz_process_low_water (svz_socket_t *sock)
+{
+  svz_socket_t *xsock;
+
+  if ((xsock = svz_sock_getreferrer (sock)) != NULL)
+    svz_sock_resume_read (xsock);
+  return 0;
+}
+
 /*
  * This is the shuffle socket pair writer which is directly connected with
  * the reading end of the child process.  It writes as much data as possible
@@ -312,9 +352,12 @@ svz_process_recv_socket (svz_socket_t *sock)
   if (svz_process_recv_update (sock, 1))
     return -1;
 
-  /* return here if there is nothing to do */
+  /* wait for the referrer to send some data if there is no room */
   if ((do_read = sock->recv_buffer_size - sock->recv_buffer_fill) <= 0)
-    return 0;
+    {
+      svz_sock_pause_read (sock);
+      return 0;
+    }
 
   if ((num_read = recv (sock->sock_desc,
                         sock->recv_buffer + sock->recv_buffer_fill,
@@ -329,6 +372,7 @@ svz_process_recv_socket (svz_socket_t *sock)
       sock->last_recv = time (NULL);
       sock->recv_buffer_fill += num_read;
       svz_process_recv_update (sock, 0);
+      svz_sock_check_water (svz_sock_getreferrer (sock));
     }
   else
     svz_log (SVZ_LOG_ERROR, "passthrough: recv: no data on socket %d\n",
@@ -397,9 +441,12 @@ svz_process_recv_pipe (svz_socket_t *sock)
   if (svz_process_recv_update (sock, 1))
     return -1;
 
-  /* return here if there is nothing to do */
+  /* wait for the referrer to send some data if there is no room */
   if ((do_read = sock->recv_buffer_size - sock->recv_buffer_fill) <= 0)
-    return 0;
+    {
+      svz_sock_pause_read (sock);
+      return 0;
+    }
 
 #ifndef __MINGW32__
   if ((num_read = read ((int) sock->pipe_desc[SVZ_READ],
@@ -433,11 +480,101 @@ svz_process_recv_pipe (svz_socket_t *sock)
       sock->last_recv = time (NULL);
       sock->recv_buffer_fill += num_read;
       svz_process_recv_update (sock, 0);
+      svz_sock_check_water (svz_sock_getreferrer (sock));
     }
 
   return (num_read > 0) ? 0 : -1;
 }
 
+#if HAVE_SPLICE
+
+/*
+ * This is the shuffle pipe reader used for TCP connections.  It moves the
+ * output of the child process straight into the connection's socket
+ * without copying it to user space.  Whatever the socket does not take at
+ * once goes through the send buffer of the connection as usual.
+ */
+static int
+svz_process_splice_pipe (svz_socket_t *sock)
+{
+  svz_socket_t *xsock;
+  ssize_t num;
+
+  if ((xsock = svz_sock_getreferrer (sock)) == NULL)
+    return -1;
+
+  /* keep the byte order when there is still data queued */
+  if (xsock->send_buffer_fill == 0 && !xsock->send_codec
+      && !(xsock->flags & SVZ_SOFLG_KILLED))
+    {
+      num = splice ((int) sock->pipe_desc[SVZ_READ], NULL,
+                    xsock->sock_desc, NULL, SVZ_PROCESS_PIPE_SIZE,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (num > 0)
+        {
+          sock->last_recv = xsock->last_send = time (NULL);
+          return 0;
+        }
+      if (num == -1)
+        {
+          if (errno == EINVAL || errno == ENOSYS)
+            sock->read_socket = svz_process_recv_pipe;
+          else if (errno != EAGAIN)
+            {
+              svz_log_sys_error ("passthrough: splice");
+              return -1;
+            }
+        }
+    }
+  return svz_process_recv_pipe (sock);
+}
+
+/*
+ * The @code{read_socket} callback of TCP connections passed through to
+ * a child process via pipes.  It moves the incoming data straight into the
+ * pipe to the child's stdin unless there is still data queued for it.
+ */
+static int
+svz_process_splice_socket (svz_socket_t *sock)
+{
+  svz_socket_t *xsock;
+  ssize_t num;
+
+  xsock = svz_sock_getreferrer (sock);
+  if (xsock && sock->recv_buffer_fill == 0 && !sock->recv_codec)
+    {
+      num = splice (sock->sock_desc, NULL,
+                    (int) xsock->pipe_desc[SVZ_WRITE], NULL,
+                    SVZ_PROCESS_PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (num > 0)
+        {
+          sock->last_recv = xsock->last_send = time (NULL);
+#if ENABLE_FLOOD_PROTECTION
+          if (svz_sock_flood_protect (sock, num))
+            {
+              svz_log (SVZ_LOG_ERROR, "kicked socket %d (flood)\n",
+                       sock->sock_desc);
+              return -1;
+            }
+#endif /* ENABLE_FLOOD_PROTECTION */
+          return 0;
+        }
+      if (num == -1)
+        {
+          if (errno == EINVAL || errno == ENOSYS)
+            sock->read_socket = svz_tcp_read_socket;
+          else if (errno != EAGAIN)
+            {
+              svz_log_net_error ("passthrough: splice");
+              return -1;
+            }
+        }
+    }
+  return svz_tcp_read_socket (sock);
+}
+
+#endif /* HAVE_SPLICE */
+
 /*
  * Disconnection routine for the socket connection @var{sock} which is
  * connected with a process's stdin/stdout via the referring passthrough
@@ -474,7 +611,7 @@ svz_process_check_request (svz_socket_t *sock)
   if ((xsock = svz_sock_getreferrer (sock)) == NULL)
     return -1;
   xsock->send_buffer_fill = sock->recv_buffer_fill;
-  return 0;
+  return svz_sock_check_water (xsock);
 }
 
 #ifdef __MINGW32__
@@ -594,6 +731,19 @@ svz_process_shuffle (svz_process_t *proc)
         return -1;
       if (svz_pipe_create_pair (serveez_to_process) == -1)
         return -1;
+#ifdef F_SETPIPE_SZ
+      /* pass more data per system call */
+      if ((fcntl ((int) process_to_serveez[SVZ_READ], F_SETPIPE_SZ,
+                  SVZ_PROCESS_PIPE_SIZE) == -1
+           || fcntl ((int) serveez_to_process[SVZ_WRITE], F_SETPIPE_SZ,
+                     SVZ_PROCESS_PIPE_SIZE) == -1)
+          && !svz_process_pipe_size_warned)
+        {
+          svz_log (SVZ_LOG_WARNING, "passthrough: cannot resize pipes: %s\n",
+                   svz_sys_strerror ());
+          svz_process_pipe_size_warned = 1;
+        }
+#endif /* F_SETPIPE_SZ */
       /* create yet another socket structure */
       if ((xsock = svz_pipe_create (process_to_serveez[SVZ_READ],
                                     serveez_to_process[SVZ_WRITE])) == NULL)
@@ -615,6 +765,16 @@ svz_process_shuffle (svz_process_t *proc)
     {
       xsock->write_socket = svz_process_send_pipe;
       xsock->read_socket = svz_process_recv_pipe;
+#if HAVE_SPLICE
+      /* relay TCP connections in the kernel */
+      if (proc->sock->flags & SVZ_SOFLG_SOCK
+          && proc->sock->proto & SVZ_PROTO_TCP)
+        {
+          xsock->read_socket = svz_process_splice_pipe;
+          if (proc->sock->read_socket == svz_tcp_read_socket)
+            proc->sock->read_socket = svz_process_splice_socket;
+        }
+#endif /* HAVE_SPLICE */
     }
 
   /* release receive and send buffers of the new socket structure */
@@ -631,6 +791,14 @@ svz_process_shuffle (svz_process_t *proc)
   proc->sock->disconnected_socket = svz_process_disconnect;
   proc->sock->check_request = svz_process_check_request;
 
+  /* let each side of the shared buffers throttle the one filling them */
+  proc->sock->high_water = xsock->high_water = svz_process_high_water;
+  proc->sock->low_water = xsock->low_water = svz_process_low_water;
+  svz_sock_setwater (proc->sock, proc->sock->send_buffer_size / 4,
+                     proc->sock->send_buffer_size * 3 / 4);
+  svz_sock_setwater (xsock, proc->sock->recv_buffer_size / 4,
+                     proc->sock->recv_buffer_size * 3 / 4);
+
   /* enqueue the new passthrough pipe socket */
   if (svz_sock_enqueue (xsock) < 0)
     return -1;
@@ -730,7 +898,10 @@ svz_process_fork (svz_process_t *proc)
  * If non-zero, pipe descriptors or the socket descriptor are passed to the
  * child process directly through @code{fork} and @code{exec}.  Otherwise,
  * socket transactions are passed via a pair or pipes or sockets (depending
- * on whether or not the system provides @code{socketpair}).
+ * on whether or not the system provides @code{socketpair}).  As an
+ * exception, @code{SVZ_PROCESS_SPLICE} passes TCP connections via two
+ * pairs of pipes, moving the data with @code{splice} where possible.
+ * Use it only for programs which do not need a socket on their stdin.
  *
  * You can pass the user and group identifications in the format
  * @samp{user[.group]} (group is optional), as @code{SVZ_PROCESS_NONE} or
@@ -777,7 +948,7 @@ svz_sock_process (svz_socket_t *sock, char *bin, char *dir,
   proc.argv = argv;
   proc.envp = envp;
   proc.user = user;
-  proc.flag = forkp
+  proc.flag = forkp && forkp != SVZ_PROCESS_SPLICE
     ? SVZ_PROCESS_FORK
     :
 #if HAVE_SOCKETPAIR
@@ -787,6 +958,14 @@ svz_sock_process (svz_socket_t *sock, char *bin, char *dir,
 #endif
     ;
 
+#if HAVE_SPLICE
+  /* Pipes let TCP connections exchange data with the child without
+     copying it to user space, if the child can do with them.  */
+  if (forkp == SVZ_PROCESS_SPLICE && proc.flag == SVZ_PROCESS_SHUFFLE_SOCK
+      && sock->flags & SVZ_SOFLG_SOCK && sock->proto & SVZ_PROTO_TCP)
+    proc.flag = SVZ_PROCESS_SHUFFLE_PIPE;
+#endif
+
   /* Depending on the given flag use different methods to passthrough
      the connection.  */
   switch (proc.flag)
@@ -38,6 +38,10 @@ svz_envblock_t;
 #define SVZ_PROCESS_NONE  ((char *) 0L)
 #define SVZ_PROCESS_OWNER ((char *) ~0L)
 
+/* Value of the @var{forkp} argument of @code{svz_sock_process} which
+   shuffles TCP connections through pipes using @code{splice}.  */
+#define SVZ_PROCESS_SPLICE 2
+
 __BEGIN_DECLS
 
 SERVEEZ_API int svz_sock_process (svz_socket_t *, char *, char *,
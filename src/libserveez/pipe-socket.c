@@ -425,6 +425,9 @@ svz_pipe_read_socket (svz_socket_t *sock)
   /* Read as much space is left in the receive buffer and return
    * zero if there is no more space.  */
   do_read = sock->recv_buffer_size - sock->recv_buffer_fill;
+  if (do_read <= 0
+      && svz_sock_grow_recv (sock, sock->recv_buffer_fill + 1) == 0)
+    do_read = sock->recv_buffer_size - sock->recv_buffer_fill;
   if (do_read <= 0)
     {
       svz_log (SVZ_LOG_ERROR, "receive buffer overflow on pipe %d\n",
@@ -765,12 +765,28 @@ svz_portcfg_mkaddr (svz_portcfg_t *this)
 void
 svz_portcfg_prepare (svz_portcfg_t *port)
 {
-  /* Check the TCP backlog value.  */
+  /* Check the TCP backlog, budget and tuning values.  */
   if (port->proto & SVZ_PROTO_TCP)
     {
       if (SVZ_CFG_TCP (port, backlog) <= 0
           || SVZ_CFG_TCP (port, backlog) > SOMAXCONN)
         SVZ_CFG_TCP (port, backlog) = SOMAXCONN;
+      if (SVZ_CFG_TCP (port, read_budget) < 0)
+        SVZ_CFG_TCP (port, read_budget) = 0;
+      if (SVZ_CFG_TCP (port, write_budget) < 0)
+        SVZ_CFG_TCP (port, write_budget) = 0;
+      if (SVZ_CFG_TCP (port, defer_accept) < 0)
+        SVZ_CFG_TCP (port, defer_accept) = 0;
+      if (SVZ_CFG_TCP (port, fastopen) < 0)
+        SVZ_CFG_TCP (port, fastopen) = 0;
+      if (SVZ_CFG_TCP (port, rcvbuf) < 0)
+        SVZ_CFG_TCP (port, rcvbuf) = 0;
+      if (SVZ_CFG_TCP (port, sndbuf) < 0)
+        SVZ_CFG_TCP (port, sndbuf) = 0;
+      if (SVZ_CFG_TCP (port, notsent_lowat) < 0)
+        SVZ_CFG_TCP (port, notsent_lowat) = 0;
+      if (SVZ_CFG_TCP (port, zerocopy) < 0)
+        SVZ_CFG_TCP (port, zerocopy) = 0;
     }
   /* Check the detection barriers for pipe and tcp sockets.  */
   if (port->proto & (SVZ_PROTO_PIPE | SVZ_PROTO_TCP))
@@ -803,6 +819,17 @@ svz_portcfg_prepare (svz_portcfg_t *port)
       else if (port->proto & (SVZ_PROTO_ICMP | SVZ_PROTO_RAW))
         port->recv_buffer_size = ICMP_BUF_SIZE;
     }
+  /* Check the buffer size limits, which only make sense for streams.  */
+  if (!(port->proto & (SVZ_PROTO_TCP | SVZ_PROTO_PIPE))
+      || port->send_buffer_limit <= port->send_buffer_size)
+    port->send_buffer_limit = 0;
+  else if (port->send_buffer_limit > MAX_BUF_SIZE)
+    port->send_buffer_limit = MAX_BUF_SIZE;
+  if (!(port->proto & (SVZ_PROTO_TCP | SVZ_PROTO_PIPE))
+      || port->recv_buffer_limit <= port->recv_buffer_size)
+    port->recv_buffer_limit = 0;
+  else if (port->recv_buffer_limit > MAX_BUF_SIZE)
+    port->recv_buffer_limit = MAX_BUF_SIZE;
   /* Check the connection frequency.  */
   if (port->connect_freq <= 0)
     {
@@ -71,6 +71,14 @@ typedef struct svz_portcfg
       struct sockaddr_in addr; /* converted from the above 2 values */
       char *device;            /* network device */
       int backlog;             /* backlog argument for ‘listen’ */
+      int read_budget;         /* bytes read per event on connections */
+      int write_budget;        /* bytes written per event on connections */
+      int defer_accept;        /* seconds to wait for data on ‘accept’ */
+      int fastopen;            /* TCP fast open queue length */
+      int rcvbuf;              /* kernel receive buffer size */
+      int sndbuf;              /* kernel send buffer size */
+      int notsent_lowat;       /* limit of unsent bytes in the kernel */
+      int zerocopy;            /* minimum size of zero-copy sends */
     } tcp;
 
     /* udp port */
@@ -118,6 +126,10 @@ typedef struct svz_portcfg
   int send_buffer_size;
   int recv_buffer_size;
 
+  /* maximum buffer sizes (adaptive buffers) */
+  int send_buffer_limit;
+  int recv_buffer_limit;
+
   /* allowed number of connects per second (hammer protection) */
   int connect_freq;
 
@@ -70,6 +70,7 @@
 #include "libserveez/socket.h"
 #include "libserveez/core.h"
 #include "libserveez/pipe-socket.h"
+#include "libserveez/tcp-socket.h"
 #include "libserveez/portcfg.h"
 #include "libserveez/interface.h"
 #include "libserveez/coserver/coserver.h"
@@ -942,6 +943,8 @@ svz_periodic_tasks (void)
         }
 #endif /* ENABLE_FLOOD_PROTECTION */
 
+      svz_sock_shrink_buffers (sock);
+
       if (sock->idle_func && sock->idle_counter > 0)
         {
           if (--sock->idle_counter <= 0)
@@ -962,6 +965,9 @@ svz_periodic_tasks (void)
      alive */
   svz_coserver_check ();
 
+  /* release zero-copy buffers of sockets gone a while ago */
+  svz_tcp_zerocopy_expire ();
+
   /* run the server instance timer routines */
   svz_foreach_server (notify_internal, NULL);
 
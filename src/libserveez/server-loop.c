@@ -56,6 +56,7 @@
 #include "libserveez/util.h"
 #include "libserveez/socket.h"
 #include "libserveez/pipe-socket.h"
+#include "libserveez/tcp-socket.h"
 #include "libserveez/server-core.h"
 
 #define USE_POLL  (HAVE_POLL && ENABLE_POLL)
@@ -79,10 +80,11 @@
   } while (0)
 
 
-#define SOCK_READABLE(sock)                                \
-  (!((sock)->flags & SVZ_SOFLG_NOOVERFLOW) ||              \
-   ((sock)->recv_buffer_fill < (sock)->recv_buffer_size && \
-    (sock)->recv_buffer_size > 0))
+#define SOCK_READABLE(sock)                                  \
+  (!((sock)->flags & SVZ_SOFLG_PAUSED) &&                    \
+   (!((sock)->flags & SVZ_SOFLG_NOOVERFLOW) ||               \
+    ((sock)->recv_buffer_fill < (sock)->recv_buffer_size &&  \
+     (sock)->recv_buffer_size > 0)))
 
 /*
  * Get and clear the pending socket error of a given socket.  Print
@@ -292,7 +294,8 @@ svz_check_sockets_select (void)
               if (FD_ISSET (sock->pipe_desc[SVZ_WRITE], &write_fds))
                 {
                   if (sock->write_socket)
-                    if (sock->write_socket (sock))
+                    if (sock->write_socket (sock)
+                        || svz_sock_check_water (sock))
                       svz_sock_schedule_for_shutdown (sock);
                 }
             }
@@ -326,6 +329,12 @@ svz_check_sockets_select (void)
           /* Is socket readable?  */
           if (FD_ISSET (sock->sock_desc, &read_fds))
             {
+              /* Zero-copy completions make the socket readable, too.  */
+              if (sock->zerocopy && svz_tcp_zerocopy_reap (sock))
+                {
+                  svz_sock_schedule_for_shutdown (sock);
+                  continue;
+                }
               if (sock->read_socket)
                 if (sock->read_socket (sock))
                   {
@@ -351,7 +360,8 @@ svz_check_sockets_select (void)
               else
                 {
                   if (sock->write_socket)
-                    if (sock->write_socket (sock))
+                    if (sock->write_socket (sock)
+                        || svz_sock_check_water (sock))
                       {
                         svz_sock_schedule_for_shutdown (sock);
                         continue;
@@ -510,6 +520,14 @@ svz_check_sockets_poll (void)
               FD_POLL_OUT (fd, sock);
               polled = 1;
             }
+          /* wait for zero-copy completions in any case */
+          if (!polled && svz_tcp_zerocopy_pending (sock))
+            {
+              FD_EXPAND ();
+              ufds[nfds].fd = fd;
+              sfds[nfds] = sock;
+              polled = 1;
+            }
           nfds += polled;
         }
     }
@@ -586,7 +604,8 @@ svz_check_sockets_poll (void)
           else
             {
               if (sock->write_socket)
-                if (sock->write_socket (sock))
+                if (sock->write_socket (sock)
+                    || svz_sock_check_water (sock))
                   {
                     svz_sock_schedule_for_shutdown (sock);
                     continue;
@@ -599,6 +618,15 @@ svz_check_sockets_poll (void)
         {
           if (sock->flags & SVZ_SOFLG_SOCK)
             {
+              /* zero-copy completions are reported as errors */
+              if (sock->zerocopy
+                  && !(ufds[fd].revents & (POLLHUP | POLLNVAL)))
+                {
+                  if (svz_tcp_zerocopy_reap (sock)
+                      || svz_sock_error_info (sock))
+                    svz_sock_schedule_for_shutdown (sock);
+                  continue;
+                }
               if (sock->flags & SVZ_SOFLG_CONNECTING)
                 {
                   svz_log (SVZ_LOG_ERROR, "exception connecting socket %d\n",
@@ -786,7 +814,8 @@ svz_check_sockets_MinGW (void)
             {
               if (sock->send_buffer_fill > 0)
                 if (sock->write_socket)
-                  if (sock->write_socket (sock))
+                  if (sock->write_socket (sock)
+                      || svz_sock_check_water (sock))
                     svz_sock_schedule_for_shutdown (sock);
             }
         }
@@ -819,6 +848,12 @@ svz_check_sockets_MinGW (void)
           /* Is socket readable?  */
           if (FD_ISSET (sock->sock_desc, &read_fds))
             {
+              /* Zero-copy completions make the socket readable, too.  */
+              if (sock->zerocopy && svz_tcp_zerocopy_reap (sock))
+                {
+                  svz_sock_schedule_for_shutdown (sock);
+                  continue;
+                }
               if (sock->read_socket)
                 if (sock->read_socket (sock))
                   {
@@ -844,7 +879,8 @@ svz_check_sockets_MinGW (void)
               else
                 {
                   if (sock->write_socket)
-                    if (sock->write_socket (sock))
+                    if (sock->write_socket (sock)
+                        || svz_sock_check_water (sock))
                       {
                         svz_sock_schedule_for_shutdown (sock);
                         continue;
@@ -41,6 +41,9 @@
 # include <sys/socket.h>
 # include <netdb.h>
 #endif
+#if HAVE_NETINET_TCP_H
+# include <netinet/tcp.h>
+#endif
 
 #include "libserveez/boot.h"
 #include "libserveez/util.h"
@@ -48,6 +51,7 @@
 #include "libserveez/core.h"
 #include "libserveez/socket.h"
 #include "libserveez/pipe-socket.h"
+#include "libserveez/tcp-socket.h"
 #include "libserveez/udp-socket.h"
 #include "libserveez/icmp-socket.h"
 #include "libserveez/server-core.h"
@@ -215,6 +219,12 @@ svz_tcp_accept (svz_socket_t *server_sock)
 
       svz_sock_resize_buffers (sock, port->send_buffer_size,
                                port->recv_buffer_size);
+      svz_sock_adapt_buffers (sock, port->send_buffer_limit,
+                              port->recv_buffer_limit);
+      sock->read_budget = SVZ_CFG_TCP (port, read_budget);
+      sock->write_budget = SVZ_CFG_TCP (port, write_budget);
+      if (SVZ_CFG_TCP (port, zerocopy) > 0)
+        svz_tcp_zerocopy (sock, SVZ_CFG_TCP (port, zerocopy));
       svz_sock_enqueue (sock);
       svz_sock_setparent (sock, server_sock);
       sock->proto = server_sock->proto;
@@ -406,6 +416,8 @@ svz_pipe_accept (svz_socket_t *server_sock)
   sock->idle_counter = 1;
   svz_sock_resize_buffers (sock, port->send_buffer_size,
                            port->recv_buffer_size);
+  svz_sock_adapt_buffers (sock, port->send_buffer_limit,
+                          port->recv_buffer_limit);
   svz_sock_enqueue (sock);
   svz_sock_setparent (sock, server_sock);
   sock->proto = server_sock->proto;
@@ -426,6 +438,58 @@ svz_pipe_accept (svz_socket_t *server_sock)
 #endif /* HAVE_MKFIFO or __MINGW32__ */
 }
 
+/*
+ * Apply the tuning options of the TCP port configuration @var{port} to
+ * the listening socket descriptor @var{fd}.  Options with a value of
+ * zero are left alone.  Since all of these are performance hints only,
+ * failures are logged but otherwise ignored.  This must be done before
+ * calling @code{listen}.
+ */
+static void
+svz_tcp_tune_listener (svz_t_socket fd, svz_portcfg_t *port)
+{
+#define TUNE(level, option, member) do {                         \
+    int optval = SVZ_CFG_TCP (port, member);                     \
+    if (optval > 0                                               \
+        && setsockopt (fd, level, option,                        \
+                       (void *) &optval, sizeof (optval)) < 0)   \
+      svz_log_net_error ("setsockopt (%s)", #option);            \
+  } while (0)
+
+#define UNSUPPORTED(option, member) do {                         \
+    if (SVZ_CFG_TCP (port, member) > 0)                          \
+      svz_log (SVZ_LOG_WARNING, "setsockopt: %s undefined\n",    \
+               #option);                                         \
+  } while (0)
+
+  TUNE (SOL_SOCKET, SO_RCVBUF, rcvbuf);
+  TUNE (SOL_SOCKET, SO_SNDBUF, sndbuf);
+
+#ifdef TCP_DEFER_ACCEPT
+  /* Do not wake us up before the client has actually sent data,
+     so protocol detection can take place on the first read.  */
+  TUNE (IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept);
+#else
+  UNSUPPORTED (TCP_DEFER_ACCEPT, defer_accept);
+#endif
+
+#ifdef TCP_FASTOPEN
+  TUNE (IPPROTO_TCP, TCP_FASTOPEN, fastopen);
+#else
+  UNSUPPORTED (TCP_FASTOPEN, fastopen);
+#endif
+
+#ifdef TCP_NOTSENT_LOWAT
+  /* Accepted connections inherit this setting.  */
+  TUNE (IPPROTO_TCP, TCP_NOTSENT_LOWAT, notsent_lowat);
+#else
+  UNSUPPORTED (TCP_NOTSENT_LOWAT, notsent_lowat);
+#endif
+
+#undef UNSUPPORTED
+#undef TUNE
+}
+
 /*
  * Create a listening server socket (network or pipe).  @var{port} is the
  * port configuration to bind the server socket to.  Return a @code{NULL}
@@ -530,6 +594,7 @@ svz_server_create (svz_portcfg_t *port)
       /* Prepare for listening on that port (if TCP).  */
       if (port->proto & SVZ_PROTO_TCP)
         {
+          svz_tcp_tune_listener (server_socket, port);
           if (listen (server_socket, SVZ_CFG_TCP (port, backlog)) < 0)
             {
               svz_log_net_error ("listen");
@@ -57,6 +57,9 @@
 #include "libserveez/server.h"
 #include "libserveez/binding.h"
 
+/* Seconds of low usage before an adaptive buffer shrinks.  */
+#define SVZ_SOCK_SHRINK_DELAY 5
+
 /*
  * The number of currently connected sockets.
  */
@@ -336,6 +339,132 @@ svz_sock_check_request (svz_socket_t *sock)
   return sock->check_request (sock);
 }
 
+/*
+ * Decode the length field of the packet header at @var{hdr} as
+ * described by the framing layout @var{frame}.
+ */
+static unsigned long
+svz_sock_frame_length (svz_sock_frame_t *frame, uint8_t *hdr)
+{
+  unsigned long length = 0;
+  int n;
+
+  hdr += frame->offset;
+  if (frame->flags & SVZ_FRAME_BIG_ENDIAN)
+    for (n = 0; n < frame->width; n++)
+      length = (length << 8) | hdr[n];
+  else
+    for (n = frame->width - 1; n >= 0; n--)
+      length = (length << 8) | hdr[n];
+
+  return length;
+}
+
+/*
+ * This @code{check_request} routine handles length-prefixed packets as
+ * set up by @code{svz_sock_setframe}.  Each complete packet (header
+ * inclusive) is passed to the @code{handle_request} callback directly
+ * from the receive buffer.  The receive buffer is enlarged only if
+ * a packet announces more data than it is able to hold.
+ */
+static int
+svz_sock_check_request_frame (svz_socket_t *sock)
+{
+  svz_sock_frame_t *frame = &sock->frame;
+  unsigned long size;
+  int len = 0;
+  char *p, *end;
+
+  p = sock->recv_buffer;
+  end = p + sock->recv_buffer_fill;
+
+  while (end - p >= frame->header_size)
+    {
+      /* Find out how large the whole packet is.  */
+      size = svz_sock_frame_length (frame, (uint8_t *) p);
+      if (size > (unsigned long) frame->max_size)
+        goto invalid;
+      if (!(frame->flags & SVZ_FRAME_INCLUSIVE))
+        size += frame->header_size;
+      if (size < (unsigned long) frame->header_size
+          || size > (unsigned long) frame->max_size)
+        goto invalid;
+
+      /* Incomplete packet?  Make room for it if necessary.  */
+      if ((unsigned long) (end - p) < size)
+        {
+          if ((int) size > sock->recv_buffer_size)
+            {
+              svz_sock_reduce_recv (sock, len);
+              len = 0;
+              svz_sock_resize_buffers (sock, sock->send_buffer_size, size);
+            }
+          break;
+        }
+
+      /* Call the handle request callback.  */
+      if (sock->handle_request)
+        {
+          if (sock->handle_request (sock, p, size))
+            return -1;
+        }
+      p += size;
+      len += size;
+    }
+
+  /* Shuffle data in the receive buffer around.  */
+  svz_sock_reduce_recv (sock, len);
+
+  return 0;
+
+ invalid:
+  svz_log (SVZ_LOG_ERROR, "invalid packet size %lu on socket %d\n",
+           size, sock->sock_desc);
+  return -1;
+}
+
+/**
+ * Set up the socket @var{sock} for length-prefixed packets and assign
+ * an appropriate @code{check_request} routine.  Each packet starts with
+ * a header of @var{header_size} bytes containing an unsigned length
+ * field of @var{width} (1, 2 or 4) bytes at @var{offset}.  The length
+ * is read in network byte order if @var{flags} contains
+ * @code{SVZ_FRAME_BIG_ENDIAN} and in little endian byte order otherwise.
+ * It specifies the number of bytes following the header, unless
+ * @code{SVZ_FRAME_INCLUSIVE} is given, in which case the header is
+ * accounted for as well.  Packets larger than @var{max_size} bytes
+ * cause the socket to be shut down.  For a non-positive @var{max_size}
+ * the maximum buffer size is used.
+ *
+ * Complete packets are passed to the @code{handle_request} callback of
+ * @var{sock}, header inclusive.  Return zero on success and -1 if the
+ * given packet layout is invalid.
+ */
+int
+svz_sock_setframe (svz_socket_t *sock, int header_size,
+                   int offset, int width, int flags, int max_size)
+{
+  if (max_size <= 0 || max_size > MAX_BUF_SIZE)
+    max_size = MAX_BUF_SIZE;
+
+  if ((width != 1 && width != 2 && width != 4) || offset < 0
+      || offset + width > header_size || header_size > max_size)
+    {
+      svz_log (SVZ_LOG_ERROR, "invalid packet layout: %d/%d/%d\n",
+               header_size, offset, width);
+      return -1;
+    }
+
+  sock->frame.header_size = header_size;
+  sock->frame.offset = offset;
+  sock->frame.width = width;
+  sock->frame.flags = flags;
+  sock->frame.max_size = max_size;
+  sock->check_request = svz_sock_check_request_frame;
+
+  return 0;
+}
+
 /*
  * Allocate a structure of type @code{svz_socket_t} and initialize its data
  * fields.  Assign some of the default callbacks for TCP connections.
@@ -422,6 +551,181 @@ svz_sock_resize_buffers (svz_socket_t *sock,
   return 0;
 }
 
+/*
+ * Return the size a buffer of @var{size} bytes has to grow to by doubling
+ * in order to hold @var{need} bytes, but not more than @var{max} bytes.
+ */
+static int
+svz_sock_grow_size (int size, int max, int need)
+{
+  while (size < need && size < max)
+    size = (size > max / 2) ? max : size * 2;
+  return size;
+}
+
+/*
+ * Grow the send buffer of @var{sock} so that it can hold @var{need}
+ * bytes, if it is adaptive and has not yet reached its maximum size.
+ */
+static void
+svz_sock_grow_send (svz_socket_t *sock, int need)
+{
+  int size = sock->send_buffer_size;
+
+  if (size <= 0 || size >= sock->send_buffer_max)
+    return;
+  size = svz_sock_grow_size (size, sock->send_buffer_max, need);
+  sock->send_buffer = svz_realloc (sock->send_buffer, size);
+  sock->send_buffer_size = size;
+  sock->send_buffer_idle = 0;
+}
+
+/*
+ * Grow the receive buffer of @var{sock} so that it can hold @var{need}
+ * bytes, if it is adaptive and has not yet reached its maximum size.
+ * Return zero if the buffer has grown, -1 otherwise.
+ */
+int
+svz_sock_grow_recv (svz_socket_t *sock, int need)
+{
+  int size = sock->recv_buffer_size;
+
+  if (size <= 0 || size >= sock->recv_buffer_max)
+    return -1;
+  size = svz_sock_grow_size (size, sock->recv_buffer_max, need);
+  sock->recv_buffer = svz_realloc (sock->recv_buffer, size);
+  sock->recv_buffer_size = size;
+  sock->recv_buffer_idle = 0;
+  return 0;
+}
+
+/*
+ * Halve the adaptive buffer @var{buffer} of @var{size} bytes holding
+ * @var{fill} bytes, if it has been used by no more than a quarter for
+ * @code{SVZ_SOCK_SHRINK_DELAY} consecutive calls counted in @var{idle}.
+ * Never shrink it below @var{min} bytes.
+ */
+static void
+svz_sock_shrink (char **buffer, int *size, int fill, int min, int *idle)
+{
+  if (*size <= min)
+    return;
+  if (fill > *size / 4)
+    *idle = 0;
+  else if (++(*idle) >= SVZ_SOCK_SHRINK_DELAY)
+    {
+      *size = (*size / 2 > min) ? *size / 2 : min;
+      *buffer = svz_realloc (*buffer, *size);
+      *idle = 0;
+    }
+}
+
+/*
+ * Shrink the adaptive buffers of @var{sock} back towards their initial
+ * sizes after a period of low usage.  This is called once per second.
+ */
+void
+svz_sock_shrink_buffers (svz_socket_t *sock)
+{
+  if (sock->send_buffer_max > 0)
+    svz_sock_shrink (&sock->send_buffer, &sock->send_buffer_size,
+                     sock->send_buffer_fill, sock->send_buffer_min,
+                     &sock->send_buffer_idle);
+  if (sock->recv_buffer_max > 0)
+    svz_sock_shrink (&sock->recv_buffer, &sock->recv_buffer_size,
+                     sock->recv_buffer_fill, sock->recv_buffer_min,
+                     &sock->recv_buffer_idle);
+}
+
+/**
+ * Make the send and receive buffers of @var{sock} adaptive.  Whenever a
+ * buffer runs full it grows by doubling its size, but not beyond
+ * @var{send_max} and @var{recv_max} bytes respectively.  After a few
+ * seconds of low usage it shrinks back towards its current size.  A
+ * maximum not larger than the current buffer size keeps the buffer
+ * at a fixed size.
+ */
+void
+svz_sock_adapt_buffers (svz_socket_t *sock, int send_max, int recv_max)
+{
+  if (send_max > MAX_BUF_SIZE)
+    send_max = MAX_BUF_SIZE;
+  if (recv_max > MAX_BUF_SIZE)
+    recv_max = MAX_BUF_SIZE;
+  sock->send_buffer_min = sock->send_buffer_size;
+  sock->recv_buffer_min = sock->recv_buffer_size;
+  sock->send_buffer_max = (send_max > sock->send_buffer_size) ? send_max : 0;
+  sock->recv_buffer_max = (recv_max > sock->recv_buffer_size) ? recv_max : 0;
+  sock->send_buffer_idle = 0;
+  sock->recv_buffer_idle = 0;
+}
+
+/**
+ * Set the send buffer watermarks of @var{sock}.  As soon as the send
+ * buffer holds @var{high} bytes or more, the socket's @code{high_water}
+ * callback is run.  When it has drained to @var{low} bytes or less
+ * afterwards, the @code{low_water} callback is run.  Protocols can
+ * use these to throttle whatever feeds the socket.  A @var{high}
+ * watermark of zero disables the callbacks.
+ */
+void
+svz_sock_setwater (svz_socket_t *sock, int low, int high)
+{
+  sock->send_low_water = low;
+  sock->send_high_water = high;
+  sock->flags &= ~SVZ_SOFLG_HIGH_WATER;
+}
+
+/**
+ * Stop reading from @var{sock}.  The main loop does not wait for
+ * incoming data on the socket anymore until @code{svz_sock_resume_read}
+ * is called, so the peer gets throttled by the network stack once its
+ * buffers are full.  Use this with the @code{high_water} callback of
+ * the socket the data is forwarded to.
+ */
+void
+svz_sock_pause_read (svz_socket_t *sock)
+{
+  sock->flags |= SVZ_SOFLG_PAUSED;
+}
+
+/**
+ * Continue reading from @var{sock} after @code{svz_sock_pause_read}.
+ */
+void
+svz_sock_resume_read (svz_socket_t *sock)
+{
+  sock->flags &= ~SVZ_SOFLG_PAUSED;
+}
+
+/*
+ * Run the @code{high_water} or @code{low_water} callback of @var{sock}
+ * if its send buffer has crossed the corresponding watermark.  Return
+ * the callback's result, or zero if nothing happened.
+ */
+int
+svz_sock_check_water (svz_socket_t *sock)
+{
+  if (sock->send_high_water <= 0)
+    return 0;
+
+  if (!(sock->flags & SVZ_SOFLG_HIGH_WATER)
+      && sock->send_buffer_fill >= sock->send_high_water)
+    {
+      sock->flags |= SVZ_SOFLG_HIGH_WATER;
+      if (sock->high_water)
+        return sock->high_water (sock);
+    }
+  else if (sock->flags & SVZ_SOFLG_HIGH_WATER
+           && sock->send_buffer_fill <= sock->send_low_water)
+    {
+      sock->flags &= ~SVZ_SOFLG_HIGH_WATER;
+      if (sock->low_water)
+        return sock->low_water (sock);
+    }
+  return 0;
+}
+
 /*
  * Free the socket structure @var{sock}.  Return a non-zero value on error.
  */
@@ -445,6 +749,8 @@ svz_sock_free (svz_socket_t *sock)
     svz_free (sock->recv_pipe);
   if (sock->send_pipe)
     svz_free (sock->send_pipe);
+  if (sock->zerocopy)
+    svz_tcp_zerocopy_free (sock);
 
 #ifdef __MINGW32__
   if (sock->overlap[SVZ_READ])
@@ -594,6 +900,10 @@ svz_sock_write (svz_socket_t *sock, char *buf, int len)
             sock->flags |= SVZ_SOFLG_FINAL_WRITE;
         }
 
+      /* Make room for the data if the send buffer is adaptive.  */
+      if (sock->send_buffer_fill + len >= sock->send_buffer_size)
+        svz_sock_grow_send (sock, sock->send_buffer_fill + len + 1);
+
       if (sock->send_buffer_fill >= sock->send_buffer_size)
         {
           /* Queue is full, unlucky socket or pipe ...  */
@@ -630,7 +940,7 @@ svz_sock_write (svz_socket_t *sock, char *buf, int len)
         }
     }
 
-  return 0;
+  return svz_sock_check_water (sock);
 }
 
 /**
@@ -64,12 +64,33 @@
 #define SVZ_SOFLG_FLUSH       0x00080000 /* Flush receive and send queue.  */
 #define SVZ_SOFLG_NOSHUTDOWN  0x00100000 /* Disable shutdown.  */
 #define SVZ_SOFLG_NOOVERFLOW  0x00200000 /* Disable receive buffer overflow.  */
+#define SVZ_SOFLG_HIGH_WATER  0x00400000 /* Send buffer above high water.  */
+#define SVZ_SOFLG_PAUSED      0x00800000 /* Reading is paused.  */
+
+/* Flags for the length-prefixed packet framing.  */
+#define SVZ_FRAME_BIG_ENDIAN  0x0001 /* Length field in network order.  */
+#define SVZ_FRAME_INCLUSIVE   0x0002 /* Length includes the header.  */
 
 /* begin svzint */
 #define VSNPRINTF_BUF_SIZE 2048 /* Size of the ‘vsnprintf’ buffer */
 /* end svzint */
 typedef struct svz_socket svz_socket_t;
 
+/*
+ * Layout of length-prefixed packets.  Each packet starts with a
+ * fixed size header containing an unsigned length field, which
+ * specifies the number of bytes following the header.
+ */
+typedef struct
+{
+  int header_size;              /* Size of the packet header.  */
+  int offset;                   /* Offset of the length field.  */
+  int width;                    /* Length field width (1, 2 or 4).  */
+  int flags;                    /* One of the SVZ_FRAME_* flags above.  */
+  int max_size;                 /* Maximum size of a complete packet.  */
+}
+svz_sock_frame_t;
+
 struct svz_socket
 {
   svz_socket_t *next;           /* Next socket in chain.  */
@@ -101,6 +122,7 @@ struct svz_socket
 
   char *boundary;               /* Packet boundary.  */
   int boundary_size;            /* Packet boundary length */
+  svz_sock_frame_t frame;       /* Length-prefixed packet layout.  */
 
   /* The following items always MUST be in network byte order.  */
   in_port_t remote_port;        /* Port number of remote end.  */
@@ -114,6 +136,17 @@ struct svz_socket
   int recv_buffer_size;         /* Size of RECV_BUFFER.  */
   int send_buffer_fill;         /* Valid bytes in SEND_BUFFER.  */
   int recv_buffer_fill;         /* Valid bytes in RECV_BUFFER.  */
+  int read_budget;              /* Bytes to read per event (0 = once).  */
+  int write_budget;             /* Bytes to write per event (0 = once).  */
+  int send_buffer_min;          /* Size to shrink SEND_BUFFER back to.  */
+  int recv_buffer_min;          /* Size to shrink RECV_BUFFER back to.  */
+  int send_buffer_max;          /* Size to grow SEND_BUFFER up to.  */
+  int recv_buffer_max;          /* Size to grow RECV_BUFFER up to.  */
+  int send_buffer_idle;         /* Seconds of low SEND_BUFFER usage.  */
+  int recv_buffer_idle;         /* Seconds of low RECV_BUFFER usage.  */
+  int send_high_water;          /* SEND_BUFFER_FILL calling HIGH_WATER.  */
+  int send_low_water;           /* SEND_BUFFER_FILL calling LOW_WATER.  */
+  void *zerocopy;               /* Zero-copy send state (or NULL).  */
 
   uint16_t sequence;            /* Currently received sequence.  */
   uint16_t send_seq;            /* Send stream sequence number.  */
@@ -160,6 +193,15 @@ struct svz_socket
    */
   int (* kicked_socket) (svz_socket_t *sock, int reason);
 
+  /*
+   * HIGH_WATER gets called when the send buffer has filled up to
+   * SEND_HIGH_WATER bytes, LOW_WATER when it has drained down to
+   * SEND_LOW_WATER bytes again.  Producers can use them to stop and
+   * resume feeding the socket instead of overflowing its send buffer.
+   */
+  int (* high_water) (svz_socket_t *sock);
+  int (* low_water) (svz_socket_t *sock);
+
   /*
    * CHECK_REQUEST gets called whenever data was read from the socket.
    * Its purpose is to check whether a complete request was read, and
@@ -248,12 +290,20 @@ SBO int svz_sock_intern_connection_info (svz_socket_t *);
 SBO int svz_sock_unique_id (svz_socket_t *);
 SBO int svz_sock_detect_proto (svz_socket_t *);
 SBO int svz_sock_flood_protect (svz_socket_t *, int);
+SBO int svz_sock_grow_recv (svz_socket_t *, int);
+SBO void svz_sock_shrink_buffers (svz_socket_t *);
+SBO int svz_sock_check_water (svz_socket_t *);
 
 SERVEEZ_API int svz_sock_nconnections (void);
 SERVEEZ_API int svz_sock_write (svz_socket_t *, char *, int);
 SERVEEZ_API int svz_sock_printf (svz_socket_t *, const char *, ...);
 SERVEEZ_API int svz_sock_resize_buffers (svz_socket_t *, int, int);
+SERVEEZ_API void svz_sock_adapt_buffers (svz_socket_t *, int, int);
+SERVEEZ_API void svz_sock_setwater (svz_socket_t *, int, int);
+SERVEEZ_API void svz_sock_pause_read (svz_socket_t *);
+SERVEEZ_API void svz_sock_resume_read (svz_socket_t *);
 SERVEEZ_API int svz_sock_check_request (svz_socket_t *);
+SERVEEZ_API int svz_sock_setframe (svz_socket_t *, int, int, int, int, int);
 SERVEEZ_API int svz_wait_if_unavailable (svz_socket_t *, unsigned int);
 SERVEEZ_API void svz_sock_reduce_recv (svz_socket_t *, int);
 SERVEEZ_API void svz_sock_reduce_send (svz_socket_t *, int);
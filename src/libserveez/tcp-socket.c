@@ -46,58 +46,424 @@
 # include <netdb.h>
 #endif
 
+#if HAVE_LINUX_ERRQUEUE_H
+# include <linux/errqueue.h>
+#endif
+
 #include "networking-headers.h"
+#include "libserveez/alloc.h"
+#include "libserveez/array.h"
 #include "libserveez/util.h"
 #include "libserveez/socket.h"
 #include "libserveez/core.h"
 #include "libserveez/server-core.h"
 #include "libserveez/tcp-socket.h"
 
+#if defined (SO_ZEROCOPY) && defined (MSG_ZEROCOPY) \
+  && defined (SO_EE_ORIGIN_ZEROCOPY) && defined (IP_RECVERR)
+# define HAVE_ZEROCOPY 1
+#else
+# define HAVE_ZEROCOPY 0
+#endif
+
+/* Maximum number of send buffers waiting for the kernel per socket.  */
+#define ZEROCOPY_MAX_PENDING 16
+
+/* Maximum number of released send buffers kept for reuse per socket.  */
+#define ZEROCOPY_MAX_SPARE 2
+
+/* Seconds to keep the pending buffers of a freed socket around.  */
+#define ZEROCOPY_LINGER 120
+
+/*
+ * A send buffer passed to the kernel by a zero-copy @code{send}.  The
+ * kernel reads the data directly from it until it posts a completion
+ * notification carrying @var{id} on the socket's error queue.
+ */
+typedef struct
+{
+  char *buffer;       /* The retired send buffer.  */
+  int size;           /* Its allocated size.  */
+  uint32_t id;        /* Notification id of the ‘send’ call.  */
+  time_t expire;      /* Release time if the socket is gone.  */
+}
+zerocopy_buffer_t;
+
+/* Zero-copy send state of a TCP socket.  */
+typedef struct
+{
+  int threshold;               /* Minimum size of zero-copy sends.  */
+  uint32_t next;               /* Notification id of the next send.  */
+  svz_array_t *pending;        /* Buffers not yet released by the kernel.  */
+  svz_array_t *spare;          /* Released buffers ready for reuse.  */
+}
+zerocopy_t;
+
+/* Pending buffers of sockets which have been freed already.  */
+static svz_array_t *zerocopy_orphans = NULL;
+
+/*
+ * Return @code{MSG_ZEROCOPY} if the next @var{len} bytes of the send
+ * buffer of @var{sock} should be sent without copying, zero otherwise.
+ */
+static int
+zerocopy_flags (svz_socket_t *sock, int len)
+{
+#if HAVE_ZEROCOPY
+  zerocopy_t *zc = sock->zerocopy;
+
+  if (zc && zc->threshold > 0 && len >= zc->threshold
+      && svz_array_size (zc->pending) < ZEROCOPY_MAX_PENDING)
+    return MSG_ZEROCOPY;
+#endif /* HAVE_ZEROCOPY */
+  return 0;
+}
+
+/*
+ * Hand the send buffer of @var{sock} over to the kernel after a
+ * zero-copy @code{send} of @var{len} bytes and continue with a fresh
+ * buffer holding the unsent rest.  The old buffer must not be touched
+ * until the kernel has released it.
+ */
+static void
+zerocopy_retire (svz_socket_t *sock, int len)
+{
+  zerocopy_t *zc = sock->zerocopy;
+  zerocopy_buffer_t *retired;
+  char *buffer = NULL;
+  size_t n;
+
+  /* Reuse a released buffer of the right size if possible.  */
+  while (buffer == NULL && (n = svz_array_size (zc->spare)) > 0)
+    {
+      retired = svz_array_del (zc->spare, n - 1);
+      if (retired->size == sock->send_buffer_size)
+        buffer = retired->buffer;
+      else
+        svz_free (retired->buffer);
+      svz_free (retired);
+    }
+  if (buffer == NULL)
+    buffer = svz_malloc (sock->send_buffer_size);
+
+  retired = svz_malloc (sizeof (zerocopy_buffer_t));
+  retired->buffer = sock->send_buffer;
+  retired->size = sock->send_buffer_size;
+  retired->id = zc->next++;
+  retired->expire = 0;
+  svz_array_add (zc->pending, retired);
+
+  sock->send_buffer_fill -= len;
+  if (sock->send_buffer_fill > 0)
+    memcpy (buffer, retired->buffer + len, sock->send_buffer_fill);
+  sock->send_buffer = buffer;
+}
+
+/*
+ * Release the buffers of the zero-copy state @var{zc} whose
+ * notification ids lie in the range @var{lo}..@var{hi}.
+ */
+static void
+zerocopy_release (zerocopy_t *zc, uint32_t lo, uint32_t hi)
+{
+  zerocopy_buffer_t *retired;
+  size_t n = 0;
+
+  while (n < svz_array_size (zc->pending))
+    {
+      retired = svz_array_get (zc->pending, n);
+      /* The ids wrap around, so compare relative to LO.  */
+      if (retired->id - lo > hi - lo)
+        {
+          n++;
+          continue;
+        }
+      svz_array_del (zc->pending, n);
+      if (svz_array_size (zc->spare) < ZEROCOPY_MAX_SPARE)
+        svz_array_add (zc->spare, retired);
+      else
+        {
+          svz_free (retired->buffer);
+          svz_free (retired);
+        }
+    }
+}
+
+static void
+zerocopy_buffer_free (void *ptr)
+{
+  zerocopy_buffer_t *retired = ptr;
+
+  svz_free (retired->buffer);
+  svz_free (retired);
+}
+
+/**
+ * Enable zero-copy sends on the TCP socket @var{sock}.  Each time the
+ * socket writes at least @var{threshold} bytes at once, the kernel reads
+ * them directly from the send buffer, which is then replaced and only
+ * recycled after the kernel has reported that it is done with it.  This
+ * saves copying large amounts of data into the kernel, but costs a page
+ * pinning and a completion notification per write, so @var{threshold}
+ * should not be smaller than a few pages.  A @var{threshold} of zero
+ * disables zero-copy sends again.  Return zero on success and -1 if the
+ * system does not support zero-copy sends.
+ */
+int
+svz_tcp_zerocopy (svz_socket_t *sock, int threshold)
+{
+#if HAVE_ZEROCOPY
+  zerocopy_t *zc = sock->zerocopy;
+  int on = 1;
+
+  if (threshold <= 0)
+    {
+      if (zc)
+        zc->threshold = 0;
+      return 0;
+    }
+
+  if (zc == NULL)
+    {
+      if (setsockopt (sock->sock_desc, SOL_SOCKET, SO_ZEROCOPY,
+                      (void *) &on, sizeof (on)) < 0)
+        {
+          svz_log_net_error ("setsockopt (SO_ZEROCOPY)");
+          return -1;
+        }
+      zc = svz_calloc (sizeof (zerocopy_t));
+      zc->pending = svz_array_create (ZEROCOPY_MAX_PENDING, NULL);
+      zc->spare = svz_array_create (ZEROCOPY_MAX_SPARE, NULL);
+      sock->zerocopy = zc;
+    }
+  zc->threshold = threshold;
+  return 0;
+#else /* not HAVE_ZEROCOPY */
+  static int warned = 0;
+
+  if (threshold > 0)
+    {
+      if (!warned++)
+        svz_log (SVZ_LOG_WARNING, "tcp: zero-copy sends not supported\n");
+      return -1;
+    }
+  return 0;
+#endif /* not HAVE_ZEROCOPY */
+}
+
+/*
+ * Return the number of send buffers of @var{sock} the kernel has not
+ * released yet.
+ */
+int
+svz_tcp_zerocopy_pending (svz_socket_t *sock)
+{
+  zerocopy_t *zc = sock->zerocopy;
+
+  return zc ? (int) svz_array_size (zc->pending) : 0;
+}
+
+/*
+ * Collect the zero-copy completion notifications from the error queue
+ * of @var{sock} and release the send buffers the kernel is done with.
+ * Return -1 if the socket should be shut down, either because of an
+ * error or because it has only been waiting for its final buffers to
+ * be released.  Return zero otherwise.
+ */
+int
+svz_tcp_zerocopy_reap (svz_socket_t *sock)
+{
+#if HAVE_ZEROCOPY
+  zerocopy_t *zc = sock->zerocopy;
+  char control[CMSG_SPACE (sizeof (struct sock_extended_err)
+                           + sizeof (struct sockaddr_in))];
+  struct sock_extended_err *err;
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+
+  while (zc && svz_array_size (zc->pending) > 0)
+    {
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof (control);
+      if (recvmsg (sock->sock_desc, &msg, MSG_ERRQUEUE) < 0)
+        {
+          if (svz_socket_unavailable_error_p ())
+            break;
+          svz_log_net_error ("tcp: recvmsg");
+          return -1;
+        }
+
+      for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL;
+           cmsg = CMSG_NXTHDR (&msg, cmsg))
+        {
+          if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR)
+            continue;
+          err = (struct sock_extended_err *) CMSG_DATA (cmsg);
+          if (err->ee_origin == SO_EE_ORIGIN_ZEROCOPY && err->ee_errno == 0)
+            zerocopy_release (zc, err->ee_info, err->ee_data);
+        }
+    }
+#endif /* HAVE_ZEROCOPY */
+
+  /* See ‘svz_tcp_write_socket’.  */
+  if (sock->flags & SVZ_SOFLG_FINAL_WRITE && sock->send_buffer_fill == 0
+      && svz_tcp_zerocopy_pending (sock) == 0)
+    return -1;
+  return 0;
+}
+
+/*
+ * Release the zero-copy state of @var{sock}.  Buffers the kernel still
+ * refers to are kept for a while, because closing the socket does not
+ * immediately end the transmission of already queued data.
+ */
+void
+svz_tcp_zerocopy_free (svz_socket_t *sock)
+{
+  zerocopy_t *zc = sock->zerocopy;
+  zerocopy_buffer_t *retired;
+  size_t n;
+
+  if (zc == NULL)
+    return;
+
+  if (svz_array_size (zc->pending) > 0)
+    {
+      if (zerocopy_orphans == NULL)
+        zerocopy_orphans = svz_array_create (ZEROCOPY_MAX_PENDING,
+                                             zerocopy_buffer_free);
+      svz_array_foreach (zc->pending, retired, n)
+        {
+          retired->expire = time (NULL) + ZEROCOPY_LINGER;
+          svz_array_add (zerocopy_orphans, retired);
+        }
+    }
+  svz_array_destroy (zc->pending);
+  svz_array_foreach (zc->spare, retired, n)
+    zerocopy_buffer_free (retired);
+  svz_array_destroy (zc->spare);
+  svz_free (zc);
+  sock->zerocopy = NULL;
+}
+
+/*
+ * Free the pending zero-copy buffers of freed sockets which have been
+ * lingering long enough.  Called periodically from the main loop.
+ */
+void
+svz_tcp_zerocopy_expire (void)
+{
+  zerocopy_buffer_t *retired;
+  time_t now = time (NULL);
+  size_t n = 0;
+
+  while (n < svz_array_size (zerocopy_orphans))
+    {
+      retired = svz_array_get (zerocopy_orphans, n);
+      if (retired->expire > now)
+        n++;
+      else
+        zerocopy_buffer_free (svz_array_del (zerocopy_orphans, n));
+    }
+}
+
+void
+svz__zerocopy_updn (int direction)
+{
+  if (!direction)
+    {
+      svz_array_destroy (zerocopy_orphans);
+      zerocopy_orphans = NULL;
+    }
+}
+
 /*
  * Default function for writing to the socket @var{sock}.  Simply flushes
  * the output buffer to the network.  Write as much as possible into the
  * socket @var{sock}.  Writing is performed non-blocking, so only as much
- * as fits into the network buffer will be written on each call.
+ * as fits into the network buffer will be written on each call.  If the
+ * socket has a @code{write_budget}, keep on writing until either the
+ * budget is exhausted, the output buffer is empty or the network buffer
+ * is full.  Large writes on sockets with zero-copy sends enabled are not
+ * limited to @code{SVZ_SOCK_MAX_WRITE}.
  */
 int
 svz_tcp_write_socket (svz_socket_t *sock)
 {
   int num_written;
   int do_write;
+  int flags;
+  int total = 0;
   svz_t_socket desc;
 
   desc = sock->sock_desc;
 
-  /*
-   * Write as many bytes as possible, remember how many were actually
-   * sent.  Limit the maximum sent bytes to ‘SVZ_SOCK_MAX_WRITE’.
-   */
-  do_write = sock->send_buffer_fill;
-  if (do_write > SVZ_SOCK_MAX_WRITE)
-    do_write = SVZ_SOCK_MAX_WRITE;
-  num_written = send (desc, sock->send_buffer, do_write, 0);
+  /* Recycle the buffers of previous zero-copy sends.  */
+  if (sock->zerocopy && svz_tcp_zerocopy_reap (sock))
+    return -1;
 
-  /* Some data has been written.  */
-  if (num_written > 0)
+  do
     {
-      sock->last_send = time (NULL);
-
       /*
-       * Shuffle the data in the output buffer around, so that
-       * new data can get stuffed into it.
+       * Write as many bytes as possible, remember how many were actually
+       * sent.  Limit the maximum sent bytes to ‘SVZ_SOCK_MAX_WRITE’ or
+       * what is left of the write budget.
        */
-      svz_sock_reduce_send (sock, num_written);
-    }
-  /* Error occurred while sending.  */
-  else if (num_written < 0)
-    {
-      svz_log_net_error ("tcp: send");
-      if (svz_wait_if_unavailable (sock, 1))
-        num_written = 0;
+      do_write = sock->send_buffer_fill;
+      if (sock->write_budget > 0)
+        {
+          if (do_write > sock->write_budget - total)
+            do_write = sock->write_budget - total;
+        }
+      else if (do_write > SVZ_SOCK_MAX_WRITE
+               && !zerocopy_flags (sock, do_write))
+        do_write = SVZ_SOCK_MAX_WRITE;
+      flags = zerocopy_flags (sock, do_write);
+      num_written = send (desc, sock->send_buffer, do_write, flags);
+
+      /* Fall back to copying if the kernel cannot pin more pages.  */
+      if (num_written < 0 && flags && errno == ENOBUFS)
+        {
+          flags = 0;
+          num_written = send (desc, sock->send_buffer, do_write, 0);
+        }
+
+      /* Some data has been written.  */
+      if (num_written > 0)
+        {
+          sock->last_send = time (NULL);
+          total += num_written;
+
+          /*
+           * Shuffle the data in the output buffer around, so that
+           * new data can get stuffed into it.  After a zero-copy send
+           * the kernel still needs the buffer, so replace it instead.
+           */
+          if (flags)
+            zerocopy_retire (sock, num_written);
+          else
+            svz_sock_reduce_send (sock, num_written);
+        }
+      /* Error occurred while sending.  */
+      else if (num_written < 0)
+        {
+          svz_log_net_error ("tcp: send");
+          if (svz_wait_if_unavailable (sock, 1))
+            num_written = 0;
+          break;
+        }
     }
+  /* A short write means the network buffer is full.  */
+  while (num_written == do_write && sock->send_buffer_fill > 0
+         && total < sock->write_budget);
 
-  /* If final write flag is set, then schedule for shutdown.  */
-  if (sock->flags & SVZ_SOFLG_FINAL_WRITE && sock->send_buffer_fill == 0)
+  /*
+   * If final write flag is set, then schedule for shutdown.  Wait for
+   * the kernel to release all zero-copy buffers first.
+   */
+  if (sock->flags & SVZ_SOFLG_FINAL_WRITE && sock->send_buffer_fill == 0
+      && svz_tcp_zerocopy_pending (sock) == 0)
     num_written = -1;
 
   /* Return a non-zero value if an error occurred.  */
@@ -107,7 +473,10 @@ svz_tcp_write_socket (svz_socket_t *sock)
 /**
  * Read all data from @var{sock} and call the @code{check_request}
  * function for the socket, if set.  Return -1 if the socket has died,
- * zero otherwise.
+ * zero otherwise.  If the socket has a @code{read_budget}, keep on
+ * reading and checking for requests until either the budget is
+ * exhausted, the receive buffer stays full or there is no more data
+ * available.
  *
  * This is the default function for reading from @var{sock}.
  */
@@ -117,52 +486,72 @@ svz_tcp_read_socket (svz_socket_t *sock)
   int num_read;
   int ret;
   int do_read;
+  int total = 0;
   svz_t_socket desc;
 
   desc = sock->sock_desc;
 
-  /*
-   * Calculate how many bytes fit into the receive buffer.
-   */
-  do_read = sock->recv_buffer_size - sock->recv_buffer_fill;
-
-  /*
-   * Check if enough space is left in the buffer, kick the socket
-   * if not.  The main loop will kill the socket if we return a non-zero
-   * value.
-   */
-  if (do_read <= 0)
+  do
     {
-      svz_log (SVZ_LOG_ERROR, "receive buffer overflow on socket %d\n", desc);
-      if (sock->kicked_socket)
-        sock->kicked_socket (sock, 0);
-      return -1;
-    }
-
-  /*
-   * Try to read as much data as possible.
-   */
-  num_read = recv (desc,
-                   sock->recv_buffer + sock->recv_buffer_fill, do_read, 0);
+      /*
+       * Calculate how many bytes fit into the receive buffer.
+       */
+      do_read = sock->recv_buffer_size - sock->recv_buffer_fill;
+      if (do_read <= 0
+          && svz_sock_grow_recv (sock, sock->recv_buffer_fill + 1) == 0)
+        do_read = sock->recv_buffer_size - sock->recv_buffer_fill;
+      if (sock->read_budget > 0 && do_read > sock->read_budget - total)
+        do_read = sock->read_budget - total;
 
-  /* Error occurred while reading.  */
-  if (num_read < 0)
-    {
       /*
-       * This means that the socket was shut down.  Close the socket in this
-       * case, which the main loop will do for us if we return a non-zero
+       * Check if enough space is left in the buffer, kick the socket
+       * if not.  The main loop will kill the socket if we return a non-zero
        * value.
        */
-      svz_log_net_error ("tcp: recv");
-      if (svz_socket_unavailable_error_p ())
-        num_read = 0;
-      else
-        return -1;
-    }
-  /* Some data has been read successfully.  */
-  else if (num_read > 0)
-    {
+      if (do_read <= 0)
+        {
+          if (total > 0)
+            break;
+          svz_log (SVZ_LOG_ERROR, "receive buffer overflow on socket %d\n",
+                   desc);
+          if (sock->kicked_socket)
+            sock->kicked_socket (sock, 0);
+          return -1;
+        }
+
+      /*
+       * Try to read as much data as possible.
+       */
+      num_read = recv (desc,
+                       sock->recv_buffer + sock->recv_buffer_fill, do_read, 0);
+
+      /* Error occurred while reading.  */
+      if (num_read < 0)
+        {
+          /*
+           * This means that the socket was shut down.  Close the socket in
+           * this case, which the main loop will do for us if we return a
+           * non-zero value.
+           */
+          svz_log_net_error ("tcp: recv");
+          if (svz_socket_unavailable_error_p ())
+            break;
+          return -1;
+        }
+      /* The socket was ‘select’ed but there is no data.  */
+      else if (num_read == 0)
+        {
+          /* Leave it to the next round to detect the end of file
+             if something has been read already.  */
+          if (total > 0)
+            break;
+          svz_log (SVZ_LOG_ERROR, "tcp: recv: no data on socket %d\n", desc);
+          return -1;
+        }
+
+      /* Some data has been read successfully.  */
       sock->last_recv = time (NULL);
+      total += num_read;
 
 #if ENABLE_FLOOD_PROTECTION
       if (svz_sock_flood_protect (sock, num_read))
@@ -180,12 +569,14 @@ svz_tcp_read_socket (svz_socket_t *sock)
             return ret;
         }
     }
-  /* The socket was ‘select’ed but there is no data.  */
-  else
-    {
-      svz_log (SVZ_LOG_ERROR, "tcp: recv: no data on socket %d\n", desc);
-      return -1;
-    }
+  /*
+   * A short read means that the network buffer has been drained.  Also
+   * stop if the socket has been scheduled for shutdown, has been paused
+   * or has changed its reading policy.
+   */
+  while (num_read == do_read && total < sock->read_budget
+         && !(sock->flags & (SVZ_SOFLG_KILLED | SVZ_SOFLG_PAUSED))
+         && sock->read_socket == svz_tcp_read_socket);
 
   return 0;
 }
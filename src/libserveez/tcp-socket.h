@@ -36,6 +36,11 @@ SERVEEZ_API int svz_tcp_read_socket (svz_socket_t *);
 SBO int svz_tcp_write_socket (svz_socket_t *);
 SBO int svz_tcp_recv_oob (svz_socket_t *);
 SERVEEZ_API int svz_tcp_send_oob (svz_socket_t *);
+SERVEEZ_API int svz_tcp_zerocopy (svz_socket_t *, int);
+SBO int svz_tcp_zerocopy_pending (svz_socket_t *);
+SBO int svz_tcp_zerocopy_reap (svz_socket_t *);
+SBO void svz_tcp_zerocopy_free (svz_socket_t *);
+SBO void svz_tcp_zerocopy_expire (void);
 
 __END_DECLS
 
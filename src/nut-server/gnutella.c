@@ -768,72 +768,56 @@ nut_server_notify (svz_server_t *server)
 }
 
 /*
- * Whenever there is data arriving for this socket we call this
- * routine.
+ * Whenever a complete packet has arrived on this socket we call this
+ * routine.  The packet framing is done by the core library.
  */
 int
-nut_check_request (svz_socket_t *sock)
+nut_handle_request (svz_socket_t *sock, char *request, int len)
 {
   nut_client_t *client = sock->data;
   nut_header_t *hdr;
   uint8_t *packet;
-  int len = strlen (NUT_OK);
-  unsigned fill = sock->recv_buffer_fill;
-
-  /* go through all packets in the receive queue */
-  while ((fill = sock->recv_buffer_fill) >= SIZEOF_NUT_HEADER)
-    {
-      hdr = nut_get_header ((uint8_t *) sock->recv_buffer);
 
-      /* is there enough data to fulfill a complete packet?  */
-      if (fill >= SIZEOF_NUT_HEADER + hdr->length)
-        {
-          len = SIZEOF_NUT_HEADER + hdr->length;
-          packet = (uint8_t *) sock->recv_buffer + SIZEOF_NUT_HEADER;
-          client->packets++;
+  hdr = nut_get_header ((uint8_t *) request);
+  packet = (uint8_t *) request + SIZEOF_NUT_HEADER;
+  client->packets++;
 #if 0
-          svz_hexdump (stdout, "gnutella packet", sock->sock_desc,
-                       sock->recv_buffer, len, 0);
+  svz_hexdump (stdout, "gnutella packet", sock->sock_desc,
+               request, len, 0);
 #endif
 
-          /* try to route the packet */
-          if (nut_route (sock, hdr, packet) == 0)
-            {
-              /* handle the packet */
-              switch (hdr->function)
-                {
-                case NUT_PING_REQ:
-                  nut_ping (sock, hdr, NULL);
-                  break;
-                case NUT_PING_ACK:
-                  nut_pong (sock, hdr, packet);
-                  break;
-                case NUT_PUSH_REQ:
-                  nut_push_request (sock, hdr, packet);
-                  break;
-                case NUT_SEARCH_REQ:
-                  nut_query (sock, hdr, packet);
-                  break;
-                case NUT_SEARCH_ACK:
-                  nut_reply (sock, hdr, packet);
-                  break;
-                }
-            }
-          else if (!(sock->flags & SVZ_SOFLG_KILLED))
-            {
-              client->dropped++;
-            }
-
-          /* return if this client connection has been killed */
-          if (sock->flags & SVZ_SOFLG_KILLED)
-            return -1;
-
-          /* cut this packet from the send buffer queue */
-          svz_sock_reduce_recv (sock, len);
+  /* try to route the packet */
+  if (nut_route (sock, hdr, packet) == 0)
+    {
+      /* handle the packet */
+      switch (hdr->function)
+        {
+        case NUT_PING_REQ:
+          nut_ping (sock, hdr, NULL);
+          break;
+        case NUT_PING_ACK:
+          nut_pong (sock, hdr, packet);
+          break;
+        case NUT_PUSH_REQ:
+          nut_push_request (sock, hdr, packet);
+          break;
+        case NUT_SEARCH_REQ:
+          nut_query (sock, hdr, packet);
+          break;
+        case NUT_SEARCH_ACK:
+          nut_reply (sock, hdr, packet);
+          break;
         }
-      else
-        break;
     }
+  else if (!(sock->flags & SVZ_SOFLG_KILLED))
+    {
+      client->dropped++;
+    }
+
+  /* return if this client connection has been killed */
+  if (sock->flags & SVZ_SOFLG_KILLED)
+    return -1;
+
   return 0;
 }
 
@@ -1196,7 +1180,10 @@ nut_connect_socket (svz_server_t *server, svz_socket_t *sock)
       /* assign gnutella specific callbacks */
       sock->flags |= SVZ_SOFLG_NOFLOOD;
       sock->disconnected_socket = nut_disconnect;
-      sock->check_request = nut_check_request;
+      sock->handle_request = nut_handle_request;
+      if (svz_sock_setframe (sock, SIZEOF_NUT_HEADER, NUT_GUID_SIZE + 3,
+                             SIZEOF_UINT32, 0, NUT_MAX_PACKET) == -1)
+        return -1;
       sock->idle_func = nut_idle_searching;
       sock->idle_counter = NUT_SEARCH_INTERVAL;
       sock->data = nut_create_client ();
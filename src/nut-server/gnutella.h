@@ -37,6 +37,7 @@
 #define NUT_MAX_TTL          5            /* default maximum packet TTL */
 #define NUT_CONNECT_INTERVAL 2            /* reconnect to gnutella hosts */
 #define NUT_SEND_BUFSIZE     (1024 * 100) /* host list buffer size */
+#define NUT_MAX_PACKET       (1024 * 64)  /* maximum gnutella packet size */
 #define NUT_CONNECT_TIMEOUT  20           /* close connection then */
 #define NUT_ENTRY_AGE        (60 * 3)     /* maximum hash entry age */
 
@@ -248,8 +249,8 @@ int nut_detect_connect (svz_socket_t *sock);
 /* connection routine */
 int nut_connect_socket (svz_server_t *server, svz_socket_t *sock);
 
-/* check request routine */
-int nut_check_request (svz_socket_t *sock);
+/* request routine */
+int nut_handle_request (svz_socket_t *sock, char *request, int len);
 
 /* disconnection routine */
 int nut_disconnect (svz_socket_t *sock);
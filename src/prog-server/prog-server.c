@@ -46,6 +46,7 @@ prog_config_t prog_config =
   NULL,
   NULL,
   1,
+  0,
   1,
   40,
   NULL,
@@ -62,6 +63,7 @@ svz_key_value_pair_t prog_config_prototype [] =
   SVZ_REGISTER_STR ("user", prog_config.user, SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_STRARRAY ("argv", prog_config.argv, SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_BOOL ("do-fork", prog_config.fork, SVZ_ITEM_DEFAULTABLE),
+  SVZ_REGISTER_BOOL ("splice", prog_config.splice, SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_BOOL ("single-threaded",
                      prog_config.single_threaded, SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_INT ("thread-frequency",
@@ -168,7 +170,8 @@ prog_passthrough (svz_socket_t *sock)
   while (argc--)
     argv[argc] = svz_array_get (cfg->argv, argc);
   if ((pid = svz_sock_process (sock, cfg->bin, cfg->dir, argv, NULL,
-                               cfg->fork,
+                               cfg->fork ? 1
+                               : cfg->splice ? SVZ_PROCESS_SPLICE : 0,
                                cfg->user ? cfg->user :  SVZ_PROCESS_NONE)) < 0)
     {
       svz_log (SVZ_LOG_ERROR, "prog: cannot execute `%s'\n", cfg->bin);
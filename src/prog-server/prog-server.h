@@ -31,6 +31,7 @@ typedef struct
   char *user;          /* user[.group] or NULL.  */
   svz_array_t *argv;   /* Arguments for the executable.  Watch argv[0].  */
   int fork;            /* Flag: fork or shuffle for passthrough method.  */
+  int splice;          /* Flag: shuffle TCP connections through pipes.  */
   int single_threaded; /* Flag: single- or multi-threaded packet server.  */
   size_t frequency;    /* Maximum number of threads per minute.  */
   int (* check_request) (svz_socket_t *);
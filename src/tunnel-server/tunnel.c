@@ -23,9 +23,15 @@
 #include "timidity.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <time.h>
 
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
 #ifndef __MINGW32__
 # include <sys/socket.h>
 #endif
@@ -42,7 +48,13 @@ tnl_config_t tnl_config =
 {
   NULL, /* the source port to forward from */
   NULL, /* target port to forward to */
-  NULL  /* the source client socket hash */
+  NULL, /* the source client socket hash */
+  0,    /* no idle target connections by default */
+  0,    /* maximum number of idle target connections */
+  NULL, /* the idle target connections */
+  0,    /* pooled connections taken recently */
+  0,    /* no failed connections to the target yet */
+  0     /* time of the next connection attempt */
 };
 
 /*
@@ -52,6 +64,8 @@ svz_key_value_pair_t tnl_config_prototype [] =
 {
   SVZ_REGISTER_PORTCFG ("source", tnl_config.source, SVZ_ITEM_NOTDEFAULTABLE),
   SVZ_REGISTER_PORTCFG ("target", tnl_config.target, SVZ_ITEM_NOTDEFAULTABLE),
+  SVZ_REGISTER_INT ("pool-min", tnl_config.pool_min, SVZ_ITEM_DEFAULTABLE),
+  SVZ_REGISTER_INT ("pool-max", tnl_config.pool_max, SVZ_ITEM_DEFAULTABLE),
   SVZ_REGISTER_END ()
 };
 
@@ -70,7 +84,7 @@ svz_servertype_t tnl_server_definition =
   tnl_global_finalize,
   NULL,
   NULL,
-  NULL,
+  tnl_notify,
   NULL,
   tnl_handle_request_udp_source,
   SVZ_CONFIG_DEFINE ("tunnel", tnl_config, tnl_config_prototype)
@@ -140,6 +154,17 @@ tnl_init (svz_server_t *server)
   /* create source client hash (for UDP and ICMP only) */
   cfg->client = svz_hash_create (4, svz_free);
 
+  /* keep TCP target connections ready to use */
+  if (cfg->target->proto & SVZ_PROTO_TCP && cfg->pool_min > 0)
+    {
+      if (cfg->pool_max < cfg->pool_min)
+        cfg->pool_max = cfg->pool_min;
+      cfg->pool = svz_array_create (cfg->pool_max, NULL);
+      cfg->pool_demand = 0;
+      cfg->pool_backoff = 0;
+      cfg->pool_retry = 0;
+    }
+
   /* assign the appropriate handle request routine of the server */
   if (cfg->source->proto & SVZ_PROTO_UDP)
     server->handle_request = tnl_handle_request_udp_source;
@@ -160,6 +185,22 @@ tnl_finalize (svz_server_t *server)
   /* release source connection hash if necessary */
   svz_hash_destroy (cfg->client);
 
+  /* close the idle target connections */
+  if (cfg->pool)
+    {
+      svz_socket_t *xsock;
+      size_t n;
+
+      svz_array_foreach (cfg->pool, xsock, n)
+        {
+          xsock->disconnected_socket = NULL;
+          xsock->idle_func = NULL;
+          svz_sock_schedule_for_shutdown (xsock);
+        }
+      svz_array_destroy (cfg->pool);
+      cfg->pool = NULL;
+    }
+
   return 0;
 }
 
@@ -182,9 +223,18 @@ tnl_addr (svz_socket_t *sock)
 static void
 tnl_free_connect (svz_socket_t *sock)
 {
-  if (sock->data)
+  tnl_connect_t *connect = sock->data;
+
+  if (connect)
     {
-      svz_free (sock->data);
+#if HAVE_SPLICE
+      if (connect->pipe_desc[0] != -1)
+        {
+          close (connect->pipe_desc[0]);
+          close (connect->pipe_desc[1]);
+        }
+#endif /* HAVE_SPLICE */
+      svz_free (connect);
       sock->data = NULL;
     }
 }
@@ -199,15 +249,427 @@ tnl_create_connect (void)
 
   source = svz_malloc (sizeof (tnl_connect_t));
   memset (source, 0, sizeof (tnl_connect_t));
+  source->pipe_desc[0] = source->pipe_desc[1] = -1;
   return source;
 }
 
+#if HAVE_SPLICE
+
+/*
+ * Move the data available on the TCP socket @var{sock} through the
+ * kernel pipe @var{pipe_desc} into the TCP socket @var{xsock} without
+ * copying it to user space.  Whatever @var{xsock} does not take at once
+ * is put into its send buffer.  Return zero on success, -1 on errors and
+ * 1 if ‘splice’ does not work for these sockets.
+ */
+static int
+tnl_splice (svz_socket_t *sock, svz_socket_t *xsock, int *pipe_desc)
+{
+  ssize_t in, out = 0, n;
+
+  /* Never take more than fits into the send buffer of the target.  */
+  in = splice (sock->sock_desc, NULL, pipe_desc[1], NULL,
+               xsock->send_buffer_size - xsock->send_buffer_fill,
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (in < 0)
+    {
+      if (svz_socket_unavailable_error_p ())
+        return 0;
+      if (errno == EINVAL || errno == ENOSYS)
+        return 1;
+      svz_log_net_error ("tunnel: splice");
+      return -1;
+    }
+  if (in == 0)
+    {
+      svz_log (SVZ_LOG_ERROR, "tunnel: splice: no data on socket %d\n",
+               sock->sock_desc);
+      return -1;
+    }
+  sock->last_recv = time (NULL);
+
+  /* Pass the data on to the target.  */
+  while (out < in)
+    {
+      n = splice (pipe_desc[0], NULL, xsock->sock_desc, NULL, in - out,
+                  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n <= 0)
+        break;
+      xsock->last_send = time (NULL);
+      out += n;
+    }
+
+  /* Keep the rest for the target's usual write callback.  */
+  while (out < in)
+    {
+      n = read (pipe_desc[0], xsock->send_buffer + xsock->send_buffer_fill,
+                in - out);
+      if (n <= 0)
+        {
+          svz_log_sys_error ("tunnel: read");
+          return -1;
+        }
+      xsock->send_buffer_fill += n;
+      out += n;
+    }
+  return 0;
+}
+
+/*
+ * The ‘read_socket’ callback of both ends of TCP to TCP tunnels.  Relay
+ * the data directly to the other end when possible.  Fall back to the
+ * buffered path as long as there is data queued for the other end
+ * (keeping the byte order), that end is not yet connected or codecs
+ * are involved.
+ */
+static int
+tnl_read_socket_tcp (svz_socket_t *sock)
+{
+  tnl_connect_t *connect = sock->data;
+  svz_socket_t *xsock = NULL;
+  int ret;
+
+  if (connect && connect->pipe_desc[0] != -1)
+    xsock = (sock == connect->source_sock)
+      ? connect->target_sock : connect->source_sock;
+
+  if (xsock && sock->recv_buffer_fill == 0 && xsock->send_buffer_fill == 0
+      && xsock->send_buffer_size > 0 && (xsock->flags & SVZ_SOFLG_CONNECTED)
+      && !(xsock->flags & SVZ_SOFLG_KILLED)
+      && !sock->recv_codec && !xsock->send_codec)
+    {
+      if ((ret = tnl_splice (sock, xsock, connect->pipe_desc)) <= 0)
+        return ret;
+
+      /* ‘splice’ is not supported, use the buffered path from now on.  */
+      svz_log (SVZ_LOG_NOTICE, "tunnel: splice not supported\n");
+      close (connect->pipe_desc[0]);
+      close (connect->pipe_desc[1]);
+      connect->pipe_desc[0] = connect->pipe_desc[1] = -1;
+    }
+  return svz_tcp_read_socket (sock);
+}
+
+/*
+ * Set up the kernel pipe of the TCP to TCP tunnel @var{connect} and make
+ * both of its ends use it.
+ */
+static void
+tnl_splice_setup (tnl_connect_t *connect)
+{
+  int *fd = connect->pipe_desc;
+
+  if (pipe (fd) == -1)
+    {
+      svz_log_sys_error ("tunnel: pipe");
+      return;
+    }
+  if (fcntl (fd[0], F_SETFL, O_NONBLOCK) == -1
+      || fcntl (fd[1], F_SETFL, O_NONBLOCK) == -1
+      || svz_fd_cloexec (fd[0]) || svz_fd_cloexec (fd[1]))
+    {
+      svz_log_sys_error ("tunnel: fcntl");
+      close (fd[0]);
+      close (fd[1]);
+      fd[0] = fd[1] = -1;
+      return;
+    }
+  connect->source_sock->read_socket = tnl_read_socket_tcp;
+  connect->target_sock->read_socket = tnl_read_socket_tcp;
+
+  /* Flush queued data at once so the relay gets back to ‘splice’.  */
+  if (connect->source_sock->write_budget == 0)
+    connect->source_sock->write_budget = connect->source_sock->send_buffer_size;
+  if (connect->target_sock->write_budget == 0)
+    connect->target_sock->write_budget = connect->target_sock->send_buffer_size;
+}
+
+#endif /* HAVE_SPLICE */
+
 static void
 resize_buffers (svz_socket_t *sock)
 {
   svz_sock_resize_buffers (sock, SVZ_UDP_BUF_SIZE, SVZ_UDP_BUF_SIZE);
 }
 
+/*
+ * Return the other end of the TCP or pipe tunnel @var{sock} belongs to
+ * or NULL if it has gone.
+ */
+static svz_socket_t *
+tnl_peer (svz_socket_t *sock)
+{
+  tnl_connect_t *connect = sock->data;
+
+  if (connect == NULL)
+    return NULL;
+  return (sock == connect->source_sock)
+    ? connect->target_sock : connect->source_sock;
+}
+
+/*
+ * The ‘high_water’ callback of stream tunnel ends.  Stop reading from
+ * the other end until this one has drained its send buffer.
+ */
+static int
+tnl_high_water (svz_socket_t *sock)
+{
+  svz_socket_t *xsock = tnl_peer (sock);
+
+  if (xsock)
+    svz_sock_pause_read (xsock);
+  return 0;
+}
+
+/*
+ * The ‘low_water’ callback of stream tunnel ends.  Continue reading from
+ * the other end and pass on what it could not forward before.
+ */
+static int
+tnl_low_water (svz_socket_t *sock)
+{
+  svz_socket_t *xsock = tnl_peer (sock);
+
+  if (xsock)
+    {
+      svz_sock_resume_read (xsock);
+      if (xsock->recv_buffer_fill > 0 && xsock->check_request (xsock))
+        svz_sock_schedule_for_shutdown (xsock);
+    }
+  return 0;
+}
+
+/*
+ * Make the TCP or pipe tunnel ends @var{sock} and @var{xsock} throttle
+ * each other: whenever one of them cannot send as fast as the other one
+ * receives, reading from the latter pauses.
+ */
+static void
+tnl_setup_backpressure (svz_socket_t *sock, svz_socket_t *xsock)
+{
+  sock->high_water = xsock->high_water = tnl_high_water;
+  sock->low_water = xsock->low_water = tnl_low_water;
+  svz_sock_setwater (sock, sock->send_buffer_size / 4,
+                     sock->send_buffer_size / 2);
+  svz_sock_setwater (xsock, xsock->send_buffer_size / 4,
+                     xsock->send_buffer_size / 2);
+}
+
+/*
+ * Return how many bytes of the receive buffer of @var{sock} can be
+ * passed on to @var{xsock}.  If @var{xsock} is a TCP or pipe connection
+ * (according to the userflags of @var{sock} matching @var{stream}) this
+ * is limited by the free space in its send buffer.  Reading from
+ * @var{sock} is paused if not all of the data fits.
+ */
+static int
+tnl_forward_len (svz_socket_t *sock, svz_socket_t *xsock, int stream)
+{
+  int len = sock->recv_buffer_fill;
+  int space;
+
+  if (sock->userflags & stream)
+    {
+      space = xsock->send_buffer_size - xsock->send_buffer_fill - 1;
+      if (len > space)
+        {
+          len = space > 0 ? space : 0;
+          svz_sock_pause_read (sock);
+        }
+    }
+  return len;
+}
+
+/*
+ * The ‘check_request’ callback of pooled target connections.  Keep
+ * whatever the target sends until a source connection takes it over.
+ */
+static int
+tnl_check_request_pool (UNUSED svz_socket_t *sock)
+{
+  return 0;
+}
+
+/*
+ * Remove the target connection @var{sock} from the pool of idle
+ * connections of its tunnel server.  Return non-zero if it was there.
+ */
+static int
+tnl_pool_remove (svz_socket_t *sock)
+{
+  tnl_config_t *cfg = sock->cfg;
+  svz_socket_t *xsock;
+  size_t n;
+
+  svz_array_foreach (cfg->pool, xsock, n)
+    if (xsock == sock)
+      {
+        svz_array_del (cfg->pool, n);
+        return 1;
+      }
+  return 0;
+}
+
+/*
+ * Note a failed connection to the target of the tunnel server
+ * configuration @var{cfg}.  Each failure in a row doubles the time
+ * until the pool is filled again, up to @code{TNL_MAX_BACKOFF} seconds.
+ */
+static void
+tnl_pool_failed (tnl_config_t *cfg)
+{
+  if (cfg->pool_backoff == 0)
+    cfg->pool_backoff = 1;
+  else if (cfg->pool_backoff < TNL_MAX_BACKOFF)
+    cfg->pool_backoff *= 2;
+  cfg->pool_retry = time (NULL) + cfg->pool_backoff;
+}
+
+/*
+ * The disconnection routine of pooled target connections.
+ */
+static int
+tnl_disconnect_pool (svz_socket_t *sock)
+{
+  tnl_pool_remove (sock);
+  if (sock->flags & SVZ_SOFLG_CONNECTING)
+    tnl_pool_failed (sock->cfg);
+  return 0;
+}
+
+/*
+ * The idle function of pooled target connections.  Drop connections
+ * which could not be established in time, and those exceeding the
+ * minimum number of idle connections once a burst has passed.
+ */
+static int
+tnl_idle_pool (svz_socket_t *sock)
+{
+  tnl_config_t *cfg = sock->cfg;
+
+  if (sock->flags & SVZ_SOFLG_CONNECTING
+      || (int) svz_array_size (cfg->pool) > cfg->pool_min)
+    {
+#if ENABLE_DEBUG
+      svz_log (SVZ_LOG_DEBUG, "tunnel: dropping pooled connection id %d\n",
+               sock->id);
+#endif /* ENABLE_DEBUG */
+      tnl_pool_remove (sock);
+      svz_sock_schedule_for_shutdown (sock);
+      return 0;
+    }
+  sock->idle_counter = TNL_TIMEOUT;
+  return 0;
+}
+
+/*
+ * Connect to the TCP target of the tunnel server configuration @var{cfg}
+ * until there are @var{count} idle connections in its pool.  After a
+ * failure only a single connection probes the target, once the backoff
+ * time has passed.
+ */
+static void
+tnl_pool_fill (tnl_config_t *cfg, int count)
+{
+  struct sockaddr_in *addr = svz_portcfg_addr (cfg->target);
+  svz_address_t *ip;
+  svz_socket_t *xsock;
+  int connecting = 0;
+  size_t n;
+  char buf[64];
+
+  /* any established connection means the target is reachable */
+  svz_array_foreach (cfg->pool, xsock, n)
+    if (xsock->flags & SVZ_SOFLG_CONNECTING)
+      connecting++;
+    else
+      cfg->pool_backoff = 0;
+
+  if ((int) svz_array_size (cfg->pool) >= count)
+    return;
+  if (cfg->pool_backoff > 0)
+    {
+      if (connecting > 0 || time (NULL) < cfg->pool_retry)
+        return;
+      count = svz_array_size (cfg->pool) + 1;
+    }
+
+  ip = svz_address_make (AF_INET, &addr->sin_addr.s_addr);
+  while ((int) svz_array_size (cfg->pool) < count)
+    {
+      if ((xsock = svz_tcp_connect (ip, addr->sin_port)) == NULL)
+        {
+          /* report only the first of the failures in a row */
+          if (cfg->pool_backoff == 0)
+            svz_log (SVZ_LOG_ERROR, "tunnel: tcp: cannot connect to %s\n",
+                     SVZ_PP_ADDR_PORT (buf, ip, addr->sin_port));
+          tnl_pool_failed (cfg);
+          break;
+        }
+      xsock->cfg = cfg;
+      xsock->flags |= SVZ_SOFLG_NOFLOOD;
+      xsock->check_request = tnl_check_request_pool;
+      xsock->disconnected_socket = tnl_disconnect_pool;
+      xsock->idle_func = tnl_idle_pool;
+      xsock->idle_counter = TNL_TIMEOUT;
+      resize_buffers (xsock);
+      svz_array_add (cfg->pool, xsock);
+    }
+  svz_free (ip);
+}
+
+/*
+ * Take an established idle target connection out of the pool of the
+ * tunnel server configuration @var{cfg} and connect a replacement.
+ * Return NULL if there is none, letting the caller connect directly:
+ * that is no slower than a pooled connection still connecting, and
+ * does not hand out one which may yet fail.
+ */
+static svz_socket_t *
+tnl_pool_get (tnl_config_t *cfg)
+{
+  svz_socket_t *xsock = NULL;
+  size_t n;
+
+  cfg->pool_demand++;
+  for (n = 0; n < svz_array_size (cfg->pool); n++)
+    {
+      xsock = svz_array_get (cfg->pool, n);
+      if (!(xsock->flags & (SVZ_SOFLG_KILLED | SVZ_SOFLG_CONNECTING)))
+        break;
+      xsock = NULL;
+    }
+  if (xsock)
+    {
+      svz_array_del (cfg->pool, n);
+      xsock->idle_func = NULL;
+    }
+  tnl_pool_fill (cfg, cfg->pool_min);
+  return xsock;
+}
+
+/*
+ * The tunnel server's timer routine.  Keep enough idle TCP target
+ * connections for the connection rate of the last second, within the
+ * configured bounds.
+ */
+int
+tnl_notify (svz_server_t *server)
+{
+  tnl_config_t *cfg = server->cfg;
+  int count;
+
+  if (cfg->pool == NULL)
+    return 0;
+
+  count = cfg->pool_min + cfg->pool_demand;
+  if (count > cfg->pool_max)
+    count = cfg->pool_max;
+  cfg->pool_demand = 0;
+  tnl_pool_fill (cfg, count);
+  return 0;
+}
+
 /*
  * Depending on the given socket structure target flag this routine
  * tries to connect to the servers target configuration and delivers a
@@ -257,16 +719,23 @@ tnl_create_socket (svz_socket_t *sock, int source)
   /* target is a TCP connection */
   if (sock->userflags & TNL_FLAG_TGT_TCP)
     {
-      if ((xsock = svz_tcp_connect (ip, port)) == NULL)
+      if ((xsock = tnl_pool_get (cfg)) != NULL)
+        {
+#if ENABLE_DEBUG
+          svz_log (SVZ_LOG_DEBUG, "tunnel: tcp: using pooled connection "
+                   "id %d\n", xsock->id);
+#endif /* ENABLE_DEBUG */
+        }
+      else if ((xsock = svz_tcp_connect (ip, port)) == NULL)
         {
           svz_log (SVZ_LOG_ERROR, "tunnel: tcp: cannot connect to %s\n",
                    SVZ_PP_ADDR_PORT (buf, ip, port));
           goto unlucky;
         }
-
 #if ENABLE_DEBUG
-      svz_log (SVZ_LOG_DEBUG, "tunnel: tcp: connecting to %s\n",
-               SVZ_PP_ADDR_PORT (buf, ip, port));
+      else
+        svz_log (SVZ_LOG_DEBUG, "tunnel: tcp: connecting to %s\n",
+                 SVZ_PP_ADDR_PORT (buf, ip, port));
 #endif /* ENABLE_DEBUG */
       xsock->check_request = tnl_check_request_tcp_target;
       resize_buffers (xsock);
@@ -447,6 +916,20 @@ tnl_connect_socket (UNUSED svz_server_t *server, svz_socket_t *sock)
   xsock->data = source;
   sock->data = source;
 
+  /* throttle each end to what the other one can send */
+  if (sock->userflags & (TNL_FLAG_TGT_TCP | TNL_FLAG_TGT_PIPE))
+    tnl_setup_backpressure (sock, xsock);
+
+  /* pass on what a pooled target connection has received already */
+  if (xsock->recv_buffer_fill > 0 && xsock->check_request (xsock))
+    return -1;
+
+#if HAVE_SPLICE
+  /* relay TCP to TCP tunnels in the kernel */
+  if ((sock->userflags & TNL_FLAG_TGT_TCP) && !(sock->flags & SVZ_SOFLG_PIPE))
+    tnl_splice_setup (source);
+#endif /* HAVE_SPLICE */
+
   return 0;
 }
 
@@ -460,6 +943,7 @@ tnl_check_request_tcp_target (svz_socket_t *sock)
 {
   svz_socket_t *xsock = NULL;
   tnl_connect_t *source = sock->data;
+  int len;
 
 #if ENABLE_DEBUG
   if (source == NULL || source->source_sock == NULL)
@@ -475,15 +959,16 @@ tnl_check_request_tcp_target (svz_socket_t *sock)
   xsock->remote_port = source->port;
 
   /* forward data to source connection */
+  len = tnl_forward_len (sock, xsock, TNL_FLAG_SRC_TCP | TNL_FLAG_SRC_PIPE);
   if (tnl_send_request_target (xsock, sock->recv_buffer,
-                               sock->recv_buffer_fill, sock->userflags) == -1)
+                               len, sock->userflags) == -1)
     {
       svz_sock_schedule_for_shutdown (xsock);
       return -1;
     }
 
   /* empty the receive buffer of this target connection */
-  sock->recv_buffer_fill = 0;
+  svz_sock_reduce_recv (sock, len);
   return 0;
 }
 
@@ -497,6 +982,7 @@ tnl_check_request_tcp_source (svz_socket_t *sock)
 {
   tnl_connect_t *target = sock->data;
   svz_socket_t *xsock;
+  int len;
 
 #if ENABLE_DEBUG
   if (target == NULL || target->target_sock == NULL)
@@ -510,13 +996,14 @@ tnl_check_request_tcp_source (svz_socket_t *sock)
   xsock = target->target_sock;
 
   /* forward data to target connection */
+  len = tnl_forward_len (sock, xsock, TNL_FLAG_TGT_TCP | TNL_FLAG_TGT_PIPE);
   if (tnl_send_request_source (xsock, sock->recv_buffer,
-                               sock->recv_buffer_fill, sock->userflags) == -1)
+                               len, sock->userflags) == -1)
     {
       return -1;
     }
 
-  sock->recv_buffer_fill = 0;
+  svz_sock_reduce_recv (sock, len);
   return 0;
 }
 
@@ -29,6 +29,12 @@ typedef struct
   svz_portcfg_t *source; /* the source port to forward from */
   svz_portcfg_t *target; /* target port to forward to */
   svz_hash_t *client;    /* source client hash */
+  int pool_min;          /* idle TCP target connections to keep */
+  int pool_max;          /* maximum number of idle target connections */
+  svz_array_t *pool;     /* idle TCP target connections */
+  int pool_demand;       /* pooled connections taken since last notify */
+  int pool_backoff;      /* seconds to wait after failed connections */
+  time_t pool_retry;     /* time of the next connection attempt */
 }
 tnl_config_t;
 
@@ -39,11 +45,13 @@ typedef struct
   in_port_t port;            /* port to send to */
   svz_socket_t *source_sock; /* source socket structure */
   svz_socket_t *target_sock; /* target socket */
+  int pipe_desc[2];          /* kernel pipe for TCP to TCP relays */
 }
 tnl_connect_t;
 
 /* tunnel server specific protocol flags */
 #define TNL_TIMEOUT       30
+#define TNL_MAX_BACKOFF   64
 
 /* flags for targets */
 #define TNL_FLAG_SRC_TCP  0x0001
@@ -67,6 +75,7 @@ tnl_connect_t;
 int tnl_init (svz_server_t *server);
 int tnl_global_init (svz_servertype_t *server);
 int tnl_finalize (svz_server_t *server);
+int tnl_notify (svz_server_t *server);
 int tnl_global_finalize (svz_servertype_t *server);
 
 /* Rest of all the callbacks.  */